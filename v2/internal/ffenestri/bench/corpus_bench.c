@@ -0,0 +1,277 @@
+/*
+ * Corpus benchmarks for the portable C helpers in ffenestri.
+ *
+ * Every payload in corpus/ is decoded, encoded, searched with the common.c
+ * getters and round-tripped, and each result reports time, throughput and
+ * allocations per operation.  See README.md for how to build and run them.
+ *
+ * run.sh also builds this file against older trees, so it sticks to what
+ * the baseline json.h and common.h offer unless told otherwise:
+ * JSONKEY comes with json_intern, and run.sh defines NO_HASH_TEXT when the
+ * tree has no json_hash_text.
+ */
+
+#include "../common.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+static const char *const corpus[] = {
+	"application_menu",
+	"tray_menu",
+	"tray_label_update",
+	"context_menu",
+	"bindings",
+};
+
+/*
+ * Allocation counters.  With glibc the functions below replace the system
+ * allocator for the whole process, json.c included, and count every call.
+ * Elsewhere the counters stay at zero and the B/op and allocs/op columns
+ * are left out.
+ */
+
+static size_t alloc_count, alloc_bytes;
+
+#ifdef __GLIBC__
+#define COUNT_ALLOCS
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+void *malloc(size_t size)
+{
+	alloc_count++;
+	alloc_bytes += size;
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size)
+{
+	alloc_count++;
+	alloc_bytes += count * size;
+	return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	alloc_count++;
+	alloc_bytes += size;
+	return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr)
+{
+	__libc_free(ptr);
+}
+#endif
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+typedef void (*BenchFn)(void *arg);
+
+/*
+ * Runs @fn until at least half a second has passed and prints the result in
+ * the format used by `go test -bench -benchmem`, so the output works with
+ * benchstat.  @bytes is the amount of input processed by one call, or 0.
+ */
+static void run(const char *name, BenchFn fn, void *arg, size_t bytes)
+{
+	size_t count, allocated;
+	long n = 1, i;
+	double elapsed;
+
+	for (;;) {
+		double start = now();
+		count = alloc_count;
+		allocated = alloc_bytes;
+		for (i = 0; i < n; i++)
+			fn(arg);
+		elapsed = now() - start;
+		count = alloc_count - count;
+		allocated = alloc_bytes - allocated;
+		if (elapsed >= 0.5 || n >= 1000000000L)
+			break;
+		n = elapsed > 0 ? (long)(n * 0.6 / elapsed) + 1 : n * 100;
+	}
+
+	printf("Benchmark%s\t%10ld\t%12.0f ns/op", name, n, elapsed * 1e9 / n);
+	if (bytes > 0)
+		printf("\t%8.2f MB/s", bytes * n / elapsed / 1e6);
+#ifdef COUNT_ALLOCS
+	printf("\t%8zu B/op\t%6zu allocs/op", allocated / n, count / n);
+#else
+	(void) count;
+	(void) allocated;
+#endif
+	printf("\n");
+}
+
+static char *read_file(const char *path, size_t *size)
+{
+	FILE *f = fopen(path, "rb");
+	char *data;
+	long len;
+
+	if (f == NULL || fseek(f, 0, SEEK_END) != 0 || (len = ftell(f)) < 0) {
+		perror(path);
+		exit(1);
+	}
+	rewind(f);
+	data = malloc(len + 1);
+	if (data == NULL || fread(data, 1, len, f) != (size_t) len) {
+		perror(path);
+		exit(1);
+	}
+	data[len] = 0;
+	fclose(f);
+	*size = len;
+	return data;
+}
+
+static void bench_decode(void *input)
+{
+	json_delete(json_decode(input));
+}
+
+static void bench_encode(void *node)
+{
+	free(json_encode(node));
+}
+
+#ifndef NO_HASH_TEXT
+/* What an update that has not changed costs when it is recognised by its hash. */
+static void bench_hash_text(void *input)
+{
+	volatile uint64_t hash = json_hash_text(input);
+	(void) hash;
+}
+#endif
+
+/* What a message goes through when the native side logs or forwards it. */
+static void bench_round_trip(void *input)
+{
+	JsonNode *node = json_decode(input);
+
+	free(json_encode(node));
+	json_delete(node);
+}
+
+/* One read of a member through the getters the native code uses. */
+typedef struct {
+	JsonNode *object;
+	const char *key;
+	JsonTag tag;
+} Lookup;
+
+typedef vec_t(Lookup) LookupVec;
+
+/* Collects a lookup for every member of every object below @node. */
+static void collect_lookups(JsonNode *node, LookupVec *lookups)
+{
+	JsonNode *child;
+
+	json_foreach(child, node) {
+		if (node->tag == JSON_OBJECT) {
+#ifdef JSONKEY
+			Lookup lookup = {node, json_intern(child->key), child->tag};
+#else
+			Lookup lookup = {node, child->key, child->tag};
+#endif
+			vec_push(lookups, lookup);
+		}
+		collect_lookups(child, lookups);
+	}
+}
+
+static void bench_lookup(void *arg)
+{
+	LookupVec *lookups = arg;
+	size_t found = 0;
+	bool b;
+	int n;
+	int i;
+
+	for (i = 0; i < lookups->length; i++) {
+		Lookup *lookup = &lookups->data[i];
+		switch (lookup->tag) {
+		case JSON_STRING:
+			found += *getJSONString(lookup->object, lookup->key) != 0;
+			break;
+		case JSON_BOOL:
+			found += getJSONBool(lookup->object, lookup->key, &b);
+			break;
+		case JSON_NUMBER:
+			found += getJSONInt(lookup->object, lookup->key, &n);
+			break;
+		default:
+			found += getJSONObject(lookup->object, lookup->key) != NULL;
+		}
+	}
+	if (found == 0 && lookups->length > 0)
+		abort();
+}
+
+int main(int argc, char **argv)
+{
+	const char *dir = argc > 1 ? argv[1] : "corpus";
+	char path[1024], name[128];
+	size_t i;
+
+	for (i = 0; i < sizeof(corpus) / sizeof(corpus[0]); i++) {
+		LookupVec lookups;
+		JsonNode *node;
+		char *input, *encoded, *again;
+		size_t size;
+
+		snprintf(path, sizeof(path), "%s/%s.json", dir, corpus[i]);
+		input = read_file(path, &size);
+
+		/* Every payload has to survive a round trip before it is timed. */
+		node = json_decode(input);
+		if (node == NULL || !json_check(node, NULL)) {
+			fprintf(stderr, "%s: invalid JSON\n", path);
+			exit(1);
+		}
+		encoded = json_encode(node);
+		json_delete(node);
+		node = json_decode(encoded);
+		again = json_encode(node);
+		if (strcmp(encoded, again) != 0) {
+			fprintf(stderr, "%s: round trip differs\n", path);
+			exit(1);
+		}
+		free(encoded);
+		free(again);
+
+		snprintf(name, sizeof(name), "Decode/%s", corpus[i]);
+		run(name, bench_decode, input, size);
+		snprintf(name, sizeof(name), "Encode/%s", corpus[i]);
+		run(name, bench_encode, node, size);
+		snprintf(name, sizeof(name), "RoundTrip/%s", corpus[i]);
+		run(name, bench_round_trip, input, size);
+#ifndef NO_HASH_TEXT
+		snprintf(name, sizeof(name), "HashText/%s", corpus[i]);
+		run(name, bench_hash_text, input, size);
+#endif
+
+		vec_init(&lookups);
+		collect_lookups(node, &lookups);
+		snprintf(name, sizeof(name), "Lookup/%s", corpus[i]);
+		run(name, bench_lookup, &lookups, 0);
+		vec_deinit(&lookups);
+
+		json_delete(node);
+		free(input);
+	}
+
+	return 0;
+}
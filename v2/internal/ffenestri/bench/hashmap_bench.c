@@ -0,0 +1,298 @@
+/*
+ * Benchmarks for hashmap.h, keyed the way the native menu code uses it.
+ *
+ * Only the public hashmap.h API is used, so run.sh can build this file
+ * against older versions of the table to compare the two.
+ */
+
+#include "../hashmap.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Versions from before hashmap_create_owned run the Owned benchmarks with
+ * a map that borrows its keys. */
+#ifndef HASHMAP_INLINE_KEY_SIZE
+#define hashmap_create_owned hashmap_create
+#endif
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+typedef void (*BenchFn)(void *arg);
+
+/*
+ * Runs @fn until at least half a second has passed and prints the result in
+ * the format used by `go test -bench`, so the output works with benchstat.
+ */
+static void run(const char *name, BenchFn fn, void *arg)
+{
+	long n = 1, i;
+	double elapsed;
+
+	for (;;) {
+		double start = now();
+		for (i = 0; i < n; i++)
+			fn(arg);
+		elapsed = now() - start;
+		if (elapsed >= 0.5 || n >= 1000000000L)
+			break;
+		n = elapsed > 0 ? (long)(n * 0.6 / elapsed) + 1 : n * 100;
+	}
+
+	printf("Benchmark%s\t%10ld\t%12.0f ns/op\n", name, n, elapsed * 1e9 / n);
+}
+
+/* A set of keys and a map holding all of them. */
+typedef struct {
+	int count;
+	char **keys;
+	unsigned *lengths;
+	char **missing;
+	/* Copies of the keys to look them up with, as the native code looks
+	 * items up by IDs that come from elsewhere than the keys it put. */
+	char **lookups;
+	struct hashmap_s map;
+	/* The same keys in a map that keeps its own copies of them. */
+	struct hashmap_s owned;
+} Keys;
+
+/*
+ * The key shapes the native code uses: menu item IDs, which are the decimal
+ * strings the menu manager hands out, icon names for the tray and dialog
+ * icon caches, and long keys such as the members of bound struct types.
+ */
+typedef struct {
+	const char *name;
+	const char *format;
+} KeyShape;
+
+static const KeyShape shapes[] = {
+	{"ids", "%d"},
+	{"names", "dialog-icon-%d-dark@2x"},
+	{"long", "main.App.SomeLongPackageName.SomeBoundStructWithALongName.MethodNumber%d"},
+};
+
+/* The menu builders create their maps with 16 slots. */
+static void make_keys(Keys *k, const char *format, int count)
+{
+	char buffer[128];
+	int i;
+
+	k->count = count;
+	k->keys = malloc(count * sizeof(char*));
+	k->lengths = malloc(count * sizeof(unsigned));
+	k->missing = malloc(count * sizeof(char*));
+	k->lookups = malloc(count * sizeof(char*));
+	for (i = 0; i < count; i++) {
+		snprintf(buffer, sizeof(buffer), format, i);
+		k->keys[i] = strdup(buffer);
+		k->lengths[i] = strlen(buffer);
+		snprintf(buffer, sizeof(buffer), format, count + i);
+		k->missing[i] = strdup(buffer);
+	}
+	for (i = 0; i < count; i++)
+		k->lookups[i] = strdup(k->keys[i]);
+
+	if (hashmap_create(16, &k->map) != 0 || hashmap_create_owned(16, &k->owned) != 0)
+		abort();
+	for (i = 0; i < count; i++) {
+		hashmap_put(&k->map, k->keys[i], k->lengths[i], k->keys[i]);
+		hashmap_put(&k->owned, k->keys[i], k->lengths[i], k->keys[i]);
+	}
+}
+
+/* Building a menu: a new map with every item put into it. */
+static void bench_put(void *arg)
+{
+	Keys *k = arg;
+	struct hashmap_s map;
+	int i;
+
+	if (hashmap_create(16, &map) != 0)
+		abort();
+	for (i = 0; i < k->count; i++)
+		hashmap_put(&map, k->keys[i], k->lengths[i], k->keys[i]);
+	hashmap_destroy(&map);
+}
+
+/* Building a store that copies its keys, such as trayMenuMap. */
+static void bench_put_owned(void *arg)
+{
+	Keys *k = arg;
+	struct hashmap_s map;
+	int i;
+
+	if (hashmap_create_owned(16, &map) != 0)
+		abort();
+	for (i = 0; i < k->count; i++)
+		hashmap_put(&map, k->keys[i], k->lengths[i], k->keys[i]);
+	hashmap_destroy(&map);
+}
+
+/* Menu item callbacks and radio groups looking up their items. */
+static void bench_get(void *arg)
+{
+	Keys *k = arg;
+	int i;
+
+	for (i = 0; i < k->count; i++)
+		if (hashmap_get(&k->map, k->lookups[i], k->lengths[i]) != k->keys[i])
+			abort();
+}
+
+static void bench_get_owned(void *arg)
+{
+	Keys *k = arg;
+	int i;
+
+	for (i = 0; i < k->count; i++)
+		if (hashmap_get(&k->owned, k->lookups[i], k->lengths[i]) != k->keys[i])
+			abort();
+}
+
+static void bench_get_miss(void *arg)
+{
+	Keys *k = arg;
+	int i;
+
+	for (i = 0; i < k->count; i++)
+		if (hashmap_get(&k->map, k->missing[i], strlen(k->missing[i])) != NULL)
+			abort();
+}
+
+/* A store replacing its menus, as trayMenuMap does on every update. */
+static void bench_replace(void *arg)
+{
+	Keys *k = arg;
+	int i;
+
+	for (i = 0; i < k->count; i++) {
+		hashmap_remove(&k->map, k->keys[i], k->lengths[i]);
+		hashmap_put(&k->map, k->keys[i], k->lengths[i], k->keys[i]);
+	}
+}
+
+static void bench_replace_owned(void *arg)
+{
+	Keys *k = arg;
+	int i;
+
+	for (i = 0; i < k->count; i++) {
+		hashmap_remove(&k->owned, k->keys[i], k->lengths[i]);
+		hashmap_put(&k->owned, k->keys[i], k->lengths[i], k->keys[i]);
+	}
+}
+
+static int visit(void *const context, struct hashmap_element_s *const e)
+{
+	(*(size_t*) context) += e->key_len;
+	return 0;
+}
+
+/*
+ * The callbacks the native code iterates with live in other files, so the
+ * compiler must not be able to inline visit into the iteration either.
+ */
+static int (*volatile visitor)(void *const, struct hashmap_element_s *const) = visit;
+
+static void bench_iterate(void *arg)
+{
+	Keys *k = arg;
+	volatile size_t total = 0;
+	size_t sum = 0;
+
+	hashmap_iterate_pairs(&k->map, visitor, &sum);
+	total = sum;
+	(void) total;
+}
+
+/* A long-lived store that has had most of its items taken out again. */
+static void drain_keys(Keys *k)
+{
+	int i;
+
+	for (i = 0; i < k->count; i++)
+		if (i % 8 != 0)
+			hashmap_remove(&k->map, k->keys[i], k->lengths[i]);
+}
+
+/* Looking up every key of a drained store, most of which are gone. */
+static void bench_get_drained(void *arg)
+{
+	Keys *k = arg;
+	int found = 0;
+	int i;
+
+	for (i = 0; i < k->count; i++)
+		found += hashmap_get(&k->map, k->keys[i], k->lengths[i]) != NULL;
+	if (found != (k->count + 7) / 8)
+		abort();
+}
+
+static void free_keys(Keys *k)
+{
+	int i;
+
+	for (i = 0; i < k->count; i++) {
+		free(k->keys[i]);
+		free(k->missing[i]);
+		free(k->lookups[i]);
+	}
+	free(k->keys);
+	free(k->lengths);
+	free(k->missing);
+	free(k->lookups);
+	hashmap_destroy(&k->map);
+	hashmap_destroy(&k->owned);
+}
+
+int main(void)
+{
+	static const int sizes[] = {4, 16, 256, 4096};
+	char name[128];
+	size_t i, j;
+
+	for (j = 0; j < sizeof(shapes) / sizeof(shapes[0]); j++) {
+		for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+			const char *shape = shapes[j].name;
+			Keys k;
+
+			make_keys(&k, shapes[j].format, sizes[i]);
+
+			snprintf(name, sizeof(name), "HashmapPut/%s/%d", shape, k.count);
+			run(name, bench_put, &k);
+			snprintf(name, sizeof(name), "HashmapGet/%s/%d", shape, k.count);
+			run(name, bench_get, &k);
+			snprintf(name, sizeof(name), "HashmapGetMiss/%s/%d", shape, k.count);
+			run(name, bench_get_miss, &k);
+			snprintf(name, sizeof(name), "HashmapReplace/%s/%d", shape, k.count);
+			run(name, bench_replace, &k);
+			snprintf(name, sizeof(name), "HashmapIterate/%s/%d", shape, k.count);
+			run(name, bench_iterate, &k);
+			snprintf(name, sizeof(name), "HashmapPutOwned/%s/%d", shape, k.count);
+			run(name, bench_put_owned, &k);
+			snprintf(name, sizeof(name), "HashmapGetOwned/%s/%d", shape, k.count);
+			run(name, bench_get_owned, &k);
+			snprintf(name, sizeof(name), "HashmapReplaceOwned/%s/%d", shape, k.count);
+			run(name, bench_replace_owned, &k);
+
+			drain_keys(&k);
+			snprintf(name, sizeof(name), "HashmapGetDrained/%s/%d", shape, k.count);
+			run(name, bench_get_drained, &k);
+			snprintf(name, sizeof(name), "HashmapIterateDrained/%s/%d", shape, k.count);
+			run(name, bench_iterate, &k);
+
+			free_keys(&k);
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,935 @@
+/*
+ * Benchmarks for the portable JSON helpers in ffenestri.
+ *
+ * See README.md for how to build and run them.
+ */
+
+#include "../json.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Growable text buffer used to synthesise payloads */
+
+typedef struct {
+	char *data;
+	size_t len;
+	size_t cap;
+} Text;
+
+static void text_printf(Text *t, const char *format, ...)
+{
+	va_list args;
+	int n;
+
+	for (;;) {
+		va_start(args, format);
+		n = vsnprintf(t->data + t->len, t->cap - t->len, format, args);
+		va_end(args);
+		if (n >= 0 && (size_t)n < t->cap - t->len)
+			break;
+		t->cap = t->cap ? t->cap * 2 : 4096;
+		t->data = realloc(t->data, t->cap);
+	}
+	t->len += n;
+}
+
+/*
+ * Builds an application menu in the shape produced by menumanager.WailsMenu:
+ * @menus top level submenus holding @items items each, with a mix of text,
+ * checkbox and radio items, accelerators and a few nested submenus.
+ */
+static char *make_menu_json(int menus, int items)
+{
+	Text t = {NULL, 0, 0};
+	int id = 0;
+	int m, i;
+
+	text_printf(&t, "{\"Menu\":{\"Items\":[");
+	for (m = 0; m < menus; m++) {
+		text_printf(&t, "%s{\"ID\":\"%d\",\"Label\":\"Menu %d\",\"Type\":\"Submenu\",\"SubMenu\":{\"Items\":[",
+			m ? "," : "", id++, m);
+		for (i = 0; i < items; i++) {
+			const char *sep = i ? "," : "";
+			switch (i % 5) {
+			case 0:
+				text_printf(&t, "%s{\"ID\":\"%d\",\"Label\":\"Open Recent File %d.txt\",\"Accelerator\":{\"Key\":\"%c\",\"Modifiers\":[\"CmdOrCtrl\",\"Shift\"]},\"Type\":\"Text\"}",
+					sep, id++, i, 'a' + i % 26);
+				break;
+			case 1:
+				text_printf(&t, "%s{\"ID\":\"%d\",\"Label\":\"Show Toolbar %d\",\"Type\":\"Checkbox\",\"Checked\":true}", sep, id++, i);
+				break;
+			case 2:
+				text_printf(&t, "%s{\"ID\":\"%d\",\"Label\":\"Zoom \\u00e9 %d%%\",\"Type\":\"Radio\",\"Disabled\":true}", sep, id++, i);
+				break;
+			case 3:
+				text_printf(&t, "%s{\"ID\":\"%d\",\"Type\":\"Separator\"}", sep, id++);
+				break;
+			default:
+				text_printf(&t, "%s{\"ID\":\"%d\",\"Label\":\"More %d\",\"Type\":\"Submenu\",\"SubMenu\":{\"Items\":[{\"ID\":\"%d\",\"Label\":\"Nested \\\"quoted\\\" item\",\"Type\":\"Text\"}]}}",
+					sep, id, i, id + 1);
+				id += 2;
+			}
+		}
+		text_printf(&t, "]}}");
+	}
+	text_printf(&t, "]},\"RadioGroups\":[{\"Members\":[\"2\",\"7\",\"12\"],\"Length\":3}]}");
+	return t.data;
+}
+
+/*
+ * Builds a tray menu whose size is dominated by long strings: a base64
+ * encoded icon of @icon_bytes bytes plus labels and tooltips on every item.
+ */
+static char *make_tray_json(int icon_bytes, int items)
+{
+	static const char base64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	Text t = {NULL, 0, 0};
+	int i;
+
+	text_printf(&t, "{\"ID\":\"0\",\"Label\":\"Wails\",\"Image\":\"");
+	for (i = 0; i < icon_bytes * 4 / 3; i++)
+		text_printf(&t, "%c", base64[(i * 7 + i / 3) % 64]);
+	text_printf(&t, "\",\"ProcessedMenu\":{\"Menu\":{\"Items\":[");
+	for (i = 0; i < items; i++)
+		text_printf(&t, "%s{\"ID\":\"%d\",\"Label\":\"Connect to the staging cluster in region %d\",\"Tooltip\":\"Opens a new connection using the credentials stored in your keychain, then refreshes the status of every service\",\"Type\":\"Text\"}",
+			i ? "," : "", i + 1, i);
+	text_printf(&t, "]}}}");
+	return t.data;
+}
+
+/*
+ * Builds a payload dominated by numbers: @count window and tray items with
+ * integer geometry and font sizes, and fractional colours and scales.
+ */
+static char *make_numbers_json(int count)
+{
+	Text t = {NULL, 0, 0};
+	int i;
+
+	text_printf(&t, "[");
+	for (i = 0; i < count; i++)
+		text_printf(&t, "%s{\"X\":%d,\"Y\":%d,\"Width\":%d,\"Height\":%d,\"FontSize\":%d,\"RGBA\":[%.17g,%g,%g,1],\"Scale\":%.17g}",
+			i ? "," : "", i * 37 % 2560, -(i * 11 % 1440), 800 + i % 400, 600 + i % 300, 10 + i % 20,
+			(i % 256) / 255.0, (i % 100) / 100.0, 0.5, 1.0 + (i % 3) / 3.0);
+	text_printf(&t, "]");
+	return t.data;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+typedef void (*BenchFn)(void *arg);
+
+/*
+ * Runs @fn until at least half a second has passed and prints the result in
+ * the format used by `go test -bench`, so the output works with benchstat.
+ * @bytes is the amount of input processed by one call, or 0.
+ */
+static void run(const char *name, BenchFn fn, void *arg, size_t bytes)
+{
+	long n = 1, i;
+	double elapsed;
+
+	for (;;) {
+		double start = now();
+		for (i = 0; i < n; i++)
+			fn(arg);
+		elapsed = now() - start;
+		if (elapsed >= 0.5 || n >= 1000000000L)
+			break;
+		n = elapsed > 0 ? (long)(n * 0.6 / elapsed) + 1 : n * 100;
+	}
+
+	printf("Benchmark%s\t%10ld\t%12.0f ns/op", name, n, elapsed * 1e9 / n);
+	if (bytes > 0)
+		printf("\t%8.2f MB/s", bytes * n / elapsed / 1e6);
+	printf("\n");
+}
+
+static void bench_decode_heap(void *input)
+{
+	json_delete(json_decode(input));
+}
+
+static void bench_decode_arena(void *input)
+{
+	json_delete(json_decode_arena(input));
+}
+
+typedef struct {
+	const char *input;
+	char *buffer;
+	size_t size;
+} Insitu;
+
+/*
+ * json_decode_insitu consumes its buffer, so every iteration starts by
+ * restoring it.  The copy is included in the timing, the same way Go has
+ * to copy the JSON into C memory before handing it over.
+ */
+static void bench_decode_insitu(void *arg)
+{
+	Insitu *in = arg;
+
+	memcpy(in->buffer, in->input, in->size);
+	json_delete(json_decode_insitu(in->buffer));
+}
+
+static void run_decode_insitu(const char *name, const char *input)
+{
+	Insitu in;
+
+	in.input = input;
+	in.size = strlen(input) + 1;
+	in.buffer = malloc(in.size);
+	run(name, bench_decode_insitu, &in, in.size - 1);
+	free(in.buffer);
+}
+
+/* Feeds the input to a streaming parser the way a pipe would deliver it. */
+static void feed_chunks(JsonParser *parser, const char *input)
+{
+	size_t len = strlen(input), off;
+
+	for (off = 0; off < len; off += 4096)
+		json_parser_feed(parser, input + off, len - off < 4096 ? len - off : 4096);
+}
+
+static void bench_decode_stream(void *input)
+{
+	JsonParser *parser = json_parser_new(NULL, NULL);
+	JsonNode *root;
+
+	feed_chunks(parser, input);
+	if (!json_parser_finish(parser, &root))
+		abort();
+	json_delete(root);
+}
+
+static bool count_event(void *ctx)
+{
+	(*(long*)ctx)++;
+	return true;
+}
+
+/* Counts containers, which is about the least work a SAX consumer can do. */
+static void bench_scan_stream(void *input)
+{
+	JsonCallbacks callbacks = {0};
+	JsonParser *parser;
+	long count = 0;
+
+	callbacks.start_object = count_event;
+	callbacks.start_array = count_event;
+	parser = json_parser_new(&callbacks, &count);
+	feed_chunks(parser, input);
+	if (!json_parser_finish(parser, NULL))
+		abort();
+}
+
+/*
+ * Reads what the menu code reads from a list of items: the ID, label and
+ * type of each, and the items of every submenu.  Both versions return the
+ * same checksum, so main can check they agree.
+ */
+static size_t walk_items(JsonNode *items)
+{
+	JsonNode *item;
+	size_t sum = 0;
+
+	json_foreach(item, items) {
+		JsonNode *label = json_find_member(item, "Label");
+		JsonNode *submenu = json_find_member(item, "SubMenu");
+
+		sum += strlen(json_find_member(item, "ID")->string_);
+		sum += (unsigned char) json_find_member(item, "Type")->string_[0];
+		if (label != NULL)
+			sum += strlen(label->string_);
+		if (submenu != NULL)
+			sum += walk_items(json_find_member(submenu, "Items"));
+	}
+	return sum;
+}
+
+/* Keys of a menu item, interned in main. */
+static const char *key_id, *key_type, *key_label, *key_submenu, *key_items;
+
+static size_t walk_items_interned(JsonNode *items)
+{
+	JsonNode *item;
+	size_t sum = 0;
+
+	json_foreach(item, items) {
+		JsonNode *label = json_find_member_interned(item, key_label);
+		JsonNode *submenu = json_find_member_interned(item, key_submenu);
+
+		sum += strlen(json_find_member_interned(item, key_id)->string_);
+		sum += (unsigned char) json_find_member_interned(item, key_type)->string_[0];
+		if (label != NULL)
+			sum += strlen(label->string_);
+		if (submenu != NULL)
+			sum += walk_items_interned(json_find_member_interned(submenu, key_items));
+	}
+	return sum;
+}
+
+/* The keys processMenuItem reads from every item, SubMenu last. */
+static const char *const menu_item_keys[] = {
+	"ID", "Label", "Tooltip", "Image", "FontName", "RGBA", "Type", "Hidden", "Disabled",
+	"Checked", "MacAlternate", "MacTemplateImage", "FontSize", "Role", "StyledLabel",
+	"Accelerator", "SubMenu",
+};
+
+#define MENU_ITEM_KEYS ((int) (sizeof(menu_item_keys) / sizeof(menu_item_keys[0])))
+
+static JsonSchema menu_item_schema = JSON_SCHEMA(menu_item_keys);
+
+/* Reads every field of every item, one lookup per key. */
+static size_t read_items(JsonNode *items, const char **interned_keys)
+{
+	JsonNode *item, *fields[MENU_ITEM_KEYS];
+	size_t sum = 0;
+	int i;
+
+	json_foreach(item, items) {
+		for (i = 0; i < MENU_ITEM_KEYS; i++) {
+			fields[i] = json_find_member_interned(item, interned_keys[i]);
+			sum += fields[i] != NULL;
+		}
+		if (fields[MENU_ITEM_KEYS - 1] != NULL)
+			sum += read_items(json_find_member_interned(fields[MENU_ITEM_KEYS - 1], key_items), interned_keys);
+	}
+	return sum;
+}
+
+/* Reads every field of every item in one pass per item. */
+static size_t extract_items(JsonNode *items)
+{
+	JsonNode *item, *fields[MENU_ITEM_KEYS];
+	size_t sum = 0;
+
+	json_foreach(item, items) {
+		sum += json_extract(&menu_item_schema, item, fields);
+		if (fields[MENU_ITEM_KEYS - 1] != NULL)
+			sum += extract_items(json_find_member_interned(fields[MENU_ITEM_KEYS - 1], key_items));
+	}
+	return sum;
+}
+
+static size_t walk_tape_items(JsonCursor items)
+{
+	JsonCursor item, value;
+	size_t sum = 0;
+	bool more;
+
+	for (more = json_tape_first(items, &item); more; more = json_tape_next(&item)) {
+		json_tape_find(item, "ID", &value);
+		sum += strlen(json_tape_string(value));
+		json_tape_find(item, "Type", &value);
+		sum += (unsigned char) json_tape_string(value)[0];
+		if (json_tape_find(item, "Label", &value))
+			sum += strlen(json_tape_string(value));
+		if (json_tape_find(item, "SubMenu", &value) && json_tape_find(value, "Items", &value))
+			sum += walk_tape_items(value);
+	}
+	return sum;
+}
+
+static size_t decode_find(JsonNode *(*decode)(const char *json), const char *input)
+{
+	JsonNode *root = decode(input);
+	size_t sum = walk_items(json_find_member(json_find_member(root, "Menu"), "Items"));
+
+	json_delete(root);
+	return sum;
+}
+
+static size_t tape_find(const char *input)
+{
+	JsonTape *tape = json_tape_parse(input);
+	JsonCursor menu, items;
+	size_t sum;
+
+	json_tape_find(json_tape_root(tape), "Menu", &menu);
+	json_tape_find(menu, "Items", &items);
+	sum = walk_tape_items(items);
+	json_tape_free(tape);
+	return sum;
+}
+
+static void bench_decode_find(void *input)
+{
+	decode_find(json_decode, input);
+}
+
+static void bench_decode_arena_find(void *input)
+{
+	decode_find(json_decode_arena, input);
+}
+
+static void bench_tape_find(void *input)
+{
+	tape_find(input);
+}
+
+static size_t walk_compact_items(const JsonCompactNode *items)
+{
+	const JsonCompactNode *item;
+	size_t sum = 0;
+
+	json_compact_foreach(item, items) {
+		const JsonCompactNode *label = json_compact_find_member(item, "Label");
+		const JsonCompactNode *submenu = json_compact_find_member(item, "SubMenu");
+
+		sum += strlen(json_compact_string(json_compact_find_member(item, "ID")));
+		sum += (unsigned char) json_compact_string(json_compact_find_member(item, "Type"))[0];
+		if (label != NULL)
+			sum += strlen(json_compact_string(label));
+		if (submenu != NULL)
+			sum += walk_compact_items(json_compact_find_member(submenu, "Items"));
+	}
+	return sum;
+}
+
+/* Ticks and unticks one checkbox of a decoded menu, instead of decoding it again. */
+typedef struct {
+	JsonNode *menu;
+	JsonNode *patches[2];
+	int next;
+} MenuPatch;
+
+static void bench_patch_menu(void *arg)
+{
+	MenuPatch *p = arg;
+
+	if (!json_patch(&p->menu, p->patches[p->next], NULL, NULL))
+		abort();
+	p->next ^= 1;
+}
+
+/* Walks a menu that has already been decoded, as the menu builders do. */
+static void bench_walk_tree(void *root)
+{
+	walk_items(json_find_member(json_find_member(root, "Menu"), "Items"));
+}
+
+static void bench_walk_tree_interned(void *root)
+{
+	walk_items_interned(json_find_member(json_find_member(root, "Menu"), "Items"));
+}
+
+static const char *menu_item_interned[MENU_ITEM_KEYS];
+
+static void bench_read_fields(void *root)
+{
+	read_items(json_find_member(json_find_member(root, "Menu"), "Items"), menu_item_interned);
+}
+
+static void bench_extract_fields(void *root)
+{
+	extract_items(json_find_member(json_find_member(root, "Menu"), "Items"));
+}
+
+static void bench_walk_compact(void *doc)
+{
+	const JsonCompactNode *menu = json_compact_find_member(json_compact_root(doc), "Menu");
+
+	walk_compact_items(json_compact_find_member(menu, "Items"));
+}
+
+/* Converts every number of a document with strtod, as parse_number used to. */
+static void bench_strtod_numbers(void *input)
+{
+	const char *s = input;
+	volatile double sink;
+
+	while (*s != 0) {
+		if (*s == '-' || (*s >= '0' && *s <= '9')) {
+			char *end;
+			sink = strtod(s, &end);
+			s = end;
+		} else {
+			s++;
+		}
+	}
+	(void) sink;
+}
+
+/* Formats every number below @node with sprintf, as emit_number used to. */
+static void sprintf_numbers(const JsonNode *node)
+{
+	const JsonNode *child;
+	char buf[64];
+
+	if (node->tag == JSON_NUMBER)
+		sprintf(buf, "%.16g", node->number_);
+	for (child = json_first_child(node); child != NULL; child = child->next)
+		sprintf_numbers(child);
+}
+
+static void bench_sprintf_numbers(void *node)
+{
+	sprintf_numbers(node);
+}
+
+static void bench_encode(void *node)
+{
+	free(json_encode(node));
+}
+
+typedef struct {
+	JsonNode *node;
+	char *buffer;
+	size_t size;
+} EncodeInto;
+
+/* Encodes into a buffer that was sized once with json_encoded_length. */
+static void bench_encode_into(void *arg)
+{
+	EncodeInto *e = arg;
+
+	if (json_encode_into(e->node, e->buffer, e->size) >= e->size)
+		abort();
+}
+
+static void run_encode_into(const char *name, JsonNode *node, size_t bytes)
+{
+	EncodeInto e;
+
+	e.node = node;
+	e.size = json_encoded_length(node) + 1;
+	e.buffer = malloc(e.size);
+	run(name, bench_encode_into, &e, bytes);
+	free(e.buffer);
+}
+
+/* Decodes a tray label update and reads it, the way UpdateTrayMenuLabelInStore does. */
+static void bench_tray_label_update(void *input)
+{
+	JsonNode *update = json_decode(input);
+
+	if (json_find_member(update, "ID") == NULL || json_find_member(update, "Label") == NULL)
+		abort();
+	json_find_member(update, "FontSize");
+	json_find_member(update, "StyledLabel");
+	json_delete(update);
+}
+
+/* Encodes a menu click message, the way menuItemCallback does. */
+static void bench_menu_clicked(void *arg)
+{
+	char buffer[512];
+	JsonNode *object = json_mkobject();
+
+	(void) arg;
+	json_append_member(object, "menuItemID", json_mkstring("1234"));
+	json_append_member(object, "menuType", json_mkstring("TrayMenu"));
+	json_append_member(object, "parentID", json_mkstring("tray-0"));
+	if (json_encode_into(object, buffer, sizeof(buffer)) >= sizeof(buffer))
+		abort();
+	json_delete(object);
+}
+
+static void bench_menu_clicked_alloc(void *arg)
+{
+	JsonNode *object = json_mkobject();
+
+	(void) arg;
+	json_append_member(object, "menuItemID", json_mkstring("1234"));
+	json_append_member(object, "menuType", json_mkstring("TrayMenu"));
+	json_append_member(object, "parentID", json_mkstring("tray-0"));
+	free(json_encode(object));
+	json_delete(object);
+}
+
+/*
+ * Escapes a string one byte at a time, growing the output as it goes, the
+ * way emit_string did before it learned to copy plain runs in bulk.
+ */
+static char *encode_string_bytewise(const char *s)
+{
+	size_t cap = 16, len = 0;
+	char *out = malloc(cap + 1);
+
+	out[len++] = '"';
+	for (; *s != 0; s++) {
+		unsigned char c = *s;
+
+		if (cap - len < 14) {
+			cap *= 2;
+			out = realloc(out, cap + 1);
+		}
+		switch (c) {
+		case '"':  out[len++] = '\\'; out[len++] = '"'; break;
+		case '\\': out[len++] = '\\'; out[len++] = '\\'; break;
+		case '\n': out[len++] = '\\'; out[len++] = 'n'; break;
+		case '\r': out[len++] = '\\'; out[len++] = 'r'; break;
+		case '\t': out[len++] = '\\'; out[len++] = 't'; break;
+		default:
+			if (c < 0x20)
+				len += sprintf(out + len, "\\u%04X", c);
+			else
+				out[len++] = c;
+		}
+	}
+	out[len++] = '"';
+	out[len] = 0;
+	return out;
+}
+
+static void bench_encode_string_bytewise(void *str)
+{
+	free(encode_string_bytewise(str));
+}
+
+static void bench_encode_string(void *str)
+{
+	free(json_encode_string(str));
+}
+
+/* A wide object, like a binding table, and the keys to look up in it. */
+typedef struct {
+	JsonNode *object;
+	char **keys;
+	int count;
+} Lookup;
+
+static Lookup *make_lookup(int count)
+{
+	Lookup *l = malloc(sizeof(Lookup));
+	char key[64];
+	int i;
+
+	l->object = json_mkobject();
+	l->keys = malloc(count * sizeof(char*));
+	l->count = count;
+	for (i = 0; i < count; i++) {
+		snprintf(key, sizeof(key), "main.App.Method%d", i);
+		json_append_member(l->object, key, json_mknumber(i));
+		l->keys[i] = strdup(key);
+	}
+	return l;
+}
+
+static void free_lookup(Lookup *l)
+{
+	int i;
+
+	json_delete(l->object);
+	for (i = 0; i < l->count; i++)
+		free(l->keys[i]);
+	free(l->keys);
+	free(l);
+}
+
+/* The member walk json_find_member did before objects had an index. */
+static JsonNode *find_member_linear(JsonNode *object, const char *name)
+{
+	JsonNode *member;
+
+	json_foreach(member, object)
+		if (strcmp(member->key, name) == 0)
+			return member;
+	return NULL;
+}
+
+static void bench_find_member_linear(void *arg)
+{
+	Lookup *l = arg;
+	int i;
+
+	for (i = 0; i < l->count; i++)
+		if (find_member_linear(l->object, l->keys[i]) == NULL)
+			abort();
+}
+
+static void bench_find_member(void *arg)
+{
+	Lookup *l = arg;
+	int i;
+
+	for (i = 0; i < l->count; i++)
+		if (json_find_member(l->object, l->keys[i]) == NULL)
+			abort();
+}
+
+/* The element walk json_find_element did before arrays had an index. */
+static JsonNode *find_element_linear(JsonNode *array, int index)
+{
+	JsonNode *element;
+	int i = 0;
+
+	json_foreach(element, array)
+		if (i++ == index)
+			return element;
+	return NULL;
+}
+
+static int array_length_linear(JsonNode *array)
+{
+	JsonNode *element;
+	int n = 0;
+
+	json_foreach(element, array)
+		n++;
+	return n;
+}
+
+/* A recent files list read the way menu code loops over arrays. */
+static void bench_index_array_linear(void *array)
+{
+	int i;
+
+	for (i = 0; i < array_length_linear(array); i++)
+		if (find_element_linear(array, i) == NULL)
+			abort();
+}
+
+static void bench_index_array(void *array)
+{
+	int i;
+
+	for (i = 0; i < json_array_length(array); i++)
+		if (json_find_element(array, i) == NULL)
+			abort();
+}
+
+/* All decoders must agree before their timings mean anything. */
+static void check_same(const char *input)
+{
+	char *buffer = strdup(input);
+	JsonNode *heap = json_decode(input);
+	JsonNode *arena = json_decode_arena(input);
+	JsonNode *insitu = json_decode_insitu(buffer);
+	JsonParser *parser = json_parser_new(NULL, NULL);
+	JsonNode *stream;
+	char *a, *b, *c, *d;
+
+	feed_chunks(parser, input);
+	if (!json_parser_finish(parser, &stream) ||
+	    heap == NULL || arena == NULL || insitu == NULL) {
+		fprintf(stderr, "decode failed\n");
+		exit(1);
+	}
+	a = json_encode(heap);
+	b = json_encode(arena);
+	c = json_encode(insitu);
+	d = json_encode(stream);
+	if (strcmp(a, b) != 0 || strcmp(a, c) != 0 || strcmp(a, d) != 0) {
+		fprintf(stderr, "arena, in-situ or streaming decode differs from heap decode\n");
+		exit(1);
+	}
+	free(a);
+	free(b);
+	free(c);
+	free(d);
+	json_delete(heap);
+	json_delete(arena);
+	json_delete(insitu);
+	json_delete(stream);
+	free(buffer);
+}
+
+int main(void)
+{
+	static const struct {
+		const char *name;
+		int menus, items;
+	} sizes[] = {
+		{"small", 2, 10},
+		{"medium", 8, 100},
+		{"large", 20, 1000},
+	};
+	static const int widths[] = {8, 64, 1024};
+	JsonCompact *compact;
+	MenuPatch patch;
+	JsonNode *node;
+	char name[64];
+	size_t i;
+
+	key_id = json_intern("ID");
+	key_type = json_intern("Type");
+	key_label = json_intern("Label");
+	key_submenu = json_intern("SubMenu");
+	key_items = json_intern("Items");
+	for (i = 0; i < MENU_ITEM_KEYS; i++)
+		menu_item_interned[i] = json_intern(menu_item_keys[i]);
+
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		char *input = make_menu_json(sizes[i].menus, sizes[i].items);
+
+		check_same(input);
+
+		snprintf(name, sizeof(name), "DecodeHeap/%s", sizes[i].name);
+		run(name, bench_decode_heap, input, strlen(input));
+		snprintf(name, sizeof(name), "DecodeArena/%s", sizes[i].name);
+		run(name, bench_decode_arena, input, strlen(input));
+		snprintf(name, sizeof(name), "DecodeInsitu/%s", sizes[i].name);
+		run_decode_insitu(name, input);
+		snprintf(name, sizeof(name), "DecodeStream/%s", sizes[i].name);
+		run(name, bench_decode_stream, input, strlen(input));
+		snprintf(name, sizeof(name), "ScanStream/%s", sizes[i].name);
+		run(name, bench_scan_stream, input, strlen(input));
+
+		patch.menu = json_decode(input);
+		patch.patches[0] = json_decode("[{\"op\":\"replace\",\"path\":\"/Menu/Items/0/SubMenu/Items/1/Checked\",\"value\":false}]");
+		patch.patches[1] = json_decode("[{\"op\":\"replace\",\"path\":\"/Menu/Items/0/SubMenu/Items/1/Checked\",\"value\":true}]");
+		patch.next = 0;
+		snprintf(name, sizeof(name), "PatchMenu/%s", sizes[i].name);
+		run(name, bench_patch_menu, &patch, 0);
+		json_delete(patch.patches[0]);
+		json_delete(patch.patches[1]);
+		json_delete(patch.menu);
+
+		if (decode_find(json_decode, input) != tape_find(input)) {
+			fprintf(stderr, "tape lookups differ from tree lookups\n");
+			exit(1);
+		}
+		snprintf(name, sizeof(name), "DecodeFind/%s", sizes[i].name);
+		run(name, bench_decode_find, input, strlen(input));
+		snprintf(name, sizeof(name), "DecodeArenaFind/%s", sizes[i].name);
+		run(name, bench_decode_arena_find, input, strlen(input));
+		snprintf(name, sizeof(name), "TapeFind/%s", sizes[i].name);
+		run(name, bench_tape_find, input, strlen(input));
+
+		node = json_decode(input);
+		compact = json_compact_from_node(node);
+		if (walk_items(json_find_member(json_find_member(node, "Menu"), "Items")) !=
+		    walk_items_interned(json_find_member(json_find_member(node, "Menu"), "Items"))) {
+			fprintf(stderr, "interned lookups differ from tree lookups\n");
+			exit(1);
+		}
+		if (walk_items(json_find_member(json_find_member(node, "Menu"), "Items")) !=
+		    walk_compact_items(json_compact_find_member(json_compact_find_member(json_compact_root(compact), "Menu"), "Items"))) {
+			fprintf(stderr, "compact lookups differ from tree lookups\n");
+			exit(1);
+		}
+		snprintf(name, sizeof(name), "WalkTree/%s", sizes[i].name);
+		run(name, bench_walk_tree, node, 0);
+		snprintf(name, sizeof(name), "WalkTreeInterned/%s", sizes[i].name);
+		run(name, bench_walk_tree_interned, node, 0);
+		if (read_items(json_find_member(json_find_member(node, "Menu"), "Items"), menu_item_interned) !=
+		    extract_items(json_find_member(json_find_member(node, "Menu"), "Items"))) {
+			fprintf(stderr, "extracted fields differ from looked up fields\n");
+			exit(1);
+		}
+		snprintf(name, sizeof(name), "ReadFields/%s", sizes[i].name);
+		run(name, bench_read_fields, node, 0);
+		snprintf(name, sizeof(name), "ExtractFields/%s", sizes[i].name);
+		run(name, bench_extract_fields, node, 0);
+		snprintf(name, sizeof(name), "WalkCompact/%s", sizes[i].name);
+		run(name, bench_walk_compact, compact, 0);
+		json_compact_free(compact);
+		json_delete(node);
+
+		node = json_decode(input);
+		snprintf(name, sizeof(name), "Encode/%s", sizes[i].name);
+		run(name, bench_encode, node, strlen(input));
+		snprintf(name, sizeof(name), "EncodeInto/%s", sizes[i].name);
+		run_encode_into(name, node, strlen(input));
+		json_delete(node);
+
+		free(input);
+	}
+
+	for (i = 0; i < sizeof(widths) / sizeof(widths[0]); i++) {
+		char *input = make_tray_json(widths[i] * 64, widths[i]);
+
+		check_same(input);
+
+		snprintf(name, sizeof(name), "DecodeStrings/%d", widths[i]);
+		run(name, bench_decode_heap, input, strlen(input));
+		snprintf(name, sizeof(name), "DecodeStringsArena/%d", widths[i]);
+		run(name, bench_decode_arena, input, strlen(input));
+		snprintf(name, sizeof(name), "DecodeStringsInsitu/%d", widths[i]);
+		run_decode_insitu(name, input);
+
+		node = json_decode(input);
+		snprintf(name, sizeof(name), "EncodeStrings/%d", widths[i]);
+		run(name, bench_encode, node, strlen(input));
+		json_delete(node);
+
+		/* The icon on its own, as in a tray label update. */
+		node = json_find_member(json_decode(input), "Image");
+		snprintf(name, sizeof(name), "EncodeStringBytewise/%d", widths[i]);
+		run(name, bench_encode_string_bytewise, node->string_, strlen(node->string_));
+		snprintf(name, sizeof(name), "EncodeString/%d", widths[i]);
+		run(name, bench_encode_string, node->string_, strlen(node->string_));
+		json_delete(node->parent);
+
+		free(input);
+	}
+
+	{
+		static const char update[] = "{\"ID\":\"tray-0\",\"Label\":\"CPU 42%\",\"FontName\":\"Menlo\",\"FontSize\":12,"
+			"\"RGBA\":\"#ff0000ff\",\"Disabled\":false,\"StyledLabel\":[{\"Label\":\"CPU \",\"FgCol\":{\"hex\":\"#00ff00\"}}]}";
+		JsonPoolStats stats;
+
+		run("TrayLabelUpdate", bench_tray_label_update, (void*) update, strlen(update));
+		json_pool_stats(&stats);
+		fprintf(stderr, "pool: %zu/%zu node hits, %zu/%zu string hits\n",
+			stats.node_hits, stats.node_hits + stats.node_misses,
+			stats.string_hits, stats.string_hits + stats.string_misses);
+	}
+
+	run("MenuClickedMessageAlloc", bench_menu_clicked_alloc, NULL, 0);
+	run("MenuClickedMessage", bench_menu_clicked, NULL, 0);
+
+	for (i = 0; i < sizeof(widths) / sizeof(widths[0]); i++) {
+		char *input = make_numbers_json(widths[i]);
+
+		check_same(input);
+
+		snprintf(name, sizeof(name), "StrtodNumbers/%d", widths[i]);
+		run(name, bench_strtod_numbers, input, strlen(input));
+		snprintf(name, sizeof(name), "DecodeNumbers/%d", widths[i]);
+		run(name, bench_decode_heap, input, strlen(input));
+		snprintf(name, sizeof(name), "DecodeNumbersArena/%d", widths[i]);
+		run(name, bench_decode_arena, input, strlen(input));
+
+		node = json_decode(input);
+		snprintf(name, sizeof(name), "SprintfNumbers/%d", widths[i]);
+		run(name, bench_sprintf_numbers, node, strlen(input));
+		snprintf(name, sizeof(name), "EncodeNumbers/%d", widths[i]);
+		run(name, bench_encode, node, strlen(input));
+		json_delete(node);
+
+		free(input);
+	}
+
+	for (i = 0; i < sizeof(widths) / sizeof(widths[0]); i++) {
+		Lookup *l = make_lookup(widths[i]);
+
+		snprintf(name, sizeof(name), "FindMemberLinear/%d", widths[i]);
+		run(name, bench_find_member_linear, l, 0);
+		snprintf(name, sizeof(name), "FindMember/%d", widths[i]);
+		run(name, bench_find_member, l, 0);
+
+		free_lookup(l);
+	}
+
+	for (i = 0; i < sizeof(widths) / sizeof(widths[0]); i++) {
+		JsonNode *array = json_mkarray();
+		int j;
+
+		for (j = 0; j < widths[i]; j++)
+			json_append_element(array, json_mkstring("/Users/wails/Documents/recent.txt"));
+
+		snprintf(name, sizeof(name), "IndexArrayLinear/%d", widths[i]);
+		run(name, bench_index_array_linear, array, 0);
+		snprintf(name, sizeof(name), "IndexArray/%d", widths[i]);
+		run(name, bench_index_array, array, 0);
+
+		json_delete(array);
+	}
+
+	return 0;
+}
@@ -0,0 +1,64 @@
+#!/bin/sh
+#
+# Builds and runs the corpus and hashmap benchmarks.
+#
+#   ./run.sh                 benchmark the working tree
+#   ./run.sh <commit>        benchmark <commit> as well and compare the two
+#
+# Each side runs COUNT times (5 by default).  Results are kept in
+# $OUT (results/ by default) as old.txt and new.txt, and compared with
+# benchstat when it is installed.
+
+set -e
+
+cd "$(dirname "$0")"
+BENCH=$(pwd)
+COUNT=${COUNT:-5}
+OUT=${OUT:-$BENCH/results}
+CC=${CC:-cc}
+CFLAGS=${CFLAGS:--O2}
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+# build <ffenestri sources> <binary prefix>
+build() {
+    # Trees from before json_hash_text leave its benchmark out
+    FEATURES=
+    grep -q json_hash_text "$1/json.h" || FEATURES=-DNO_HASH_TEXT
+    $CC $CFLAGS $FEATURES -o "$2_corpus" "$1/json.c" "$1/common.c" "$1/vec.c" "$1/bench/corpus_bench.c"
+    $CC $CFLAGS -o "$2_hashmap" "$1/bench/hashmap_bench.c"
+}
+
+# measure <binary prefix> <results>
+measure() {
+    : > "$2"
+    i=0
+    while [ $i -lt "$COUNT" ]; do
+        "$1_corpus" "$BENCH/corpus" | tee -a "$2"
+        "$1_hashmap" | tee -a "$2"
+        i=$((i + 1))
+    done
+}
+
+mkdir -p "$OUT"
+
+if [ -n "$1" ]; then
+    # The old tree is built with today's benchmark and corpus, so both
+    # sides run the same workload.
+    ROOT=$(git rev-parse --show-toplevel)
+    PREFIX=$(git rev-parse --show-prefix)
+    mkdir "$WORK/old"
+    git -C "$ROOT" archive "$1" "${PREFIX%bench/}" | tar -x -C "$WORK/old"
+    mkdir -p "$WORK/old/$PREFIX"
+    cp corpus_bench.c hashmap_bench.c "$WORK/old/$PREFIX"
+    build "$WORK/old/${PREFIX%bench/}" "$WORK/old_bench"
+    measure "$WORK/old_bench" "$OUT/old.txt"
+fi
+
+build .. "$WORK/new_bench"
+measure "$WORK/new_bench" "$OUT/new.txt"
+
+if [ -n "$1" ] && command -v benchstat > /dev/null; then
+    benchstat "$OUT/old.txt" "$OUT/new.txt"
+fi
@@ -6,6 +6,7 @@
 //
 
 #include "common.h"
+#include <limits.h>
 
 // Credit: https://stackoverflow.com/a/8465083
 char* concat(const char *string1, const char *string2)
@@ -40,7 +41,7 @@ int freeHashmapItem(void *const context, struct hashmap_element_s *const e) {
 
 const char* getJSONString(JsonNode *item, const char* key) {
     // Get key
-    JsonNode *node = json_find_member(item, key);
+    JsonNode *node = json_find_member_interned(item, key);
     const char *result = "";
     if ( node != NULL && node->tag == JSON_STRING) {
         result = node->string_;
@@ -49,7 +50,11 @@ const char* getJSONString(JsonNode *item, const char* key) {
 }
 
 void ABORT_JSON(JsonNode *node, const char* key) {
-    ABORT("Unable to read required key '%s' from JSON: %s\n", key, json_encode(node));
+    // Stream the JSON out instead of encoding what may be a whole menu into memory first
+    printf("FATAL: Unable to read required key '%s' from JSON: ", key);
+    json_write(node, json_file_writer, stdout, NULL);
+    printf("\n\n");
+    exit(1);
 }
 
 const char* mustJSONString(JsonNode *node, const char* key) {
@@ -68,11 +73,11 @@ JsonNode* mustJSONObject(JsonNode *node, const char* key) {
 }
 
 JsonNode* getJSONObject(JsonNode* node, const char* key) {
-    return json_find_member(node, key);
+    return json_find_member_interned(node, key);
 }
 
 bool getJSONBool(JsonNode *item, const char* key, bool *result) {
-    JsonNode *node = json_find_member(item, key);
+    JsonNode *node = json_find_member_interned(item, key);
     if ( node != NULL && node->tag == JSON_BOOL) {
         *result = node->bool_;
         return true;
@@ -81,9 +86,10 @@ bool getJSONBool(JsonNode *item, const char* key, bool *result) {
 }
 
 bool getJSONInt(JsonNode *item, const char* key, int *result) {
-    JsonNode *node = json_find_member(item, key);
-    if ( node != NULL && node->tag == JSON_NUMBER) {
-        *result = (int) node->number_;
+    int64_t value;
+    JsonNode *node = json_find_member_interned(item, key);
+    if ( json_get_int64(node, &value) && value >= INT_MIN && value <= INT_MAX ) {
+        *result = (int) value;
         return true;
     }
     return false;
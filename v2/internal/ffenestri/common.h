@@ -19,6 +19,19 @@
 #define MEMFREE(input) free((void*)input); input = NULL;
 #define FREE_AND_SET(variable, value) if( variable != NULL ) { MEMFREE(variable); } variable = value
 
+// JSONKEY interns a key literal the first time its call site runs.
+// The getJSON* and mustJSON* helpers compare member keys by pointer
+// before strcmp, so keys made with it are found fastest. The cached
+// pointer is shared by every thread that runs the call site.
+#define JSONKEY(key) ({ \
+    static const char *interned = NULL; \
+    const char *result = __atomic_load_n(&interned, __ATOMIC_ACQUIRE); \
+    if( result == NULL ) { \
+        result = json_intern(key); \
+        __atomic_store_n(&interned, result, __ATOMIC_RELEASE); \
+    } \
+    result; })
+
 // Credit: https://stackoverflow.com/a/8465083
 char* concat(const char *string1, const char *string2);
 void ABORT(const char *message, ...);
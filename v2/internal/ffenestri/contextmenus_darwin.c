@@ -18,10 +18,11 @@ ContextMenu* NewContextMenu(const char* contextMenuJSON) {
     // Save reference to this json
     result->processedJSON = processedJSON;
 
-    result->ID = mustJSONString(processedJSON, "ID");
-    JsonNode* processedMenu = mustJSONObject(processedJSON, "ProcessedMenu");
+    result->ID = mustJSONString(processedJSON, JSONKEY("ID"));
+    JsonNode* processedMenu = mustJSONObject(processedJSON, JSONKEY("ProcessedMenu"));
 
     result->menu = NewMenu(processedMenu);
+    result->menu->hash = json_hash_text(contextMenuJSON);
     result->nsmenu = NULL;
     result->menu->menuType = ContextMenuType;
     result->menu->parentData = result;
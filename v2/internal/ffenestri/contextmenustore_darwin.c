@@ -6,8 +6,9 @@ ContextMenuStore* NewContextMenuStore() {
 
     ContextMenuStore* result = malloc(sizeof(ContextMenuStore));
 
-    // Allocate Context Menu Store
-    if( 0 != hashmap_create((const unsigned)4, &result->contextMenuMap)) {
+    // Allocate Context Menu Store. It keeps its own copy of the menu IDs, as
+    // they live in the JSON of menus that get replaced
+    if( 0 != hashmap_create_owned((const unsigned)4, &result->contextMenuMap)) {
         ABORT("[NewContextMenus] Not enough memory to allocate contextMenuStore!");
     }
 
@@ -26,7 +27,28 @@ ContextMenu* GetContextMenuFromStore(ContextMenuStore* store, const char* menuID
     return hashmap_get(&store->contextMenuMap, menuID, strlen(menuID));
 }
 
+int contextMenuBuiltFrom(void *const context, struct hashmap_element_s *const e) {
+    ContextMenu *menu = e->data;
+    // A positive result stops the iteration
+    return MenuBuiltFrom(menu->menu, *(uint64_t*)context) ? 1 : 0;
+}
+
+// Whether a stored context menu was built from exactly this JSON and has not
+// changed since. Identical JSON means an identical ID, so only the hashes of
+// the stored menus need checking and nothing has to be parsed
+bool contextMenuUnchanged(ContextMenuStore* store, const char* menuJSON) {
+    uint64_t hash = json_hash_text(menuJSON);
+    return hashmap_iterate_pairs(&store->contextMenuMap, contextMenuBuiltFrom, &hash) > 0;
+}
+
 void UpdateContextMenuInStore(ContextMenuStore* store, const char* menuJSON) {
+
+    // Nothing to parse or rebuild if this menu is already stored
+    if( contextMenuUnchanged(store, menuJSON) ) {
+        CountSkippedMenuRebuild();
+        return;
+    }
+
     ContextMenu* newContextMenu = NewContextMenu(menuJSON);
 
     // Get the current menu
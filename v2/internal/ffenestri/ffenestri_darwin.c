@@ -1407,6 +1407,11 @@ void dumpMemberList(const char *name, id *memberList) {
 void updateMenu(struct Application *app, const char *menuAsJSON) {
 	Debug(app, "Menu is now: %s", menuAsJSON);
 	ON_MAIN_THREAD (
+		// Nothing to do if the menu has not changed
+		if( MenuBuiltFrom(app->applicationMenu, json_hash_text(menuAsJSON)) ) {
+			CountSkippedMenuRebuild();
+			return;
+		}
 		DeleteMenu(app->applicationMenu);
 		Menu* newMenu = NewApplicationMenu(menuAsJSON);
         id menu = GetMenu(newMenu);
@@ -1461,8 +1466,9 @@ void processDialogIcons(struct hashmap_s *hashmap, const unsigned char *dialogIc
 
 void processUserDialogIcons(struct Application *app) {
 
-	// Allocate the Dialog icon hashmap
-	if( 0 != hashmap_create((const unsigned)4, &dialogIconCache)) {
+	// Allocate the Dialog icon hashmap. Icon names are short, so it keeps
+	// them inline rather than pointing into the icon tables
+	if( 0 != hashmap_create_owned((const unsigned)4, &dialogIconCache)) {
 	   // Couldn't allocate map
 	   Fatal(app, "Not enough memory to allocate dialogIconCache!");
 	   return;
@@ -32,12 +32,33 @@
 #ifndef SHEREDOM_HASHMAP_H_INCLUDED
 #define SHEREDOM_HASHMAP_H_INCLUDED
 
+/*
+   The table is open addressed in the style of Abseil's "Swiss tables".
+   Besides the elements it keeps one control byte per slot, which is either
+   HASHMAP_EMPTY or the low 7 bits of the hash of the key in that slot.
+   Lookups probe a group of 16 control bytes at a time (with a single SSE2
+   compare where available) and only look at the elements whose control byte
+   matches, so a miss rarely touches an element at all and the table can run
+   at a 7/8 load factor.
+
+   Probing is linear, so removing an element shifts the elements after it
+   back towards their home slots instead of leaving a tombstone. Probe
+   sequences stay as short as if the removed keys had never been put, and
+   the table shrinks when most of its elements are gone.
+
+   A hashmap made with hashmap_create_owned copies its keys. Short keys are
+   kept in an array of HASHMAP_INLINE_KEY_SIZE bytes per slot that shares
+   the allocation of the elements. Longer keys are copied into blocks of an
+   arena that is compacted whenever the table is rehashed.
+*/
+
 #if defined(_MSC_VER)
 // Workaround a bug in the MSVC runtime where it uses __cplusplus when not
 // defined.
 #pragma warning(push, 0)
 #pragma warning(disable : 4668)
 #endif
+#include <limits.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -46,10 +67,38 @@
 #define HASHMAP_SSE42
 #endif
 
+/* Define HASHMAP_NO_SIMD to probe groups with the portable code instead. */
+#if !defined(HASHMAP_NO_SIMD) &&                                               \
+    ((defined(_MSC_VER) && (defined(_M_X64) || _M_IX86_FP >= 2)) ||            \
+     (!defined(_MSC_VER) && defined(__SSE2__)))
+#define HASHMAP_SSE2
+#endif
+
+/* Keys are hashed eight bytes at a time with the CRC32-C instructions of
+ * SSE 4.2 or ARMv8 when the compiler targets them, and with a wyhash style
+ * multiply and fold otherwise. Define HASHMAP_HASH_WYHASH to use the latter
+ * everywhere. */
+#if !defined(HASHMAP_HASH_WYHASH) &&                                           \
+    (defined(HASHMAP_SSE42) || defined(__ARM_FEATURE_CRC32))
+#define HASHMAP_HASH_CRC32
+#endif
+
 #if defined(HASHMAP_SSE42)
 #include <nmmintrin.h>
 #endif
 
+#if defined(HASHMAP_HASH_CRC32) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+
+#if defined(HASHMAP_SSE2)
+#include <emmintrin.h>
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
 #if defined(_MSC_VER)
 #pragma warning(pop)
 #endif
@@ -73,23 +122,69 @@
 #define HASHMAP_USED
 #endif
 
-/* We need to keep keys and values. */
+/* For the helpers on the lookup path, which compilers otherwise leave as
+ * calls. */
+#if defined(_MSC_VER)
+#define HASHMAP_ALWAYS_INLINE __forceinline
+#elif defined(__GNUC__)
+#define HASHMAP_ALWAYS_INLINE __attribute__((always_inline)) inline
+#else
+#define HASHMAP_ALWAYS_INLINE
+#endif
+
+/* We need to keep keys and values. The full hash of the key is kept too, so
+ * that lookups compare it before the key and rehashing does not have to
+ * hash every key again. */
 struct hashmap_element_s {
   const char *key;
   unsigned key_len;
+  unsigned hash;
+  /* Whether the slot holds an element. The control bytes say the same, but
+   * this is kept in step for callers that scan the elements directly. */
   int in_use;
   void *data;
 };
 
+/* A block of the arena that owned keys too long to be kept inline are
+ * copied into. The keys follow the header. */
+struct hashmap_arena_s {
+  struct hashmap_arena_s *next;
+  unsigned used;
+  unsigned size;
+};
+
 /* A hashmap has some maximum size and current size, as well as the data to
  * hold. */
 struct hashmap_s {
   unsigned table_size;
   unsigned size;
+  /* table_size control bytes, followed by a copy of the first
+   * HASHMAP_GROUP_WIDTH so that a group can be loaded at any slot. */
+  unsigned char *ctrl;
+  /* The elements. The control bytes live in the same allocation. */
   struct hashmap_element_s *data;
+  /* Only set if the hashmap owns its keys: HASHMAP_INLINE_KEY_SIZE bytes
+   * per slot for short keys, also in the allocation of the elements. */
+  char *inline_keys;
+  /* The arena for longer owned keys, and how many of its bytes hold keys
+   * that are still in the hashmap and keys that have been removed. */
+  struct hashmap_arena_s *arena;
+  unsigned arena_live;
+  unsigned arena_dead;
 };
 
-#define HASHMAP_MAX_CHAIN_LENGTH (8)
+/* The number of slots probed at once, and the smallest table size. */
+#define HASHMAP_GROUP_WIDTH (16)
+
+/* The control byte of slots without an element. Slots in use hold the low 7
+ * bits of their hash, so they never have the top bit set. */
+#define HASHMAP_EMPTY (0x80)
+
+/* Owned keys shorter than this are kept in the table, NUL terminated. */
+#define HASHMAP_INLINE_KEY_SIZE (24)
+
+/* The size of the arena blocks that longer owned keys are copied into. */
+#define HASHMAP_ARENA_BLOCK_SIZE (1024)
 
 #if defined(__cplusplus)
 extern "C" {
@@ -101,10 +196,24 @@ extern "C" {
 /// @return On success 0 is returned.
 ///
 /// Note that the initial size of the hashmap must be a power of two, and
-/// creation of the hashmap will fail if this is not the case.
+/// creation of the hashmap will fail if this is not the case. Sizes below
+/// HASHMAP_GROUP_WIDTH are rounded up to it.
 static int hashmap_create(const unsigned initial_size,
                           struct hashmap_s *const out_hashmap) HASHMAP_USED;
 
+/// @brief Create a hashmap that keeps its own copy of every key.
+/// @param initial_size The initial size of the hashmap. Must be a power of two.
+/// @param out_hashmap The storage for the created hashmap.
+/// @return On success 0 is returned.
+///
+/// Like hashmap_create, except that hashmap_put copies the key, so the
+/// caller may free it as soon as hashmap_put returns. The key of an element
+/// points into the hashmap, NUL terminated, and may move when the hashmap
+/// is changed.
+static int
+hashmap_create_owned(const unsigned initial_size,
+                     struct hashmap_s *const out_hashmap) HASHMAP_USED;
+
 /// @brief Put an element into the hashmap.
 /// @param hashmap The hashmap to insert into.
 /// @param key The string key to use.
@@ -114,7 +223,8 @@ static int hashmap_create(const unsigned initial_size,
 ///
 /// The key string slice is not copied when creating the hashmap entry, and thus
 /// must remain a valid pointer until the hashmap entry is removed or the
-/// hashmap is destroyed.
+/// hashmap is destroyed, unless the hashmap was made by hashmap_create_owned.
+/// If the key is already in the hashmap its value is replaced.
 static int hashmap_put(struct hashmap_s *const hashmap, const char *const key,
                        const unsigned len, void *const value) HASHMAP_USED;
 
@@ -132,6 +242,9 @@ static void *hashmap_get(const struct hashmap_s *const hashmap,
 /// @param key The string key to use.
 /// @param len The length of the string key.
 /// @return On success 0 is returned.
+///
+/// The hashmap shrinks once fewer than a quarter of the elements it has room
+/// for are left.
 static int hashmap_remove(struct hashmap_s *const hashmap,
                           const char *const key,
                           const unsigned len) HASHMAP_USED;
@@ -153,11 +266,29 @@ static int hashmap_iterate(const struct hashmap_s *const hashmap,
 /// @return If the entire hashmap was iterated then 0 is returned.
 /// Otherwise if the callback function f returned positive then the positive 
 /// value is returned.  If the callback function returns -1, the current item
-/// is removed and iteration continues.
+/// is removed and iteration continues. Every other element is still visited
+/// exactly once.
 static int hashmap_iterate_pairs(struct hashmap_s *const hashmap,
                     int (*f)(void *const, struct hashmap_element_s *const),
                     void *const context) HASHMAP_USED;
 
+/// @brief Make room for a number of elements.
+/// @param hashmap The hashmap to make room in.
+/// @param count The number of elements the hashmap should hold in total.
+/// @return On success 0 is returned.
+///
+/// After this the hashmap holds count elements without having to rehash,
+/// so a hashmap that is about to be filled with a known number of
+/// elements can be sized up front. Removing elements may shrink it again.
+static int hashmap_reserve(struct hashmap_s *const hashmap,
+                           const unsigned count) HASHMAP_USED;
+
+/// @brief Get the number of elements the hashmap holds before it rehashes.
+/// @param hashmap The hashmap to get the capacity of.
+/// @return The capacity of the hashmap.
+static unsigned
+hashmap_capacity(const struct hashmap_s *const hashmap) HASHMAP_USED;
+
 /// @brief Get the size of the hashmap.
 /// @param hashmap The hashmap to get the size of.
 /// @return The size of the hashmap.
@@ -168,21 +299,53 @@ hashmap_num_entries(const struct hashmap_s *const hashmap) HASHMAP_USED;
 /// @param hashmap The hashmap to destroy.
 static void hashmap_destroy(struct hashmap_s *const hashmap) HASHMAP_USED;
 
-static unsigned hashmap_crc32_helper(const char *const s,
-                                     const unsigned len) HASHMAP_USED;
-static unsigned
-hashmap_hash_helper_int_helper(const struct hashmap_s *const m,
-                               const char *const keystring,
+#if defined(HASHMAP_HASH_CRC32)
+static HASHMAP_ALWAYS_INLINE unsigned
+hashmap_crc32_helper(const char *const s, const unsigned len) HASHMAP_USED;
+#else
+static HASHMAP_ALWAYS_INLINE unsigned
+hashmap_wyhash_helper(const char *const s, const unsigned len) HASHMAP_USED;
+#endif
+static HASHMAP_ALWAYS_INLINE unsigned
+hashmap_hash_helper_int_helper(const char *const keystring,
                                const unsigned len) HASHMAP_USED;
-static int hashmap_match_helper(const struct hashmap_element_s *const element,
-                                const char *const key,
-                                const unsigned len) HASHMAP_USED;
-static int hashmap_hash_helper(const struct hashmap_s *const m,
-                               const char *const key, const unsigned len,
-                               unsigned *const out_index) HASHMAP_USED;
-static int hashmap_rehash_iterator(void *const new_hash, 
-                              struct hashmap_element_s *const e) HASHMAP_USED;
-static int hashmap_rehash_helper(struct hashmap_s *const m) HASHMAP_USED;
+static HASHMAP_ALWAYS_INLINE unsigned
+hashmap_group_match(const unsigned char *const ctrl,
+                    const unsigned char h2) HASHMAP_USED;
+static HASHMAP_ALWAYS_INLINE unsigned
+hashmap_group_match_empty(const unsigned char *const ctrl) HASHMAP_USED;
+static HASHMAP_ALWAYS_INLINE unsigned
+hashmap_lowest_bit(const unsigned mask) HASHMAP_USED;
+static HASHMAP_ALWAYS_INLINE int
+hashmap_match_helper(const struct hashmap_element_s *const element,
+                     const char *const key, const unsigned len,
+                     const unsigned hash) HASHMAP_USED;
+static HASHMAP_ALWAYS_INLINE int
+hashmap_find_helper(const struct hashmap_s *const m, const char *const key,
+                    const unsigned len, const unsigned hash,
+                    unsigned *const out_index) HASHMAP_USED;
+static HASHMAP_ALWAYS_INLINE unsigned
+hashmap_find_slot_helper(const struct hashmap_s *const m,
+                         const unsigned hash) HASHMAP_USED;
+static HASHMAP_ALWAYS_INLINE void
+hashmap_set_ctrl_helper(struct hashmap_s *const m, const unsigned index,
+                        const unsigned char c) HASHMAP_USED;
+static int hashmap_create_helper(const unsigned initial_size,
+                                 const int owned_keys,
+                                 struct hashmap_s *const out_hashmap)
+    HASHMAP_USED;
+static char *hashmap_arena_alloc_helper(struct hashmap_s *const m,
+                                        const unsigned bytes) HASHMAP_USED;
+static int hashmap_own_key_helper(struct hashmap_s *const m,
+                                  const unsigned index, const char *const key,
+                                  const unsigned len) HASHMAP_USED;
+static void hashmap_move_helper(struct hashmap_s *const m, const unsigned to,
+                                const unsigned from) HASHMAP_USED;
+static void hashmap_erase_helper(struct hashmap_s *const m,
+                                 unsigned index) HASHMAP_USED;
+static void hashmap_shrink_helper(struct hashmap_s *const m) HASHMAP_USED;
+static int hashmap_rehash_helper(struct hashmap_s *const m,
+                                 const unsigned new_size) HASHMAP_USED;
 
 #if defined(__cplusplus)
 }
@@ -198,40 +361,102 @@ static int hashmap_rehash_helper(struct hashmap_s *const m) HASHMAP_USED;
 #define HASHMAP_NULL 0
 #endif
 
+/* The most elements a table of the given size holds before it grows. */
+#define HASHMAP_MAX_LOAD(table_size) ((table_size) - (table_size) / 8)
+
 int hashmap_create(const unsigned initial_size,
                    struct hashmap_s *const out_hashmap) {
+  return hashmap_create_helper(initial_size, 0, out_hashmap);
+}
+
+int hashmap_create_owned(const unsigned initial_size,
+                         struct hashmap_s *const out_hashmap) {
+  return hashmap_create_helper(initial_size, 1, out_hashmap);
+}
+
+int hashmap_create_helper(const unsigned initial_size, const int owned_keys,
+                          struct hashmap_s *const out_hashmap) {
+  unsigned table_size = initial_size;
+  size_t bytes;
+
   if (0 == initial_size || 0 != (initial_size & (initial_size - 1))) {
     return 1;
   }
 
+  if (table_size < HASHMAP_GROUP_WIDTH) {
+    table_size = HASHMAP_GROUP_WIDTH;
+  }
+
+  /* The elements come first so that they keep their alignment, followed
+   * by the inline keys of an owning hashmap. */
+  bytes = HASHMAP_CAST(size_t, table_size) * sizeof(struct hashmap_element_s) +
+          table_size + HASHMAP_GROUP_WIDTH;
+  if (owned_keys) {
+    bytes += HASHMAP_CAST(size_t, table_size) * HASHMAP_INLINE_KEY_SIZE;
+  }
   out_hashmap->data =
-      HASHMAP_CAST(struct hashmap_element_s *,
-                   calloc(initial_size, sizeof(struct hashmap_element_s)));
+      HASHMAP_CAST(struct hashmap_element_s *, malloc(bytes));
   if (!out_hashmap->data) {
     return 1;
   }
 
-  out_hashmap->table_size = initial_size;
+  /* Empty slots read as not in use. */
+  memset(out_hashmap->data, 0,
+         HASHMAP_CAST(size_t, table_size) * sizeof(struct hashmap_element_s));
+
+  out_hashmap->inline_keys = HASHMAP_NULL;
+  out_hashmap->ctrl = HASHMAP_PTR_CAST(unsigned char *,
+                                       (out_hashmap->data + table_size));
+  if (owned_keys) {
+    out_hashmap->inline_keys = HASHMAP_PTR_CAST(char *, out_hashmap->ctrl);
+    out_hashmap->ctrl += HASHMAP_CAST(size_t, table_size) *
+                         HASHMAP_INLINE_KEY_SIZE;
+  }
+  memset(out_hashmap->ctrl, HASHMAP_EMPTY, table_size + HASHMAP_GROUP_WIDTH);
+
+  out_hashmap->table_size = table_size;
   out_hashmap->size = 0;
+  out_hashmap->arena = HASHMAP_NULL;
+  out_hashmap->arena_live = 0;
+  out_hashmap->arena_dead = 0;
 
   return 0;
 }
 
 int hashmap_put(struct hashmap_s *const m, const char *const key,
                 const unsigned len, void *const value) {
+  const unsigned hash = hashmap_hash_helper_int_helper(key, len);
   unsigned int index;
 
-  /* Find a place to put our value. */
-  while (!hashmap_hash_helper(m, key, len, &index)) {
-    if (hashmap_rehash_helper(m)) {
+  /* Replace the value of a key that is already there. An owned key is
+   * kept. */
+  if (hashmap_find_helper(m, key, len, hash, &index)) {
+    m->data[index].data = value;
+    if (!m->inline_keys) {
+      m->data[index].key = key;
+    }
+    return 0;
+  }
+
+  /* Grow the table if this element would take it over its load factor. If
+   * this multiplication overflows hashmap_create will fail. */
+  if (m->size >= HASHMAP_MAX_LOAD(m->table_size)) {
+    if (hashmap_rehash_helper(m, 2 * m->table_size)) {
       return 1;
     }
   }
 
   /* Set the data. */
+  index = hashmap_find_slot_helper(m, hash);
+  if (!m->inline_keys) {
+    m->data[index].key = key;
+  } else if (hashmap_own_key_helper(m, index, key, len)) {
+    return 1;
+  }
+  hashmap_set_ctrl_helper(m, index, HASHMAP_CAST(unsigned char, (hash & 0x7f)));
   m->data[index].data = value;
-  m->data[index].key = key;
   m->data[index].key_len = len;
+  m->data[index].hash = hash;
   m->data[index].in_use = 1;
   m->size++;
 
@@ -240,21 +465,11 @@ int hashmap_put(struct hashmap_s *const m, const char *const key,
 
 void *hashmap_get(const struct hashmap_s *const m, const char *const key,
                   const unsigned len) {
-  unsigned int curr;
-  unsigned int i;
-
-  /* Find data location */
-  curr = hashmap_hash_helper_int_helper(m, key, len);
-
-  /* Linear probing, if necessary */
-  for (i = 0; i < HASHMAP_MAX_CHAIN_LENGTH; i++) {
-    if (m->data[curr].in_use) {
-      if (hashmap_match_helper(&m->data[curr], key, len)) {
-        return m->data[curr].data;
-      }
-    }
+  unsigned int index;
 
-    curr = (curr + 1) % m->table_size;
+  if (hashmap_find_helper(m, key, len, hashmap_hash_helper_int_helper(key, len),
+                          &index)) {
+    return m->data[index].data;
   }
 
   /* Not found */
@@ -263,40 +478,32 @@ void *hashmap_get(const struct hashmap_s *const m, const char *const key,
 
 int hashmap_remove(struct hashmap_s *const m, const char *const key,
                    const unsigned len) {
-  unsigned int i;
-  unsigned int curr;
+  unsigned int index;
 
   /* Find key */
-  curr = hashmap_hash_helper_int_helper(m, key, len);
-
-  /* Linear probing, if necessary */
-  for (i = 0; i < HASHMAP_MAX_CHAIN_LENGTH; i++) {
-    if (m->data[curr].in_use) {
-      if (hashmap_match_helper(&m->data[curr], key, len)) {
-        /* Blank out the fields including in_use */
-        memset(&m->data[curr], 0, sizeof(struct hashmap_element_s));
-
-        /* Reduce the size */
-        m->size--;
-        return 0;
-      }
-    }
-    curr = (curr + 1) % m->table_size;
+  if (!hashmap_find_helper(m, key, len,
+                           hashmap_hash_helper_int_helper(key, len), &index)) {
+    return 1;
   }
 
-  return 1;
+  hashmap_erase_helper(m, index);
+  hashmap_shrink_helper(m);
+  return 0;
 }
 
 int hashmap_iterate(const struct hashmap_s *const m,
                     int (*f)(void *const, void *const), void *const context) {
   unsigned int i;
+  unsigned full;
 
-  /* Linear probing */
-  for (i = 0; i < m->table_size; i++) {
-    if (m->data[i].in_use) {
-      if (!f(context, m->data[i].data)) {
+  /* Visit the slots in use a group at a time */
+  for (i = 0; i < m->table_size; i += HASHMAP_GROUP_WIDTH) {
+    full = ~hashmap_group_match_empty(m->ctrl + i) & 0xffff;
+    while (full) {
+      if (!f(context, m->data[i + hashmap_lowest_bit(full)].data)) {
         return 1;
       }
+      full &= full - 1;
     }
   }
   return 0;
@@ -305,202 +512,534 @@ int hashmap_iterate(const struct hashmap_s *const m,
 int hashmap_iterate_pairs(struct hashmap_s *const hashmap,
             int (*f)(void *const, struct hashmap_element_s *const),
             void *const context) {
-  unsigned int i;
-  struct hashmap_element_s *p;
+  const unsigned mask = hashmap->table_size - 1;
+  unsigned int i = 0;
+  unsigned start, end, base, limit, index, full;
   int r;
-
-  /* Linear probing */
-  for (i = 0; i < hashmap->table_size; i++) {
-    p=&hashmap->data[i];
-    if (p->in_use) {
-      r=f(context, p);
+  int removed = 0;
+
+  /* Removing an element can shift later elements back into its slot, so
+   * iteration starts after an empty slot, which elements never shift
+   * across, and looks at a slot again after removing from it. That way
+   * each element is visited once. There is always an empty slot. */
+  while (!(full = hashmap_group_match_empty(hashmap->ctrl + i))) {
+    i += HASHMAP_GROUP_WIDTH;
+  }
+  start = i + hashmap_lowest_bit(full) + 1;
+  end = start + hashmap->table_size;
+
+  /* Visit the slots in use a group at a time, from start round to end */
+  for (i = start; i < end; i = base + HASHMAP_GROUP_WIDTH) {
+    base = i & ~(HASHMAP_GROUP_WIDTH - 1);
+    limit = end - base < HASHMAP_GROUP_WIDTH ? (1u << (end - base)) - 1
+                                             : 0xffff;
+    full = ~hashmap_group_match_empty(hashmap->ctrl + (base & mask)) &
+           (limit << (i - base)) & limit;
+    while (full) {
+      index = (base & mask) + hashmap_lowest_bit(full);
+      r=f(context, &hashmap->data[index]);
       switch (r)
       {
         case -1: /* remove item */
-          memset(p, 0, sizeof(struct hashmap_element_s));
-          hashmap->size--;
-          break;
+          hashmap_erase_helper(hashmap, index);
+          removed = 1;
+          /* Carry on from the slot that was just emptied. */
+          full = ~hashmap_group_match_empty(hashmap->ctrl + (base & mask)) &
+                 (limit << (index & (HASHMAP_GROUP_WIDTH - 1))) & limit;
+          continue;
         case 0: /* continue iterating */
           break;
         default: /* early exit */
           return 1;
       }
+      full &= full - 1;
     }
   }
+
+  if (removed) {
+    hashmap_shrink_helper(hashmap);
+  }
   return 0;
 }
 
 void hashmap_destroy(struct hashmap_s *const m) {
+  struct hashmap_arena_s *block = m->arena;
+
+  while (block) {
+    struct hashmap_arena_s *const next = block->next;
+    free(block);
+    block = next;
+  }
+
   free(m->data);
   memset(m, 0, sizeof(struct hashmap_s));
 }
 
+int hashmap_reserve(struct hashmap_s *const m, const unsigned count) {
+  unsigned new_size = m->table_size;
+
+  if (count <= hashmap_capacity(m)) {
+    return 0;
+  }
+
+  while (HASHMAP_MAX_LOAD(new_size) < count) {
+    if (new_size > UINT_MAX / 2) {
+      return 1;
+    }
+    new_size *= 2;
+  }
+
+  return hashmap_rehash_helper(m, new_size);
+}
+
+unsigned hashmap_capacity(const struct hashmap_s *const m) {
+  return HASHMAP_MAX_LOAD(m->table_size);
+}
+
 unsigned hashmap_num_entries(const struct hashmap_s *const m) {
   return m->size;
 }
 
+#if defined(HASHMAP_HASH_CRC32)
+#if defined(__ARM_FEATURE_CRC32)
+#define HASHMAP_CRC32_U64(crc, v) __crc32cd(crc, v)
+#define HASHMAP_CRC32_U32(crc, v) __crc32cw(crc, v)
+#define HASHMAP_CRC32_U8(crc, v) __crc32cb(crc, v)
+#elif defined(__x86_64__) || defined(_M_X64)
+#define HASHMAP_CRC32_U64(crc, v)                                              \
+  HASHMAP_CAST(unsigned, _mm_crc32_u64(crc, v))
+#define HASHMAP_CRC32_U32(crc, v) _mm_crc32_u32(crc, v)
+#define HASHMAP_CRC32_U8(crc, v) _mm_crc32_u8(crc, v)
+#else
+/* 32-bit x86 has no 64-bit CRC32 instruction. */
+#define HASHMAP_CRC32_U64(crc, v)                                              \
+  _mm_crc32_u32(_mm_crc32_u32(crc, HASHMAP_CAST(unsigned, v)),                 \
+                HASHMAP_CAST(unsigned, (v) >> 32))
+#define HASHMAP_CRC32_U32(crc, v) _mm_crc32_u32(crc, v)
+#define HASHMAP_CRC32_U8(crc, v) _mm_crc32_u8(crc, v)
+#endif
+
 unsigned hashmap_crc32_helper(const char *const s, const unsigned len) {
-  unsigned i;
-  unsigned crc32val = 0;
+  unsigned i = 0;
+  unsigned crc32val = 0xffffffffu;
+  unsigned long long word;
+  unsigned half;
+
+  for (; i + 8 <= len; i += 8) {
+    memcpy(&word, s + i, sizeof(word));
+    crc32val = HASHMAP_CRC32_U64(crc32val, word);
+  }
 
-#if defined(HASHMAP_SSE42)
-  for (i = 0; i < len; i++) {
-    crc32val = _mm_crc32_u8(crc32val, HASHMAP_CAST(unsigned char, s[i]));
+  if (i + 4 <= len) {
+    memcpy(&half, s + i, sizeof(half));
+    crc32val = HASHMAP_CRC32_U32(crc32val, half);
+    i += 4;
   }
 
-  return crc32val;
-#else
-  // Using polynomial 0x11EDC6F41 to match SSE 4.2's crc function.
-  static const unsigned crc32_tab[] = {
-      0x00000000U, 0xF26B8303U, 0xE13B70F7U, 0x1350F3F4U, 0xC79A971FU,
-      0x35F1141CU, 0x26A1E7E8U, 0xD4CA64EBU, 0x8AD958CFU, 0x78B2DBCCU,
-      0x6BE22838U, 0x9989AB3BU, 0x4D43CFD0U, 0xBF284CD3U, 0xAC78BF27U,
-      0x5E133C24U, 0x105EC76FU, 0xE235446CU, 0xF165B798U, 0x030E349BU,
-      0xD7C45070U, 0x25AFD373U, 0x36FF2087U, 0xC494A384U, 0x9A879FA0U,
-      0x68EC1CA3U, 0x7BBCEF57U, 0x89D76C54U, 0x5D1D08BFU, 0xAF768BBCU,
-      0xBC267848U, 0x4E4DFB4BU, 0x20BD8EDEU, 0xD2D60DDDU, 0xC186FE29U,
-      0x33ED7D2AU, 0xE72719C1U, 0x154C9AC2U, 0x061C6936U, 0xF477EA35U,
-      0xAA64D611U, 0x580F5512U, 0x4B5FA6E6U, 0xB93425E5U, 0x6DFE410EU,
-      0x9F95C20DU, 0x8CC531F9U, 0x7EAEB2FAU, 0x30E349B1U, 0xC288CAB2U,
-      0xD1D83946U, 0x23B3BA45U, 0xF779DEAEU, 0x05125DADU, 0x1642AE59U,
-      0xE4292D5AU, 0xBA3A117EU, 0x4851927DU, 0x5B016189U, 0xA96AE28AU,
-      0x7DA08661U, 0x8FCB0562U, 0x9C9BF696U, 0x6EF07595U, 0x417B1DBCU,
-      0xB3109EBFU, 0xA0406D4BU, 0x522BEE48U, 0x86E18AA3U, 0x748A09A0U,
-      0x67DAFA54U, 0x95B17957U, 0xCBA24573U, 0x39C9C670U, 0x2A993584U,
-      0xD8F2B687U, 0x0C38D26CU, 0xFE53516FU, 0xED03A29BU, 0x1F682198U,
-      0x5125DAD3U, 0xA34E59D0U, 0xB01EAA24U, 0x42752927U, 0x96BF4DCCU,
-      0x64D4CECFU, 0x77843D3BU, 0x85EFBE38U, 0xDBFC821CU, 0x2997011FU,
-      0x3AC7F2EBU, 0xC8AC71E8U, 0x1C661503U, 0xEE0D9600U, 0xFD5D65F4U,
-      0x0F36E6F7U, 0x61C69362U, 0x93AD1061U, 0x80FDE395U, 0x72966096U,
-      0xA65C047DU, 0x5437877EU, 0x4767748AU, 0xB50CF789U, 0xEB1FCBADU,
-      0x197448AEU, 0x0A24BB5AU, 0xF84F3859U, 0x2C855CB2U, 0xDEEEDFB1U,
-      0xCDBE2C45U, 0x3FD5AF46U, 0x7198540DU, 0x83F3D70EU, 0x90A324FAU,
-      0x62C8A7F9U, 0xB602C312U, 0x44694011U, 0x5739B3E5U, 0xA55230E6U,
-      0xFB410CC2U, 0x092A8FC1U, 0x1A7A7C35U, 0xE811FF36U, 0x3CDB9BDDU,
-      0xCEB018DEU, 0xDDE0EB2AU, 0x2F8B6829U, 0x82F63B78U, 0x709DB87BU,
-      0x63CD4B8FU, 0x91A6C88CU, 0x456CAC67U, 0xB7072F64U, 0xA457DC90U,
-      0x563C5F93U, 0x082F63B7U, 0xFA44E0B4U, 0xE9141340U, 0x1B7F9043U,
-      0xCFB5F4A8U, 0x3DDE77ABU, 0x2E8E845FU, 0xDCE5075CU, 0x92A8FC17U,
-      0x60C37F14U, 0x73938CE0U, 0x81F80FE3U, 0x55326B08U, 0xA759E80BU,
-      0xB4091BFFU, 0x466298FCU, 0x1871A4D8U, 0xEA1A27DBU, 0xF94AD42FU,
-      0x0B21572CU, 0xDFEB33C7U, 0x2D80B0C4U, 0x3ED04330U, 0xCCBBC033U,
-      0xA24BB5A6U, 0x502036A5U, 0x4370C551U, 0xB11B4652U, 0x65D122B9U,
-      0x97BAA1BAU, 0x84EA524EU, 0x7681D14DU, 0x2892ED69U, 0xDAF96E6AU,
-      0xC9A99D9EU, 0x3BC21E9DU, 0xEF087A76U, 0x1D63F975U, 0x0E330A81U,
-      0xFC588982U, 0xB21572C9U, 0x407EF1CAU, 0x532E023EU, 0xA145813DU,
-      0x758FE5D6U, 0x87E466D5U, 0x94B49521U, 0x66DF1622U, 0x38CC2A06U,
-      0xCAA7A905U, 0xD9F75AF1U, 0x2B9CD9F2U, 0xFF56BD19U, 0x0D3D3E1AU,
-      0x1E6DCDEEU, 0xEC064EEDU, 0xC38D26C4U, 0x31E6A5C7U, 0x22B65633U,
-      0xD0DDD530U, 0x0417B1DBU, 0xF67C32D8U, 0xE52CC12CU, 0x1747422FU,
-      0x49547E0BU, 0xBB3FFD08U, 0xA86F0EFCU, 0x5A048DFFU, 0x8ECEE914U,
-      0x7CA56A17U, 0x6FF599E3U, 0x9D9E1AE0U, 0xD3D3E1ABU, 0x21B862A8U,
-      0x32E8915CU, 0xC083125FU, 0x144976B4U, 0xE622F5B7U, 0xF5720643U,
-      0x07198540U, 0x590AB964U, 0xAB613A67U, 0xB831C993U, 0x4A5A4A90U,
-      0x9E902E7BU, 0x6CFBAD78U, 0x7FAB5E8CU, 0x8DC0DD8FU, 0xE330A81AU,
-      0x115B2B19U, 0x020BD8EDU, 0xF0605BEEU, 0x24AA3F05U, 0xD6C1BC06U,
-      0xC5914FF2U, 0x37FACCF1U, 0x69E9F0D5U, 0x9B8273D6U, 0x88D28022U,
-      0x7AB90321U, 0xAE7367CAU, 0x5C18E4C9U, 0x4F48173DU, 0xBD23943EU,
-      0xF36E6F75U, 0x0105EC76U, 0x12551F82U, 0xE03E9C81U, 0x34F4F86AU,
-      0xC69F7B69U, 0xD5CF889DU, 0x27A40B9EU, 0x79B737BAU, 0x8BDCB4B9U,
-      0x988C474DU, 0x6AE7C44EU, 0xBE2DA0A5U, 0x4C4623A6U, 0x5F16D052U,
-      0xAD7D5351U};
-
-  for (i = 0; i < len; i++) {
-    crc32val = crc32_tab[(HASHMAP_CAST(unsigned char, crc32val) ^
-                          HASHMAP_CAST(unsigned char, s[i]))] ^
-               (crc32val >> 8);
+  for (; i < len; i++) {
+    crc32val = HASHMAP_CRC32_U8(crc32val, HASHMAP_CAST(unsigned char, s[i]));
   }
+
   return crc32val;
+}
+
+unsigned hashmap_hash_helper_int_helper(const char *const keystring,
+                                        const unsigned len) {
+  const unsigned long long crc = hashmap_crc32_helper(keystring, len);
+
+  /* A CRC is linear in its input, so it is spread over all the bits with a
+   * Fibonacci multiply, keeping the upper half of the product. */
+  return HASHMAP_CAST(unsigned, ((crc * 0x9e3779b97f4a7c15ull) >> 32));
+}
+#else
+/* The constants of wyhash (https://github.com/wangyi-fudan/wyhash). */
+#define HASHMAP_WYP0 (0xa0761d6478bd642full)
+#define HASHMAP_WYP1 (0xe7037ed1a0b428dbull)
+#define HASHMAP_WYP2 (0x8ebc6af09c88c6e3ull)
+
+static unsigned long long hashmap_read64(const unsigned char *const p) {
+  unsigned long long word;
+  memcpy(&word, p, sizeof(word));
+  return word;
+}
+
+static unsigned long long hashmap_read32(const unsigned char *const p) {
+  unsigned word;
+  memcpy(&word, p, sizeof(word));
+  return word;
+}
+
+/* Multiplies a and b to 128 bits and folds the halves together. */
+static unsigned long long hashmap_mix64(const unsigned long long a,
+                                        const unsigned long long b) {
+#if defined(__SIZEOF_INT128__)
+  const __uint128_t r = HASHMAP_CAST(__uint128_t, a) * b;
+  return HASHMAP_CAST(unsigned long long, r) ^
+         HASHMAP_CAST(unsigned long long, (r >> 64));
+#elif defined(_MSC_VER) && defined(_M_X64)
+  unsigned long long hi;
+  const unsigned long long lo = _umul128(a, b, &hi);
+  return lo ^ hi;
+#else
+  const unsigned long long ha = a >> 32, la = a & 0xffffffffu;
+  const unsigned long long hb = b >> 32, lb = b & 0xffffffffu;
+  const unsigned long long mid0 = ha * lb, mid1 = la * hb;
+  const unsigned long long low = la * lb;
+  const unsigned long long t = low + (mid0 << 32);
+  const unsigned long long lo = t + (mid1 << 32);
+  const unsigned long long hi = ha * hb + (mid0 >> 32) + (mid1 >> 32) +
+                                (t < low) + (lo < t);
+  return lo ^ hi;
 #endif
 }
 
-unsigned hashmap_hash_helper_int_helper(const struct hashmap_s *const m,
-                                        const char *const keystring,
+unsigned hashmap_wyhash_helper(const char *const s, const unsigned len) {
+  const unsigned char *p = HASHMAP_PTR_CAST(const unsigned char *, s);
+  unsigned long long seed = HASHMAP_WYP0;
+  unsigned long long a, b, h;
+  unsigned i = len;
+
+  if (len <= 16) {
+    /* Short keys are read as two, possibly overlapping, pairs of words. */
+    if (len >= 4) {
+      const unsigned shift = (len >> 3) << 2;
+      a = (hashmap_read32(p) << 32) | hashmap_read32(p + shift);
+      b = (hashmap_read32(p + len - 4) << 32) |
+          hashmap_read32(p + len - 4 - shift);
+    } else if (len > 0) {
+      a = (HASHMAP_CAST(unsigned long long, p[0]) << 16) |
+          (HASHMAP_CAST(unsigned long long, p[len >> 1]) << 8) | p[len - 1];
+      b = 0;
+    } else {
+      a = b = 0;
+    }
+  } else {
+    for (; i > 16; i -= 16, p += 16) {
+      seed = hashmap_mix64(hashmap_read64(p) ^ HASHMAP_WYP1,
+                           hashmap_read64(p + 8) ^ seed);
+    }
+    /* The last 16 bytes, which may overlap the last block. */
+    a = hashmap_read64(p + i - 16);
+    b = hashmap_read64(p + i - 8);
+  }
+
+  h = hashmap_mix64(a ^ HASHMAP_WYP1, b ^ seed);
+  h = hashmap_mix64(h ^ HASHMAP_WYP2, len ^ HASHMAP_WYP1);
+  return HASHMAP_CAST(unsigned, (h ^ (h >> 32)));
+}
+
+unsigned hashmap_hash_helper_int_helper(const char *const keystring,
                                         const unsigned len) {
-  unsigned key = hashmap_crc32_helper(keystring, len);
+  return hashmap_wyhash_helper(keystring, len);
+}
+#endif
 
-  /* Robert Jenkins' 32 bit Mix Function */
-  key += (key << 12);
-  key ^= (key >> 22);
-  key += (key << 4);
-  key ^= (key >> 9);
-  key += (key << 10);
-  key ^= (key >> 2);
-  key += (key << 7);
-  key ^= (key >> 12);
+/*
+ * The group helpers return a mask with bit i set when control byte i of the
+ * group at ctrl matches.
+ */
+#if defined(HASHMAP_SSE2)
+unsigned hashmap_group_match(const unsigned char *const ctrl,
+                             const unsigned char h2) {
+  const __m128i group =
+      _mm_loadu_si128(HASHMAP_PTR_CAST(const __m128i *, ctrl));
+  const __m128i match = _mm_set1_epi8(HASHMAP_CAST(char, h2));
+  return HASHMAP_CAST(unsigned,
+                      _mm_movemask_epi8(_mm_cmpeq_epi8(group, match)));
+}
 
-  /* Knuth's Multiplicative Method */
-  key = (key >> 3) * 2654435761;
+unsigned hashmap_group_match_empty(const unsigned char *const ctrl) {
+  /* Empty is the only control byte with the top bit set. */
+  return HASHMAP_CAST(unsigned, _mm_movemask_epi8(_mm_loadu_si128(
+                                    HASHMAP_PTR_CAST(const __m128i *, ctrl))));
+}
+#else
+/* Without SSE2 each half of the group is handled eight bytes at a time. */
+#define HASHMAP_LSBS (0x0101010101010101ull)
+#define HASHMAP_MSBS (0x8080808080808080ull)
+
+static unsigned long long hashmap_group_load(const unsigned char *const ctrl) {
+  unsigned long long word;
+  memcpy(&word, ctrl, sizeof(word));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  word = __builtin_bswap64(word);
+#endif
+  return word;
+}
 
-  return key % m->table_size;
+/* Gathers the top bit of each byte into the low eight bits. */
+static unsigned hashmap_group_bits(const unsigned long long msbs) {
+  return HASHMAP_CAST(unsigned, (((msbs >> 7) * 0x0102040810204080ull) >> 56));
 }
 
-int hashmap_match_helper(const struct hashmap_element_s *const element,
-                         const char *const key, const unsigned len) {
-  return (element->key_len == len) && (0 == memcmp(element->key, key, len));
+unsigned hashmap_group_match(const unsigned char *const ctrl,
+                             const unsigned char h2) {
+  unsigned mask = 0;
+  int half;
+
+  for (half = 1; half >= 0; half--) {
+    /* Bytes equal to h2 become zero. This can report a byte right above a
+     * match as a match too, which is harmless as the keys are compared. */
+    const unsigned long long x =
+        hashmap_group_load(ctrl + 8 * half) ^ (HASHMAP_LSBS * h2);
+    mask = (mask << 8) |
+           hashmap_group_bits((x - HASHMAP_LSBS) & ~x & HASHMAP_MSBS);
+  }
+  return mask;
 }
 
-int hashmap_hash_helper(const struct hashmap_s *const m, const char *const key,
-                        const unsigned len, unsigned *const out_index) {
-  unsigned int curr;
-  unsigned int i;
+unsigned hashmap_group_match_empty(const unsigned char *const ctrl) {
+  unsigned mask = 0;
+  int half;
 
-  /* If full, return immediately */
-  if (m->size >= m->table_size) {
-    return 0;
+  for (half = 1; half >= 0; half--) {
+    /* Empty is the only control byte with the top bit set. */
+    const unsigned long long x = hashmap_group_load(ctrl + 8 * half);
+    mask = (mask << 8) | hashmap_group_bits(x & HASHMAP_MSBS);
   }
+  return mask;
+}
+#endif
 
-  /* Find the best index */
-  curr = hashmap_hash_helper_int_helper(m, key, len);
+unsigned hashmap_lowest_bit(const unsigned mask) {
+#if defined(_MSC_VER)
+  unsigned long index;
+  _BitScanForward(&index, mask);
+  return HASHMAP_CAST(unsigned, index);
+#else
+  return HASHMAP_CAST(unsigned, __builtin_ctz(mask));
+#endif
+}
 
-  /* Linear probing */
-  for (i = 0; i < HASHMAP_MAX_CHAIN_LENGTH; i++) {
-    if (!m->data[curr].in_use) {
-      *out_index = curr;
-      return 1;
+int hashmap_match_helper(const struct hashmap_element_s *const element,
+                         const char *const key, const unsigned len,
+                         const unsigned hash) {
+  return (element->hash == hash) && (element->key_len == len) &&
+         (0 == memcmp(element->key, key, len));
+}
+
+/*
+ * Groups are probed one after the other from the home slot of the hash.
+ * Returns 1 and the index of the element with the given key, or 0 if there
+ * is none.
+ */
+int hashmap_find_helper(const struct hashmap_s *const m, const char *const key,
+                        const unsigned len, const unsigned hash,
+                        unsigned *const out_index) {
+  const unsigned mask = m->table_size - 1;
+  const unsigned char h2 = HASHMAP_CAST(unsigned char, (hash & 0x7f));
+  unsigned curr = (hash >> 7) & mask;
+  unsigned probed;
+
+  for (probed = 0; probed < m->table_size; probed += HASHMAP_GROUP_WIDTH) {
+    unsigned match = hashmap_group_match(m->ctrl + curr, h2);
+
+    while (match) {
+      const unsigned index = (curr + hashmap_lowest_bit(match)) & mask;
+      if (hashmap_match_helper(&m->data[index], key, len, hash)) {
+        *out_index = index;
+        return 1;
+      }
+      match &= match - 1;
     }
 
-    if (m->data[curr].in_use &&
-        hashmap_match_helper(&m->data[curr], key, len)) {
-      *out_index = curr;
-      return 1;
+    /* The key would have gone into an empty slot of this group. */
+    if (hashmap_group_match_empty(m->ctrl + curr)) {
+      return 0;
     }
 
-    curr = (curr + 1) % m->table_size;
+    curr = (curr + HASHMAP_GROUP_WIDTH) & mask;
   }
 
   return 0;
 }
 
-int hashmap_rehash_iterator(void *const new_hash,
-  struct hashmap_element_s *const e) {
-  int temp=hashmap_put(HASHMAP_PTR_CAST(struct hashmap_s *, new_hash),
-    e->key, e->key_len, e->data);
-  if (0<temp) {
-    return 1;
+/*
+ * Returns the first empty slot at or after the home slot of hash. There
+ * always is one, as the table is never filled beyond its load factor.
+ */
+unsigned hashmap_find_slot_helper(const struct hashmap_s *const m,
+                                  const unsigned hash) {
+  const unsigned mask = m->table_size - 1;
+  unsigned curr = (hash >> 7) & mask;
+  unsigned match;
+
+  while (!(match = hashmap_group_match_empty(m->ctrl + curr))) {
+    curr = (curr + HASHMAP_GROUP_WIDTH) & mask;
+  }
+
+  return (curr + hashmap_lowest_bit(match)) & mask;
+}
+
+/* Sets a control byte and, for the first group, its copy past the end. */
+void hashmap_set_ctrl_helper(struct hashmap_s *const m, const unsigned index,
+                             const unsigned char c) {
+  m->ctrl[index] = c;
+  m->ctrl[((index - HASHMAP_GROUP_WIDTH) & (m->table_size - 1)) +
+          HASHMAP_GROUP_WIDTH] = c;
+}
+
+/*
+ * Empties a slot, then walks the rest of its cluster and moves back every
+ * element whose probe sequence passes the empty slot, which becomes the
+ * slot that element left. Lookups never see a gap between an element and
+ * its home slot, so no tombstone is needed.
+ */
+void hashmap_erase_helper(struct hashmap_s *const m, unsigned index) {
+  const unsigned mask = m->table_size - 1;
+  unsigned curr = index;
+  unsigned home;
+
+  /* An owned key in the arena stays there until the arena is compacted. */
+  if (m->inline_keys && m->data[index].key_len >= HASHMAP_INLINE_KEY_SIZE) {
+    m->arena_live -= m->data[index].key_len + 1;
+    m->arena_dead += m->data[index].key_len + 1;
   }
-  /* clear old value to avoid stale pointers */
-  return -1;
+
+  for (;;) {
+    curr = (curr + 1) & mask;
+    if (HASHMAP_EMPTY == m->ctrl[curr]) {
+      break;
+    }
+
+    /* Move the element if the empty slot is no further from its home slot
+     * than where it is now. */
+    home = (m->data[curr].hash >> 7) & mask;
+    if (((curr - home) & mask) >= ((curr - index) & mask)) {
+      hashmap_set_ctrl_helper(m, index, m->ctrl[curr]);
+      hashmap_move_helper(m, index, curr);
+      index = curr;
+    }
+  }
+
+  hashmap_set_ctrl_helper(m, index, HASHMAP_EMPTY);
+  m->data[index].in_use = 0;
+  m->size--;
 }
+
+/*
+ * Halves the table while less than a quarter of its capacity is in use, and
+ * rehashes it at the same size if most of the key arena is taken up by keys
+ * that have been removed, as rehashing compacts the arena.
+ */
+void hashmap_shrink_helper(struct hashmap_s *const m) {
+  unsigned new_size = m->table_size;
+
+  while (new_size > HASHMAP_GROUP_WIDTH &&
+         m->size < HASHMAP_MAX_LOAD(new_size) / 4) {
+    new_size /= 2;
+  }
+
+  /* If the new table cannot be allocated, keep the current one. */
+  if (new_size != m->table_size ||
+      (m->arena_dead > HASHMAP_ARENA_BLOCK_SIZE &&
+       m->arena_dead > m->arena_live)) {
+    hashmap_rehash_helper(m, new_size);
+  }
+}
+
 /*
- * Doubles the size of the hashmap, and rehashes all the elements
+ * Returns bytes of arena for an owned key. Keys that do not fit in what is
+ * left of the current block get a block of their own if they are larger than
+ * a block, so that the rest of the current block is not wasted.
  */
-int hashmap_rehash_helper(struct hashmap_s *const m) {
-  /* If this multiplication overflows hashmap_create will fail. */
-  unsigned new_size = 2 * m->table_size;
+char *hashmap_arena_alloc_helper(struct hashmap_s *const m,
+                                 const unsigned bytes) {
+  struct hashmap_arena_s *block = m->arena;
+  char *result;
+
+  if (!block || block->size - block->used < bytes) {
+    const unsigned size =
+        bytes > HASHMAP_ARENA_BLOCK_SIZE ? bytes : HASHMAP_ARENA_BLOCK_SIZE;
+    block = HASHMAP_CAST(struct hashmap_arena_s *,
+                         malloc(sizeof(struct hashmap_arena_s) + size));
+    if (!block) {
+      return HASHMAP_NULL;
+    }
+    block->used = 0;
+    block->size = size;
+    if (m->arena && size > HASHMAP_ARENA_BLOCK_SIZE) {
+      block->next = m->arena->next;
+      m->arena->next = block;
+    } else {
+      block->next = m->arena;
+      m->arena = block;
+    }
+  }
 
+  result = HASHMAP_PTR_CAST(char *, (block + 1)) + block->used;
+  block->used += bytes;
+  return result;
+}
+
+/*
+ * Copies a key into the hashmap for the element at index, inline if it is
+ * short enough and into the arena otherwise.
+ */
+int hashmap_own_key_helper(struct hashmap_s *const m, const unsigned index,
+                           const char *const key, const unsigned len) {
+  char *copy;
+
+  if (len < HASHMAP_INLINE_KEY_SIZE) {
+    copy = m->inline_keys + HASHMAP_CAST(size_t, index) *
+                                HASHMAP_INLINE_KEY_SIZE;
+  } else {
+    copy = hashmap_arena_alloc_helper(m, len + 1);
+    if (!copy) {
+      return 1;
+    }
+    m->arena_live += len + 1;
+  }
+
+  memcpy(copy, key, len);
+  copy[len] = '\0';
+  m->data[index].key = copy;
+  return 0;
+}
+
+/* Moves an element to another slot, taking an inline key along with it. */
+void hashmap_move_helper(struct hashmap_s *const m, const unsigned to,
+                         const unsigned from) {
+  m->data[to] = m->data[from];
+
+  if (m->inline_keys && m->data[to].key_len < HASHMAP_INLINE_KEY_SIZE) {
+    char *const key =
+        m->inline_keys + HASHMAP_CAST(size_t, to) * HASHMAP_INLINE_KEY_SIZE;
+    memcpy(key, m->data[from].key, m->data[to].key_len + 1);
+    m->data[to].key = key;
+  }
+}
+
+/*
+ * Moves every element into a new table of new_size slots, placing each by
+ * its stored hash. Owned keys are copied too, which leaves the keys that
+ * have been removed behind in the old arena.
+ */
+int hashmap_rehash_helper(struct hashmap_s *const m, const unsigned new_size) {
   struct hashmap_s new_hash;
+  unsigned i;
 
-  int flag = hashmap_create(new_size, &new_hash);
-  if (0!=flag) {
-    return flag;
+  if (0 != hashmap_create_helper(new_size, HASHMAP_NULL != m->inline_keys,
+                                 &new_hash)) {
+    return 1;
   }
 
-  /* copy the old elements to the new table */
-  flag = hashmap_iterate_pairs(m, hashmap_rehash_iterator, HASHMAP_PTR_CAST(void *, &new_hash));
-  if (0!=flag) {
-    return flag;
+  /* The keys are known to be distinct, so they only need a free slot. */
+  for (i = 0; i < m->table_size; i++) {
+    if (m->ctrl[i] < HASHMAP_EMPTY) {
+      const unsigned index =
+          hashmap_find_slot_helper(&new_hash, m->data[i].hash);
+      hashmap_set_ctrl_helper(&new_hash, index, m->ctrl[i]);
+      new_hash.data[index] = m->data[i];
+      if (m->inline_keys &&
+          hashmap_own_key_helper(&new_hash, index, m->data[i].key,
+                                 m->data[i].key_len)) {
+        hashmap_destroy(&new_hash);
+        return 1;
+      }
+    }
   }
+  new_hash.size = m->size;
 
   hashmap_destroy(m);
   /* put new hash into old hash structure by copying */
@@ -515,4 +1054,4 @@ int hashmap_rehash_helper(struct hashmap_s *const m) {
 #pragma clang diagnostic pop
 #endif
 
-#endif
\ No newline at end of file
+#endif
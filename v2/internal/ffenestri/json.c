@@ -26,44 +26,72 @@
 */
 
 #include "json.h"
+#include "json_pow10.h"
+#include "hashmap.h"
 
 #include <assert.h>
+#include <float.h>
+#include <locale.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#if !defined(JSON_NO_SIMD) && defined(__x86_64__) && defined(__GNUC__)
+#define JSON_SIMD_X86 1
+#include <immintrin.h>
+#endif
+
+#if defined(__GNUC__)
+#define NO_SANITIZE_ADDRESS __attribute__((no_sanitize_address))
+#else
+#define NO_SANITIZE_ADDRESS
+#endif
+
 #define out_of_memory() do {                    \
 		fprintf(stderr, "Out of memory.\n");    \
 		exit(EXIT_FAILURE);                     \
 	} while (0)
 
-/* Sadly, strdup is not portable. */
-static char *json_strdup(const char *str)
-{
-	char *ret = (char*) malloc(strlen(str) + 1);
-	if (ret == NULL)
-		out_of_memory();
-	strcpy(ret, str);
-	return ret;
-}
-
 /* String buffer */
 
-typedef struct
+typedef struct SB SB;
+
+struct SB
 {
 	char *cur;
 	char *end;
 	char *start;
-} SB;
+	
+	/*
+	 * If set, a full buffer is handed to flush, which must make room by
+	 * consuming its contents, instead of being grown.  This is how output
+	 * goes to memory that json.c does not own.
+	 */
+	void (*flush)(SB *sb);
+	void *ctx;
+};
 
-static void sb_init(SB *sb)
+/* Smallest buffer a flush must leave room for, enough for any sb_need. */
+#define SB_MIN_FLUSH 64
+
+static void sb_init_capacity(SB *sb, size_t capacity)
 {
-	sb->start = (char*) malloc(17);
+	if (capacity < 16)
+		capacity = 16;
+	sb->start = (char*) malloc(capacity + 1);
 	if (sb->start == NULL)
 		out_of_memory();
 	sb->cur = sb->start;
-	sb->end = sb->start + 16;
+	sb->end = sb->start + capacity;
+	sb->flush = NULL;
+	sb->ctx = NULL;
+}
+
+static void sb_init(SB *sb)
+{
+	sb_init_capacity(sb, 16);
 }
 
 /* sb and need may be evaluated multiple times. */
@@ -77,6 +105,12 @@ static void sb_grow(SB *sb, int need)
 	size_t length = sb->cur - sb->start;
 	size_t alloc = sb->end - sb->start;
 	
+	if (sb->flush != NULL) {
+		sb->flush(sb);
+		assert(sb->end - sb->cur >= need);
+		return;
+	}
+	
 	do {
 		alloc *= 2;
 	} while (alloc < length + need);
@@ -90,6 +124,16 @@ static void sb_grow(SB *sb, int need)
 
 static void sb_put(SB *sb, const char *bytes, int count)
 {
+	/* A flushed buffer may be smaller than @count. */
+	while (sb->flush != NULL && count > sb->end - sb->cur) {
+		int n = (int) (sb->end - sb->cur);
+		memcpy(sb->cur, bytes, n);
+		sb->cur += n;
+		bytes += n;
+		count -= n;
+		sb->flush(sb);
+	}
+	
 	sb_need(sb, count);
 	memcpy(sb->cur, bytes, count);
 	sb->cur += count;
@@ -119,383 +163,3294 @@ static void sb_free(SB *sb)
 }
 
 /*
- * Unicode helper functions
+ * Node pool
  *
- * These are taken from the ccan/charset module and customized a bit.
- * Putting them here means the compiler can (choose to) inline them,
- * and it keeps ccan/json from having a dependency.
+ * Heap nodes, and the strings they own when those are short, are recycled
+ * through freelists private to each thread, so a small document that is
+ * decoded and deleted over and over stops going to the system allocator.
+ * A node may be deleted on another thread than the one that made it; it
+ * then joins the lists of that thread.  The lists are bounded, and they
+ * are released when their thread exits.
  */
 
-/*
- * Type for Unicode codepoints.
- * We need our own because wchar_t might be 16 bits.
- */
-typedef uint32_t uchar_t;
+/* POOL_MAX_SCRATCH is the largest decoder scratch buffer kept for the next decode. */
+#ifdef JSON_NO_POOL
+#define POOL_MAX_SCRATCH    0
+#else
+#define POOL_MAX_NODES      1024
+#define POOL_MAX_STRINGS    1024
+#define POOL_MAX_SCRATCH    4096
+#endif
 
-/*
- * Validate a single UTF-8 character starting at @s.
- * The string must be null-terminated.
- *
- * If it's valid, return its length (1 thru 4).
- * If it's invalid or clipped, return 0.
- *
- * This function implements the syntax given in RFC3629, which is
- * the same as that given in The Unicode Standard, Version 6.0.
- *
- * It has the following properties:
- *
- *  * All codepoints U+0000..U+10FFFF may be encoded,
- *    except for U+D800..U+DFFF, which are reserved
- *    for UTF-16 surrogate pair encoding.
- *  * UTF-8 byte sequences longer than 4 bytes are not permitted,
- *    as they exceed the range of Unicode.
- *  * The sixty-six Unicode "non-characters" are permitted
- *    (namely, U+FDD0..U+FDEF, U+xxFFFE, and U+xxFFFF).
- */
-static int utf8_validate_cz(const char *s)
+/* Owned strings shorter than this are allocated at this size, so they can be reused. */
+#define POOL_STRING_SIZE    32
+
+typedef struct PoolItem PoolItem;
+
+struct PoolItem
 {
-	unsigned char c = *s++;
+	PoolItem *next;
+};
+
+typedef struct
+{
+	PoolItem *nodes;
+	PoolItem *strings;
+	JsonPoolStats stats;
 	
-	if (c <= 0x7F) {        /* 00..7F */
-		return 1;
-	} else if (c <= 0xC1) { /* 80..C1 */
-		/* Disallow overlong 2-byte sequence. */
-		return 0;
-	} else if (c <= 0xDF) { /* C2..DF */
-		/* Make sure subsequent byte is in the range 0x80..0xBF. */
-		if (((unsigned char)*s++ & 0xC0) != 0x80)
-			return 0;
-		
-		return 2;
-	} else if (c <= 0xEF) { /* E0..EF */
-		/* Disallow overlong 3-byte sequence. */
-		if (c == 0xE0 && (unsigned char)*s < 0xA0)
-			return 0;
-		
-		/* Disallow U+D800..U+DFFF. */
-		if (c == 0xED && (unsigned char)*s > 0x9F)
-			return 0;
-		
-		/* Make sure subsequent bytes are in the range 0x80..0xBF. */
-		if (((unsigned char)*s++ & 0xC0) != 0x80)
-			return 0;
-		if (((unsigned char)*s++ & 0xC0) != 0x80)
-			return 0;
-		
-		return 3;
-	} else if (c <= 0xF4) { /* F0..F4 */
-		/* Disallow overlong 4-byte sequence. */
-		if (c == 0xF0 && (unsigned char)*s < 0x90)
-			return 0;
-		
-		/* Disallow codepoints beyond U+10FFFF. */
-		if (c == 0xF4 && (unsigned char)*s > 0x8F)
-			return 0;
-		
-		/* Make sure subsequent bytes are in the range 0x80..0xBF. */
-		if (((unsigned char)*s++ & 0xC0) != 0x80)
-			return 0;
-		if (((unsigned char)*s++ & 0xC0) != 0x80)
-			return 0;
-		if (((unsigned char)*s++ & 0xC0) != 0x80)
-			return 0;
-		
-		return 4;
-	} else {                /* F5..FF */
-		return 0;
-	}
+	/* The scratch buffer of the last decode, or NULL. */
+	char *scratch;
+	size_t scratch_capacity;
+	
+	/* Whether pool_key will trim the lists when the thread exits. */
+	bool registered;
+} Pool;
+
+static __thread Pool pool;
+static pthread_key_t pool_key;
+static pthread_once_t pool_key_once = PTHREAD_ONCE_INIT;
+static bool pool_key_valid;
+
+static void pool_thread_exit(void *unused)
+{
+	(void) unused;
+	json_pool_trim();
 }
 
-/* Validate a null-terminated UTF-8 string. */
-static bool utf8_validate(const char *s)
+static void pool_key_create(void)
 {
-	int len;
+	pool_key_valid = pthread_key_create(&pool_key, pool_thread_exit) == 0;
+}
+
+static void pool_register(void)
+{
+	pthread_once(&pool_key_once, pool_key_create);
+	if (pool_key_valid)
+		pthread_setspecific(pool_key, &pool);
+	pool.registered = true;
+}
+
+/* Returns an uninitialized node. */
+static JsonNode *pool_node_alloc(void)
+{
+	PoolItem *item = pool.nodes;
 	
-	for (; *s != 0; s += len) {
-		len = utf8_validate_cz(s);
-		if (len == 0)
-			return false;
+	if (item != NULL) {
+		pool.nodes = item->next;
+		pool.stats.nodes_cached--;
+		pool.stats.node_hits++;
+		return (JsonNode*) item;
 	}
 	
-	return true;
+	pool.stats.node_misses++;
+	item = (PoolItem*) malloc(sizeof(JsonNode));
+	if (item == NULL)
+		out_of_memory();
+	return (JsonNode*) item;
 }
 
-/*
- * Read a single UTF-8 character starting at @s,
- * returning the length, in bytes, of the character read.
- *
- * This function assumes input is valid UTF-8,
- * and that there are enough characters in front of @s.
- */
-static int utf8_read_char(const char *s, uchar_t *out)
+static void pool_node_free(JsonNode *node)
 {
-	const unsigned char *c = (const unsigned char*) s;
+#ifndef JSON_NO_POOL
+	PoolItem *item = (PoolItem*) node;
 	
-	assert(utf8_validate_cz(s));
+	if (pool.stats.nodes_cached < POOL_MAX_NODES) {
+		if (!pool.registered)
+			pool_register();
+		item->next = pool.nodes;
+		pool.nodes = item;
+		pool.stats.nodes_cached++;
+		return;
+	}
+#endif
+	
+	free(node);
+}
 
-	if (c[0] <= 0x7F) {
-		/* 00..7F */
-		*out = c[0];
-		return 1;
-	} else if (c[0] <= 0xDF) {
-		/* C2..DF (unless input is invalid) */
-		*out = ((uchar_t)c[0] & 0x1F) << 6 |
-		       ((uchar_t)c[1] & 0x3F);
-		return 2;
-	} else if (c[0] <= 0xEF) {
-		/* E0..EF */
-		*out = ((uchar_t)c[0] &  0xF) << 12 |
-		       ((uchar_t)c[1] & 0x3F) << 6  |
-		       ((uchar_t)c[2] & 0x3F);
-		return 3;
+/* Copies a string that a heap node will own.  Release it with pool_string_free. */
+static char *pool_strndup(const char *str, size_t len)
+{
+	char *ret;
+	
+	if (len >= POOL_STRING_SIZE) {
+		ret = (char*) malloc(len + 1);
+	} else if (pool.strings != NULL) {
+		ret = (char*) pool.strings;
+		pool.strings = pool.strings->next;
+		pool.stats.strings_cached--;
+		pool.stats.string_hits++;
 	} else {
-		/* F0..F4 (unless input is invalid) */
-		*out = ((uchar_t)c[0] &  0x7) << 18 |
-		       ((uchar_t)c[1] & 0x3F) << 12 |
-		       ((uchar_t)c[2] & 0x3F) << 6  |
-		       ((uchar_t)c[3] & 0x3F);
-		return 4;
+		ret = (char*) malloc(POOL_STRING_SIZE);
+		pool.stats.string_misses++;
 	}
+	
+	if (ret == NULL)
+		out_of_memory();
+	memcpy(ret, str, len);
+	ret[len] = 0;
+	return ret;
 }
 
-/*
- * Write a single UTF-8 character to @s,
- * returning the length, in bytes, of the character written.
- *
- * @unicode must be U+0000..U+10FFFF, but not U+D800..U+DFFF.
- *
- * This function will write up to 4 bytes to @out.
- */
-static int utf8_write_char(uchar_t unicode, char *out)
+static void pool_string_free(char *str)
 {
-	unsigned char *o = (unsigned char*) out;
+#ifndef JSON_NO_POOL
+	PoolItem *item = (PoolItem*) str;
 	
-	assert(unicode <= 0x10FFFF && !(unicode >= 0xD800 && unicode <= 0xDFFF));
+	/*
+	 * A short string has POOL_STRING_SIZE bytes and a long one more, so this
+	 * does not read past either.
+	 */
+	if (str != NULL && memchr(str, 0, POOL_STRING_SIZE) != NULL &&
+	    pool.stats.strings_cached < POOL_MAX_STRINGS) {
+		if (!pool.registered)
+			pool_register();
+		item->next = pool.strings;
+		pool.strings = item;
+		pool.stats.strings_cached++;
+		return;
+	}
+#endif
+	
+	free(str);
+}
 
-	if (unicode <= 0x7F) {
-		/* U+0000..U+007F */
-		*o++ = unicode;
-		return 1;
-	} else if (unicode <= 0x7FF) {
-		/* U+0080..U+07FF */
-		*o++ = 0xC0 | unicode >> 6;
-		*o++ = 0x80 | (unicode & 0x3F);
-		return 2;
-	} else if (unicode <= 0xFFFF) {
-		/* U+0800..U+FFFF */
-		*o++ = 0xE0 | unicode >> 12;
-		*o++ = 0x80 | (unicode >> 6 & 0x3F);
-		*o++ = 0x80 | (unicode & 0x3F);
-		return 3;
-	} else {
-		/* U+10000..U+10FFFF */
-		*o++ = 0xF0 | unicode >> 18;
-		*o++ = 0x80 | (unicode >> 12 & 0x3F);
-		*o++ = 0x80 | (unicode >> 6 & 0x3F);
-		*o++ = 0x80 | (unicode & 0x3F);
-		return 4;
+static void pool_scratch_init(SB *sb)
+{
+	if (pool.scratch == NULL) {
+		sb_init(sb);
+		return;
 	}
+	
+	sb->start = sb->cur = pool.scratch;
+	sb->end = pool.scratch + pool.scratch_capacity;
+	sb->flush = NULL;
+	sb->ctx = NULL;
+	pool.scratch = NULL;
 }
 
-/*
- * Compute the Unicode codepoint of a UTF-16 surrogate pair.
- *
- * @uc should be 0xD800..0xDBFF, and @lc should be 0xDC00..0xDFFF.
- * If they aren't, this function returns false.
- */
-static bool from_surrogate_pair(uint16_t uc, uint16_t lc, uchar_t *unicode)
+static void pool_scratch_free(SB *sb)
 {
-	if (uc >= 0xD800 && uc <= 0xDBFF && lc >= 0xDC00 && lc <= 0xDFFF) {
-		*unicode = 0x10000 + ((((uchar_t)uc & 0x3FF) << 10) | (lc & 0x3FF));
-		return true;
-	} else {
-		return false;
+	size_t capacity = sb->end - sb->start;
+	
+	if (pool.scratch != NULL || capacity > POOL_MAX_SCRATCH) {
+		sb_free(sb);
+		return;
 	}
+	
+	if (!pool.registered)
+		pool_register();
+	pool.scratch = sb->start;
+	pool.scratch_capacity = capacity;
 }
 
-/*
- * Construct a UTF-16 surrogate pair given a Unicode codepoint.
- *
- * @unicode must be U+10000..U+10FFFF.
- */
-static void to_surrogate_pair(uchar_t unicode, uint16_t *uc, uint16_t *lc)
+void json_pool_stats(JsonPoolStats *out)
 {
-	uchar_t n;
+	*out = pool.stats;
+}
+
+void json_pool_trim(void)
+{
+	PoolItem *item, *next;
 	
-	assert(unicode >= 0x10000 && unicode <= 0x10FFFF);
+	for (item = pool.nodes; item != NULL; item = next) {
+		next = item->next;
+		free(item);
+	}
+	for (item = pool.strings; item != NULL; item = next) {
+		next = item->next;
+		free(item);
+	}
 	
-	n = unicode - 0x10000;
-	*uc = ((n >> 10) & 0x3FF) | 0xD800;
-	*lc = (n & 0x3FF) | 0xDC00;
+	free(pool.scratch);
+	
+	pool.nodes = pool.strings = NULL;
+	pool.stats.nodes_cached = pool.stats.strings_cached = 0;
+	pool.scratch = NULL;
 }
 
-#define is_space(c) ((c) == '\t' || (c) == '\n' || (c) == '\r' || (c) == ' ')
-#define is_digit(c) ((c) >= '0' && (c) <= '9')
+/* Sadly, strdup is not portable.  Only nodes own these, so they come from the pool. */
+static char *json_strdup(const char *str)
+{
+	return pool_strndup(str, strlen(str));
+}
 
-static bool parse_value     (const char **sp, JsonNode        **out);
-static bool parse_string    (const char **sp, char            **out);
-static bool parse_number    (const char **sp, double           *out);
-static bool parse_array     (const char **sp, JsonNode        **out);
-static bool parse_object    (const char **sp, JsonNode        **out);
-static bool parse_hex16     (const char **sp, uint16_t         *out);
+/*
+ * Node flags
+ *
+ * Nodes made by mknode own their key and string_ and are released one by
+ * one.  Nodes of an arena document share the lifetime of the document.
+ */
 
-static bool expect_literal  (const char **sp, const char *str);
-static void skip_space      (const char **sp);
+#define NODE_ARENA          0x01    /* Node lives in a JsonDocument arena. */
+#define NODE_DOCUMENT       0x02    /* Node is the root of its JsonDocument. */
+#define NODE_SHARED_KEY     0x04    /* key is not owned by the node. */
+#define NODE_SHARED_STRING  0x08    /* string_ is not owned by the node. */
+#define NODE_INTEGER        0x10    /* integer_ holds the exact value of number_. */
+#define NODE_INTERNED_KEY   0x20    /* key came from json_intern (with NODE_SHARED_KEY). */
 
-static void emit_value              (SB *out, const JsonNode *node);
-static void emit_value_indented     (SB *out, const JsonNode *node, const char *space, int indent_level);
-static void emit_string             (SB *out, const char *str);
-static void emit_number             (SB *out, double num);
+/* Arena documents */
+
+#define ARENA_MIN_BLOCK 4096
+
+typedef struct ArenaBlock ArenaBlock;
+
+struct ArenaBlock
+{
+	ArenaBlock *next;
+};
+
+typedef struct
+{
+	/* Must come first, so json_delete can get from the root to its document. */
+	JsonNode root;
+	
+	/* Free space in the current block. */
+	char *cur;
+	char *end;
+	
+	/* Blocks allocated after the one holding this struct. */
+	ArenaBlock *blocks;
+	size_t block_size;
+	
+	/* Lookup indexes built for nodes of the document. */
+	JsonIndex *indexes;
+	
+	/* Set once a heap node has been attached somewhere in the document. */
+	bool has_heap_nodes;
+} JsonDocument;
+
+static JsonDocument *document_new(size_t hint)
+{
+	size_t size = hint < ARENA_MIN_BLOCK ? ARENA_MIN_BLOCK : (hint + 7) & ~(size_t)7;
+	JsonDocument *doc = (JsonDocument*) malloc(sizeof(JsonDocument) + size);
+	if (doc == NULL)
+		out_of_memory();
+	doc->cur = (char*) (doc + 1);
+	doc->end = doc->cur + size;
+	doc->blocks = NULL;
+	doc->block_size = size;
+	doc->indexes = NULL;
+	doc->has_heap_nodes = false;
+	return doc;
+}
+
+static void *arena_alloc(JsonDocument *doc, size_t size)
+{
+	void *ret;
+	
+	size = (size + 7) & ~(size_t)7;
+	if ((size_t)(doc->end - doc->cur) < size) {
+		ArenaBlock *block;
+		
+		do {
+			doc->block_size *= 2;
+		} while (doc->block_size < size);
+		
+		block = (ArenaBlock*) malloc(sizeof(ArenaBlock) + doc->block_size);
+		if (block == NULL)
+			out_of_memory();
+		block->next = doc->blocks;
+		doc->blocks = block;
+		doc->cur = (char*) (block + 1);
+		doc->end = doc->cur + doc->block_size;
+	}
+	
+	ret = doc->cur;
+	doc->cur += size;
+	return ret;
+}
+
+static char *arena_strndup(JsonDocument *doc, const char *str, size_t len)
+{
+	char *ret = (char*) arena_alloc(doc, len + 1);
+	memcpy(ret, str, len);
+	ret[len] = 0;
+	return ret;
+}
+
+/*
+ * Returns the document @node belongs to, or NULL if it is
+ * not (or no longer) attached to an arena document.
+ */
+static JsonDocument *document_of(JsonNode *node)
+{
+	while (node->parent != NULL)
+		node = node->parent;
+	if (node->flags & NODE_DOCUMENT)
+		return (JsonDocument*) node;
+	return NULL;
+}
+
+/* Move the parsed root into the document header, so it can be found later. */
+static JsonNode *document_adopt_root(JsonDocument *doc, JsonNode *root)
+{
+	JsonNode *child;
+	
+	doc->root = *root;
+	doc->root.flags |= NODE_DOCUMENT;
+	if (root->tag == JSON_ARRAY || root->tag == JSON_OBJECT)
+		for (child = root->children.head; child != NULL; child = child->next)
+			child->parent = &doc->root;
+	
+	return &doc->root;
+}
+
+/* Release the heap nodes that were attached below @node. */
+static void delete_heap_nodes(JsonNode *node)
+{
+	JsonNode *child, *next;
+	
+	for (child = json_first_child(node); child != NULL; child = next) {
+		next = child->next;
+		if (child->flags & NODE_ARENA)
+			delete_heap_nodes(child);
+		else
+			json_delete(child);
+	}
+}
+
+/* Member and element indexes */
+
+/* Lookups walking past this many children build an index. */
+#define INDEX_MIN_CHILDREN 8
+
+struct JsonIndex
+{
+	/* Next index owned by the same arena document. */
+	JsonIndex *next;
+	
+	/* Set when the children changed in a way the index cannot follow. */
+	bool stale;
+	
+	/* JSON_OBJECT: maps each key to the first member that has it. */
+	struct hashmap_s members;
+	
+	/* JSON_OBJECT: how many members are not in the map, being preceded by one with the same key. */
+	int shadowed;
+	
+	/* JSON_ARRAY: the elements, in order, from elements[start]. */
+	JsonNode **elements;
+	int start;
+	int capacity;
+	
+	/* JSON_ARRAY: position of the element json_find_element returned last, which is likely to be moved next. */
+	int hint;
+};
+
+/*
+ * Attach an empty, stale index to @node.  Indexes of arena nodes are
+ * released with their document, so a node that has been detached from
+ * its document cannot get one and NULL is returned.
+ */
+static JsonIndex *index_new(JsonNode *node)
+{
+	JsonDocument *doc = NULL;
+	JsonIndex *index;
+	
+	if (node->flags & NODE_ARENA) {
+		doc = document_of(node);
+		if (doc == NULL)
+			return NULL;
+	}
+	
+	index = (JsonIndex*) calloc(1, sizeof(JsonIndex));
+	if (index == NULL)
+		out_of_memory();
+	index->stale = true;
+	if (doc != NULL) {
+		index->next = doc->indexes;
+		doc->indexes = index;
+	}
+	
+	node->children.index = index;
+	return index;
+}
+
+static void index_free(JsonIndex *index)
+{
+	if (index->members.data != NULL)
+		hashmap_destroy(&index->members);
+	free(index->elements);
+	free(index);
+}
+
+/*
+ * Make room for @count elements, leaving as much room in front of them as
+ * behind, so elements can be added and removed cheaply at either end.
+ */
+static void index_reserve_elements(JsonIndex *index, int length, int count)
+{
+	JsonNode **elements;
+	int capacity = index->capacity;
+	int start;
+	
+	if (capacity == 0)
+		capacity = 16;
+	while (capacity < count * 2)
+		capacity *= 2;
+	
+	elements = (JsonNode**) malloc(capacity * sizeof(JsonNode*));
+	if (elements == NULL)
+		out_of_memory();
+	start = (capacity - count) / 2;
+	if (length > 0)
+		memcpy(elements + start, index->elements + index->start, length * sizeof(JsonNode*));
+	
+	free(index->elements);
+	index->elements = elements;
+	index->start = start;
+	index->capacity = capacity;
+}
+
+/*
+ * Position of @child among the children of its parent, found by walking
+ * towards both ends at once, so children near either end are found at once.
+ */
+static int child_position(JsonNode *child)
+{
+	JsonNode *before = child->prev, *after = child->next;
+	int steps = 0;
+	
+	for (;;) {
+		if (before == NULL)
+			return steps;
+		if (after == NULL)
+			return child->parent->children.length - 1 - steps;
+		before = before->prev;
+		after = after->next;
+		steps++;
+	}
+}
+
+/* Position of @element, which is one of the @length elements of @index. */
+static int element_position(JsonIndex *index, int length, JsonNode *element)
+{
+	if (index->hint < length && index->elements[index->start + index->hint] == element)
+		return index->hint;
+	return child_position(element);
+}
+
+/* Put @child at @position of the @length - 1 elements, moving the shorter side. */
+static void index_insert_element(JsonIndex *index, int length, int position, JsonNode *child)
+{
+	JsonNode **elements;
+	
+	if (position < length / 2) {
+		if (index->start == 0)
+			index_reserve_elements(index, length - 1, length);
+		elements = index->elements + index->start;
+		memmove(elements - 1, elements, position * sizeof(JsonNode*));
+		index->start--;
+	} else {
+		if (index->start + length > index->capacity)
+			index_reserve_elements(index, length - 1, length);
+		elements = index->elements + index->start;
+		memmove(elements + position + 1, elements + position, (length - 1 - position) * sizeof(JsonNode*));
+	}
+	index->elements[index->start + position] = child;
+}
+
+/* Take the element at @position out of the @length elements, moving the shorter side. */
+static void index_remove_element(JsonIndex *index, int length, int position)
+{
+	JsonNode **elements = index->elements + index->start;
+	
+	if (position < length / 2) {
+		memmove(elements + 1, elements, position * sizeof(JsonNode*));
+		index->start++;
+	} else {
+		memmove(elements + position, elements + position + 1, (length - 1 - position) * sizeof(JsonNode*));
+	}
+}
+
+/* Index @member, replacing an existing member with the same key if @replace. */
+static void index_add_member(JsonIndex *index, JsonNode *member, bool replace)
+{
+	unsigned len = strlen(member->key);
+	
+	if (hashmap_get(&index->members, member->key, len) != NULL) {
+		index->shadowed++;
+		if (!replace)
+			return;
+	}
+	
+	if (hashmap_put(&index->members, member->key, len, member) != 0)
+		out_of_memory();
+}
+
+static void index_rebuild(JsonNode *node)
+{
+	JsonIndex *index = node->children.index;
+	JsonNode *child;
+	
+	if (node->tag == JSON_OBJECT) {
+		unsigned size = 16;
+		
+		while (size < (unsigned) node->children.length * 2)
+			size *= 2;
+		
+		if (index->members.data != NULL)
+			hashmap_destroy(&index->members);
+		if (hashmap_create(size, &index->members) != 0)
+			out_of_memory();
+		index->shadowed = 0;
+		
+		json_foreach(child, node)
+			index_add_member(index, child, false);
+	} else {
+		JsonNode **element;
+		
+		index_reserve_elements(index, 0, node->children.length);
+		element = index->elements + index->start;
+		json_foreach(child, node)
+			*element++ = child;
+	}
+	
+	index->stale = false;
+}
+
+/* Keep the index of @parent in step with @child being linked in. */
+static void index_link(JsonNode *parent, JsonNode *child)
+{
+	JsonIndex *index = parent->children.index;
+	
+	if (index == NULL || index->stale)
+		return;
+	
+	if (parent->tag == JSON_OBJECT) {
+		/* Members are only ever added at either end. */
+		index_add_member(index, child, child->prev == NULL);
+	} else {
+		/*
+		 * children.length already counts @child, so it is @child and not
+		 * its successor whose position the list gives; the hint still
+		 * refers to the index as it was.
+		 */
+		int length = parent->children.length;
+		int position;
+		
+		if (child->next == NULL)
+			position = length - 1;
+		else if (index->hint < length - 1 && index->elements[index->start + index->hint] == child->next)
+			position = index->hint;
+		else
+			position = child_position(child);
+		
+		index_insert_element(index, length, position, child);
+	}
+}
+
+/* Keep the index of @parent in step with @child being unlinked. */
+static void index_unlink(JsonNode *parent, JsonNode *child)
+{
+	JsonIndex *index = parent->children.index;
+	
+	if (index == NULL || index->stale)
+		return;
+	
+	if (parent->tag == JSON_OBJECT) {
+		unsigned len = strlen(child->key);
+		JsonNode *next;
+		
+		if (hashmap_get(&index->members, child->key, len) != child) {
+			index->shadowed--;
+			return;
+		}
+		
+		/* The next member with the same key, if any, takes over. */
+		if (index->shadowed > 0) {
+			for (next = child->next; next != NULL; next = next->next) {
+				if (strcmp(next->key, child->key) == 0) {
+					if (hashmap_put(&index->members, next->key, len, next) != 0)
+						out_of_memory();
+					index->shadowed--;
+					return;
+				}
+			}
+		}
+		hashmap_remove(&index->members, child->key, len);
+	} else {
+		/* children.length still counts @child. */
+		int length = parent->children.length;
+		
+		index_remove_element(index, length, element_position(index, length, child));
+	}
+}
+
+/* Keep the index of @parent in step with @child having taken the place of @old. */
+static void index_replace(JsonNode *parent, JsonNode *old, JsonNode *child)
+{
+	JsonIndex *index = parent->children.index;
+	
+	if (index == NULL || index->stale)
+		return;
+	
+	if (parent->tag == JSON_OBJECT) {
+		unsigned len = strlen(child->key);
+		
+		if (hashmap_get(&index->members, child->key, len) == old &&
+		    hashmap_put(&index->members, child->key, len, child) != 0)
+			out_of_memory();
+	} else {
+		index->elements[index->start + element_position(index, parent->children.length, old)] = child;
+	}
+}
+
+/* Whether the index of @node, unless it is stale, matches the children. */
+static bool index_matches(const JsonNode *node)
+{
+	JsonIndex *index = node->children.index;
+	struct hashmap_s seen;
+	JsonNode *child;
+	int i = 0, shadowed = 0;
+	bool ok = true;
+	
+	if (index == NULL || index->stale)
+		return true;
+	
+	if (node->tag == JSON_ARRAY) {
+		json_foreach(child, node)
+			if (index->elements[index->start + i++] != child)
+				return false;
+		return true;
+	}
+	
+	if (hashmap_create(16, &seen) != 0)
+		out_of_memory();
+	json_foreach(child, node) {
+		unsigned len = strlen(child->key);
+		JsonNode *first = (JsonNode*) hashmap_get(&index->members, child->key, len);
+		
+		if (hashmap_get(&seen, child->key, len) != NULL) {
+			shadowed++;
+			ok = ok && first != child;
+		} else {
+			ok = ok && first == child;
+			if (hashmap_put(&seen, child->key, len, child) != 0)
+				out_of_memory();
+		}
+	}
+	ok = ok && shadowed == index->shadowed && hashmap_num_entries(&index->members) == hashmap_num_entries(&seen);
+	hashmap_destroy(&seen);
+	return ok;
+}
+
+static void document_free(JsonDocument *doc)
+{
+	ArenaBlock *block, *next;
+	JsonIndex *index, *next_index;
+	
+	/* The indexes go next, so they need not follow the heap nodes out. */
+	for (index = doc->indexes; index != NULL; index = index->next)
+		index->stale = true;
+	if (doc->has_heap_nodes)
+		delete_heap_nodes(&doc->root);
+	
+	for (index = doc->indexes; index != NULL; index = next_index) {
+		next_index = index->next;
+		index_free(index);
+	}
+	
+	for (block = doc->blocks; block != NULL; block = next) {
+		next = block->next;
+		free(block);
+	}
+	free(doc);
+}
+
+/*
+ * Key interning
+ *
+ * The table maps each interned key to one copy that lives as long as the
+ * process.  Lookups do not lock: slots and the table pointer are published
+ * with release stores, and a table that has been outgrown is kept, not
+ * freed, so a reader can finish probing it.  Insertions take the mutex and
+ * probe again, since a lock-free miss may be stale.
+ */
+
+/* Decoders only intern keys this short, and only this many of them. */
+#define INTERN_MAX_DECODED_LENGTH 32
+#define INTERN_MAX_DECODED 4096
+
+typedef struct
+{
+	uint32_t hash;
+	uint32_t length;
+	char key[];
+} InternKey;
+
+typedef struct InternTable InternTable;
+
+struct InternTable
+{
+	size_t mask;
+	size_t count;
+	InternKey **slots;
+	
+	/* The table this one replaced, kept for readers still probing it. */
+	InternTable *outgrown;
+};
+
+static InternTable *intern_table;
+static pthread_mutex_t intern_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Multiplicative hashing a word at a time, which is plenty for short keys. */
+static uint32_t intern_hash(const char *str, size_t len)
+{
+	uint64_t hash = len * 0x9E3779B97F4A7C15ull;
+	uint64_t word;
+	
+	for (; len >= 8; str += 8, len -= 8) {
+		memcpy(&word, str, 8);
+		hash = (hash ^ word) * 0xFF51AFD7ED558CCDull;
+	}
+	if (len > 0) {
+		word = 0;
+		memcpy(&word, str, len);
+		hash = (hash ^ word) * 0xFF51AFD7ED558CCDull;
+	}
+	return (uint32_t) (hash ^ (hash >> 32));
+}
+
+static InternKey *intern_probe(const InternTable *table, const char *str, size_t len, uint32_t hash, size_t *slot)
+{
+	size_t i = hash & table->mask;
+	InternKey *entry;
+	
+	while ((entry = __atomic_load_n(&table->slots[i], __ATOMIC_ACQUIRE)) != NULL) {
+		if (entry->hash == hash && entry->length == len && memcmp(entry->key, str, len) == 0)
+			return entry;
+		i = (i + 1) & table->mask;
+	}
+	
+	if (slot != NULL)
+		*slot = i;
+	return NULL;
+}
+
+/* Replace the table with one twice the size.  Called with intern_lock held. */
+static InternTable *intern_grow(InternTable *old)
+{
+	InternTable *table = (InternTable*) malloc(sizeof(InternTable));
+	size_t size = old != NULL ? (old->mask + 1) * 2 : 256;
+	size_t i, slot;
+	
+	if (table == NULL)
+		out_of_memory();
+	table->slots = (InternKey**) calloc(size, sizeof(InternKey*));
+	if (table->slots == NULL)
+		out_of_memory();
+	table->mask = size - 1;
+	table->count = 0;
+	table->outgrown = old;
+	
+	if (old != NULL) {
+		for (i = 0; i <= old->mask; i++) {
+			InternKey *entry = old->slots[i];
+			
+			if (entry != NULL) {
+				intern_probe(table, entry->key, entry->length, entry->hash, &slot);
+				table->slots[slot] = entry;
+				table->count++;
+			}
+		}
+	}
+	
+	__atomic_store_n(&intern_table, table, __ATOMIC_RELEASE);
+	return table;
+}
+
+/*
+ * Return the interned copy of @str, adding it unless the table already
+ * holds @limit keys.
+ */
+static const char *intern(const char *str, size_t len, size_t limit)
+{
+	uint32_t hash = intern_hash(str, len);
+	InternTable *table = __atomic_load_n(&intern_table, __ATOMIC_ACQUIRE);
+	InternKey *entry;
+	size_t slot;
+	
+	if (table != NULL && (entry = intern_probe(table, str, len, hash, NULL)) != NULL)
+		return entry->key;
+	
+	pthread_mutex_lock(&intern_lock);
+	
+	table = intern_table;
+	if (table != NULL && (entry = intern_probe(table, str, len, hash, &slot)) != NULL)
+		goto done;
+	
+	if (table != NULL && table->count >= limit) {
+		pthread_mutex_unlock(&intern_lock);
+		return NULL;
+	}
+	
+	/* Keep the load factor under a half. */
+	if (table == NULL || (table->count + 1) * 2 > table->mask + 1) {
+		table = intern_grow(table);
+		intern_probe(table, str, len, hash, &slot);
+	}
+	
+	entry = (InternKey*) malloc(sizeof(InternKey) + len + 1);
+	if (entry == NULL)
+		out_of_memory();
+	entry->hash = hash;
+	entry->length = len;
+	memcpy(entry->key, str, len);
+	entry->key[len] = 0;
+	
+	table->count++;
+	__atomic_store_n(&table->slots[slot], entry, __ATOMIC_RELEASE);
+
+done:
+	pthread_mutex_unlock(&intern_lock);
+	return entry->key;
+}
+
+const char *json_intern(const char *key)
+{
+	return intern(key, strlen(key), SIZE_MAX);
+}
+
+/*
+ * Parser state shared by the parse_* functions.  It is only used when they
+ * are asked to build nodes, so json_validate passes NULL.
+ */
+typedef struct
+{
+	/* Document receiving the parsed nodes, or NULL to use the heap. */
+	JsonDocument *doc;
+	
+	/* Strings are unescaped here, then copied out at their final size. */
+	SB scratch;
+	
+	/* Unescape strings in the input buffer itself instead (json_decode_insitu). */
+	bool insitu;
+	
+	/* Share object keys through the intern table where possible. */
+	bool intern_keys;
+} Decoder;
+
+static char *decoder_strndup(Decoder *dec, const char *str, size_t len)
+{
+	if (dec->doc != NULL)
+		return arena_strndup(dec->doc, str, len);
+	
+	return pool_strndup(str, len);
+}
+
+/*
+ * Unicode helper functions
+ *
+ * These are taken from the ccan/charset module and customized a bit.
+ * Putting them here means the compiler can (choose to) inline them,
+ * and it keeps ccan/json from having a dependency.
+ */
+
+/*
+ * Type for Unicode codepoints.
+ * We need our own because wchar_t might be 16 bits.
+ */
+typedef uint32_t uchar_t;
+
+/*
+ * Validate a single UTF-8 character starting at @s.
+ * The string must be null-terminated.
+ *
+ * If it's valid, return its length (1 thru 4).
+ * If it's invalid or clipped, return 0.
+ *
+ * This function implements the syntax given in RFC3629, which is
+ * the same as that given in The Unicode Standard, Version 6.0.
+ *
+ * It has the following properties:
+ *
+ *  * All codepoints U+0000..U+10FFFF may be encoded,
+ *    except for U+D800..U+DFFF, which are reserved
+ *    for UTF-16 surrogate pair encoding.
+ *  * UTF-8 byte sequences longer than 4 bytes are not permitted,
+ *    as they exceed the range of Unicode.
+ *  * The sixty-six Unicode "non-characters" are permitted
+ *    (namely, U+FDD0..U+FDEF, U+xxFFFE, and U+xxFFFF).
+ */
+static int utf8_validate_cz(const char *s)
+{
+	unsigned char c = *s++;
+	
+	if (c <= 0x7F) {        /* 00..7F */
+		return 1;
+	} else if (c <= 0xC1) { /* 80..C1 */
+		/* Disallow overlong 2-byte sequence. */
+		return 0;
+	} else if (c <= 0xDF) { /* C2..DF */
+		/* Make sure subsequent byte is in the range 0x80..0xBF. */
+		if (((unsigned char)*s++ & 0xC0) != 0x80)
+			return 0;
+		
+		return 2;
+	} else if (c <= 0xEF) { /* E0..EF */
+		/* Disallow overlong 3-byte sequence. */
+		if (c == 0xE0 && (unsigned char)*s < 0xA0)
+			return 0;
+		
+		/* Disallow U+D800..U+DFFF. */
+		if (c == 0xED && (unsigned char)*s > 0x9F)
+			return 0;
+		
+		/* Make sure subsequent bytes are in the range 0x80..0xBF. */
+		if (((unsigned char)*s++ & 0xC0) != 0x80)
+			return 0;
+		if (((unsigned char)*s++ & 0xC0) != 0x80)
+			return 0;
+		
+		return 3;
+	} else if (c <= 0xF4) { /* F0..F4 */
+		/* Disallow overlong 4-byte sequence. */
+		if (c == 0xF0 && (unsigned char)*s < 0x90)
+			return 0;
+		
+		/* Disallow codepoints beyond U+10FFFF. */
+		if (c == 0xF4 && (unsigned char)*s > 0x8F)
+			return 0;
+		
+		/* Make sure subsequent bytes are in the range 0x80..0xBF. */
+		if (((unsigned char)*s++ & 0xC0) != 0x80)
+			return 0;
+		if (((unsigned char)*s++ & 0xC0) != 0x80)
+			return 0;
+		if (((unsigned char)*s++ & 0xC0) != 0x80)
+			return 0;
+		
+		return 4;
+	} else {                /* F5..FF */
+		return 0;
+	}
+}
+
+/*
+ * Read a single UTF-8 character starting at @s,
+ * returning the length, in bytes, of the character read.
+ *
+ * This function assumes input is valid UTF-8,
+ * and that there are enough characters in front of @s.
+ */
+static int utf8_read_char(const char *s, uchar_t *out)
+{
+	const unsigned char *c = (const unsigned char*) s;
+	
+	assert(utf8_validate_cz(s));
+
+	if (c[0] <= 0x7F) {
+		/* 00..7F */
+		*out = c[0];
+		return 1;
+	} else if (c[0] <= 0xDF) {
+		/* C2..DF (unless input is invalid) */
+		*out = ((uchar_t)c[0] & 0x1F) << 6 |
+		       ((uchar_t)c[1] & 0x3F);
+		return 2;
+	} else if (c[0] <= 0xEF) {
+		/* E0..EF */
+		*out = ((uchar_t)c[0] &  0xF) << 12 |
+		       ((uchar_t)c[1] & 0x3F) << 6  |
+		       ((uchar_t)c[2] & 0x3F);
+		return 3;
+	} else {
+		/* F0..F4 (unless input is invalid) */
+		*out = ((uchar_t)c[0] &  0x7) << 18 |
+		       ((uchar_t)c[1] & 0x3F) << 12 |
+		       ((uchar_t)c[2] & 0x3F) << 6  |
+		       ((uchar_t)c[3] & 0x3F);
+		return 4;
+	}
+}
+
+/*
+ * Write a single UTF-8 character to @s,
+ * returning the length, in bytes, of the character written.
+ *
+ * @unicode must be U+0000..U+10FFFF, but not U+D800..U+DFFF.
+ *
+ * This function will write up to 4 bytes to @out.
+ */
+static int utf8_write_char(uchar_t unicode, char *out)
+{
+	unsigned char *o = (unsigned char*) out;
+	
+	assert(unicode <= 0x10FFFF && !(unicode >= 0xD800 && unicode <= 0xDFFF));
+
+	if (unicode <= 0x7F) {
+		/* U+0000..U+007F */
+		*o++ = unicode;
+		return 1;
+	} else if (unicode <= 0x7FF) {
+		/* U+0080..U+07FF */
+		*o++ = 0xC0 | unicode >> 6;
+		*o++ = 0x80 | (unicode & 0x3F);
+		return 2;
+	} else if (unicode <= 0xFFFF) {
+		/* U+0800..U+FFFF */
+		*o++ = 0xE0 | unicode >> 12;
+		*o++ = 0x80 | (unicode >> 6 & 0x3F);
+		*o++ = 0x80 | (unicode & 0x3F);
+		return 3;
+	} else {
+		/* U+10000..U+10FFFF */
+		*o++ = 0xF0 | unicode >> 18;
+		*o++ = 0x80 | (unicode >> 12 & 0x3F);
+		*o++ = 0x80 | (unicode >> 6 & 0x3F);
+		*o++ = 0x80 | (unicode & 0x3F);
+		return 4;
+	}
+}
+
+/*
+ * Compute the Unicode codepoint of a UTF-16 surrogate pair.
+ *
+ * @uc should be 0xD800..0xDBFF, and @lc should be 0xDC00..0xDFFF.
+ * If they aren't, this function returns false.
+ */
+static bool from_surrogate_pair(uint16_t uc, uint16_t lc, uchar_t *unicode)
+{
+	if (uc >= 0xD800 && uc <= 0xDBFF && lc >= 0xDC00 && lc <= 0xDFFF) {
+		*unicode = 0x10000 + ((((uchar_t)uc & 0x3FF) << 10) | (lc & 0x3FF));
+		return true;
+	} else {
+		return false;
+	}
+}
+
+/*
+ * Construct a UTF-16 surrogate pair given a Unicode codepoint.
+ *
+ * @unicode must be U+10000..U+10FFFF.
+ */
+static void to_surrogate_pair(uchar_t unicode, uint16_t *uc, uint16_t *lc)
+{
+	uchar_t n;
+	
+	assert(unicode >= 0x10000 && unicode <= 0x10FFFF);
+	
+	n = unicode - 0x10000;
+	*uc = ((n >> 10) & 0x3FF) | 0xD800;
+	*lc = (n & 0x3FF) | 0xDC00;
+}
+
+/*
+ * Plain string runs
+ *
+ * Most strings are long runs of printable ASCII that need neither escaping
+ * nor validation.  scan_plain returns a pointer to the first byte at or after
+ * @s that ends such a run: a quote, a backslash, a control character (which
+ * includes the terminating NUL) or the first byte of a multi-byte UTF-8
+ * sequence.  The caller handles that byte and carries on scanning after it.
+ *
+ * The fast versions read whole aligned words or vectors.  These may extend
+ * past the terminating NUL, but never into the next page, so they are safe
+ * even though they are out of bounds as far as the sanitizers know.
+ *
+ * Define JSON_NO_SIMD to use the portable word-at-a-time version everywhere.
+ */
+
+#define is_plain(c) ((unsigned char)(c) >= 0x20 && (unsigned char)(c) < 0x80 && (c) != '"' && (c) != '\\')
+
+#if !JSON_SIMD_X86
+
+#define WORD_ONES  0x0101010101010101ULL
+#define WORD_HIGHS 0x8080808080808080ULL
+
+NO_SANITIZE_ADDRESS
+static const char *scan_plain_word(const char *s)
+{
+	while (((uintptr_t) s & 7) != 0) {
+		if (!is_plain(*s))
+			return s;
+		s++;
+	}
+	
+	for (;;) {
+		uint64_t w, quote, backslash;
+		
+		memcpy(&w, s, 8);
+		quote = w ^ (WORD_ONES * '"');
+		backslash = w ^ (WORD_ONES * '\\');
+		
+		/*
+		 * A high bit is set in a byte that is zero after the xors, below 0x20
+		 * or 0x80 and up.  Borrows can only add false hits above a real one,
+		 * so the byte loop below finds the exact position.
+		 */
+		if ((((quote - WORD_ONES) & ~quote) |
+			 ((backslash - WORD_ONES) & ~backslash) |
+			 (w - WORD_ONES * 0x20) | w) & WORD_HIGHS)
+			break;
+		s += 8;
+	}
+	
+	while (is_plain(*s))
+		s++;
+	return s;
+}
+
+#else
+
+/* Bit i is set if byte i of the 16 at @p is not plain. */
+NO_SANITIZE_ADDRESS
+static unsigned special_mask_sse2(const char *p)
+{
+	__m128i v = _mm_load_si128((const __m128i*) p);
+	
+	/* Signed compare: bytes from 0x80 up are negative, so also below ' '. */
+	__m128i special = _mm_or_si128(
+		_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('"')),
+		             _mm_cmpeq_epi8(v, _mm_set1_epi8('\\'))),
+		_mm_cmplt_epi8(v, _mm_set1_epi8(' ')));
+	
+	return (unsigned) _mm_movemask_epi8(special);
+}
+
+static const char *scan_plain_sse2(const char *s)
+{
+	unsigned offset = (uintptr_t) s & 15;
+	const char *block = s - offset;
+	unsigned mask = special_mask_sse2(block) & (0xFFFFu << offset);
+	
+	while (mask == 0) {
+		block += 16;
+		mask = special_mask_sse2(block);
+	}
+	return block + __builtin_ctz(mask);
+}
+
+/* Bit i is set if byte i of the 32 at @p is not plain. */
+__attribute__((target("avx2"))) NO_SANITIZE_ADDRESS
+static uint32_t special_mask_avx2(const char *p)
+{
+	__m256i v = _mm256_load_si256((const __m256i*) p);
+	__m256i special = _mm256_or_si256(
+		_mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('"')),
+		                _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\\'))),
+		_mm256_cmpgt_epi8(_mm256_set1_epi8(' '), v));
+	
+	return (uint32_t) _mm256_movemask_epi8(special);
+}
+
+__attribute__((target("avx2")))
+static const char *scan_plain_avx2(const char *s)
+{
+	unsigned offset = (uintptr_t) s & 31;
+	const char *block = s - offset;
+	uint32_t mask = special_mask_avx2(block) & (0xFFFFFFFFu << offset);
+	
+	while (mask == 0) {
+		block += 32;
+		mask = special_mask_avx2(block);
+	}
+	return block + __builtin_ctz(mask);
+}
+
+#endif
+
+static const char *scan_plain_init(const char *s);
+
+/* Picks the best implementation for this CPU on first use. */
+static const char *(*scan_plain)(const char *s) = scan_plain_init;
+
+static const char *scan_plain_init(const char *s)
+{
+#if JSON_SIMD_X86
+	if (__builtin_cpu_supports("avx2"))
+		scan_plain = scan_plain_avx2;
+	else
+		scan_plain = scan_plain_sse2;
+#else
+	scan_plain = scan_plain_word;
+#endif
+	return scan_plain(s);
+}
+
+/* Validate a null-terminated UTF-8 string. */
+static bool utf8_validate(const char *s)
+{
+	int len;
+	
+	for (s = scan_plain(s); *s != 0; s = scan_plain(s + len)) {
+		len = utf8_validate_cz(s);
+		if (len == 0)
+			return false;
+	}
+	
+	return true;
+}
+
+#define is_space(c) ((c) == '\t' || (c) == '\n' || (c) == '\r' || (c) == ' ')
+#define is_digit(c) ((c) >= '0' && (c) <= '9')
+
+/* A number read by parse_number. */
+typedef struct
+{
+	double value;
+	
+	/* The exact value, if the number is an integer that fits. */
+	int64_t integer;
+	bool is_integer;
+} Number;
+
+static bool parse_value     (Decoder *dec, const char **sp, JsonNode **out);
+static bool parse_string    (Decoder *dec, const char **sp, char     **out, bool *interned);
+static bool parse_number    (const char **sp, Number *out);
+static bool parse_array     (Decoder *dec, const char **sp, JsonNode **out);
+static bool parse_object    (Decoder *dec, const char **sp, JsonNode **out);
+static bool parse_hex16     (const char **sp, uint16_t         *out);
+
+static bool expect_literal  (const char **sp, const char *str);
+static void skip_space      (const char **sp);
+
+static void emit_value              (SB *out, const JsonNode *node);
+static void emit_value_indented     (SB *out, const JsonNode *node, const char *space, int indent_level);
+static void emit_string             (SB *out, const char *str);
+static void emit_number             (SB *out, const JsonNode *node);
 static void emit_array              (SB *out, const JsonNode *array);
 static void emit_array_indented     (SB *out, const JsonNode *array, const char *space, int indent_level);
 static void emit_object             (SB *out, const JsonNode *object);
 static void emit_object_indented    (SB *out, const JsonNode *object, const char *space, int indent_level);
 
-static int write_hex16(char *out, uint16_t val);
+static int write_hex16(char *out, uint16_t val);
+
+static JsonNode *mknode(JsonTag tag);
+static JsonNode *decoder_mknode(Decoder *dec, JsonTag tag);
+static void append_node(JsonNode *parent, JsonNode *child);
+static void prepend_node(JsonNode *parent, JsonNode *child);
+static void append_member(JsonNode *object, char *key, JsonNode *value);
+
+/* Assertion-friendly validity checks */
+static bool tag_is_valid(unsigned int tag);
+
+static JsonNode *decode(Decoder *dec, const char *json)
+{
+	const char *s = json;
+	JsonNode *ret;
+	
+	skip_space(&s);
+	if (!parse_value(dec, &s, &ret))
+		return NULL;
+	
+	skip_space(&s);
+	if (*s != 0) {
+		json_delete(ret);
+		return NULL;
+	}
+	
+	return ret;
+}
+
+JsonNode *json_decode(const char *json)
+{
+	Decoder dec;
+	JsonNode *ret;
+	
+	dec.doc = NULL;
+	pool_scratch_init(&dec.scratch);
+	dec.insitu = false;
+	dec.intern_keys = true;
+	
+	ret = decode(&dec, json);
+	pool_scratch_free(&dec.scratch);
+	
+	return ret;
+}
+
+JsonNode *json_decode_arena(const char *json)
+{
+	Decoder dec;
+	JsonNode *ret;
+	
+	dec.doc = document_new(strlen(json));
+	sb_init(&dec.scratch);
+	dec.insitu = false;
+	dec.intern_keys = false;
+	
+	ret = decode(&dec, json);
+	sb_free(&dec.scratch);
+	
+	if (ret == NULL) {
+		document_free(dec.doc);
+		return NULL;
+	}
+	
+	return document_adopt_root(dec.doc, ret);
+}
+
+JsonNode *json_decode_insitu(char *json)
+{
+	Decoder dec;
+	JsonNode *ret;
+	
+	dec.doc = document_new(strlen(json));
+	dec.insitu = true;
+	dec.intern_keys = false;
+	
+	ret = decode(&dec, json);
+	if (ret == NULL) {
+		document_free(dec.doc);
+		return NULL;
+	}
+	
+	return document_adopt_root(dec.doc, ret);
+}
+
+char *json_encode(const JsonNode *node)
+{
+	return json_stringify(node, NULL);
+}
+
+char *json_encode_string(const char *str)
+{
+	SB sb;
+	sb_init_capacity(&sb, strlen(str) + 2);
+	
+	emit_string(&sb, str);
+	
+	return sb_finish(&sb);
+}
+
+char *json_stringify(const JsonNode *node, const char *space)
+{
+	SB sb;
+	sb_init(&sb);
+	
+	if (space != NULL)
+		emit_value_indented(&sb, node, space, 0);
+	else
+		emit_value(&sb, node);
+	
+	return sb_finish(&sb);
+}
+
+/*
+ * json_encode_into writes straight into the caller's buffer while it can,
+ * then goes on in a chunk on the stack, copying what still fits and
+ * counting the rest.
+ */
+typedef struct
+{
+	/* Where the next output byte goes, and how much room is left for it. */
+	char *buf;
+	size_t avail;
+	
+	/* Output length so far, including what did not fit. */
+	size_t length;
+	
+	char chunk[256];
+} EncodeInto;
+
+static void encode_into_flush(SB *sb)
+{
+	EncodeInto *into = (EncodeInto*) sb->ctx;
+	size_t n = sb->cur - sb->start;
+	
+	if (sb->start == into->buf) {
+		/* Already in place. */
+		into->buf += n;
+		into->avail -= n;
+	} else {
+		size_t copy = n < into->avail ? n : into->avail;
+		if (copy > 0) {
+			memcpy(into->buf, sb->start, copy);
+			into->buf += copy;
+			into->avail -= copy;
+		}
+	}
+	into->length += n;
+	
+	sb->start = sb->cur = into->chunk;
+	sb->end = into->chunk + sizeof(into->chunk);
+}
+
+size_t json_encode_into(const JsonNode *node, char *buf, size_t size)
+{
+	EncodeInto into;
+	SB sb;
+	
+	into.buf = buf;
+	into.avail = size > 0 ? size - 1 : 0;
+	into.length = 0;
+	
+	sb.flush = encode_into_flush;
+	sb.ctx = &into;
+	if (into.avail >= SB_MIN_FLUSH) {
+		sb.start = sb.cur = buf;
+		sb.end = buf + into.avail;
+	} else {
+		sb.start = sb.cur = into.chunk;
+		sb.end = into.chunk + sizeof(into.chunk);
+	}
+	
+	emit_value(&sb, node);
+	encode_into_flush(&sb);
+	
+	if (size > 0)
+		*into.buf = 0;
+	return into.length;
+}
+
+size_t json_encoded_length(const JsonNode *node)
+{
+	return json_encode_into(node, NULL, 0);
+}
+
+/* json_write encodes into a chunk on the stack and hands each full one to the writer. */
+typedef struct
+{
+	JsonWriteFn write;
+	void *ctx;
+	bool failed;
+	
+	char chunk[4096];
+} Writer;
+
+static void writer_flush(SB *sb)
+{
+	Writer *w = (Writer*) sb->ctx;
+	size_t n = sb->cur - sb->start;
+	
+	/* After a failed write the rest of the output is dropped. */
+	if (n > 0 && !w->failed)
+		w->failed = !w->write(sb->start, n, w->ctx);
+	sb->cur = sb->start;
+}
+
+bool json_write(const JsonNode *node, JsonWriteFn write, void *ctx, const char *space)
+{
+	Writer w;
+	SB sb;
+	
+	w.write = write;
+	w.ctx = ctx;
+	w.failed = false;
+	
+	sb.start = sb.cur = w.chunk;
+	sb.end = w.chunk + sizeof(w.chunk);
+	sb.flush = writer_flush;
+	sb.ctx = &w;
+	
+	if (space != NULL)
+		emit_value_indented(&sb, node, space, 0);
+	else
+		emit_value(&sb, node);
+	writer_flush(&sb);
+	
+	return !w.failed;
+}
+
+bool json_file_writer(const char *data, size_t length, void *file)
+{
+	return fwrite(data, 1, length, (FILE*) file) == length;
+}
+
+void json_delete(JsonNode *node)
+{
+	if (node != NULL) {
+		JsonDocument *doc = node->flags & NODE_ARENA ? document_of(node) : NULL;
+		
+		json_remove_from_parent(node);
+		
+		if (node->flags & NODE_ARENA) {
+			/*
+			 * The arena is released along with the document's root, but
+			 * heap nodes below this one would no longer be found then.
+			 * A node that was already detached has lost its document, so
+			 * it is searched regardless.
+			 */
+			if (node->flags & NODE_DOCUMENT)
+				document_free((JsonDocument*) node);
+			else if (doc == NULL || doc->has_heap_nodes)
+				delete_heap_nodes(node);
+			return;
+		}
+		
+		switch (node->tag) {
+			case JSON_STRING:
+				if (!(node->flags & NODE_SHARED_STRING))
+					pool_string_free(node->string_);
+				break;
+			case JSON_ARRAY:
+			case JSON_OBJECT:
+			{
+				JsonNode *child, *next;
+				
+				/* Drop the index first, so the children need not be taken out of it. */
+				if (node->children.index != NULL) {
+					index_free(node->children.index);
+					node->children.index = NULL;
+				}
+				for (child = node->children.head; child != NULL; child = next) {
+					next = child->next;
+					json_delete(child);
+				}
+				break;
+			}
+			default:;
+		}
+		
+		pool_node_free(node);
+	}
+}
+
+bool json_validate(const char *json)
+{
+	const char *s = json;
+	
+	skip_space(&s);
+	if (!parse_value(NULL, &s, NULL))
+		return false;
+	
+	skip_space(&s);
+	if (*s != 0)
+		return false;
+	
+	return true;
+}
+
+/*** Streaming parser ***/
+
+/* What may come next in the input, ignoring whitespace. */
+typedef enum {
+	EXPECT_VALUE,           /* at the start, or after ':' or an array's ',' */
+	EXPECT_VALUE_OR_END,    /* after '[' */
+	EXPECT_KEY,             /* after an object's ',' */
+	EXPECT_KEY_OR_END,      /* after '{' */
+	EXPECT_COLON,           /* after a key */
+	EXPECT_COMMA_OR_END,    /* after a value inside a container */
+	EXPECT_NOTHING,         /* after the top-level value */
+} ParserExpect;
+
+/* The token the parser is in the middle of when a chunk runs out. */
+typedef enum {
+	LEX_BETWEEN,            /* none */
+	LEX_STRING,             /* a string */
+	LEX_ESCAPE,             /* a string, right after a backslash */
+	LEX_BARE,               /* a number, or true, false or null */
+} ParserLex;
+
+struct JsonParser
+{
+	JsonCallbacks callbacks;
+	void *ctx;
+	
+	ParserLex lex;
+	ParserExpect expect;
+	bool failed;
+	
+	/* The current token as read so far, quotes and escapes included. */
+	SB token;
+	
+	/* '{' or '[' for each open container, innermost last. */
+	char *stack;
+	size_t depth;
+	size_t stack_size;
+	
+	/*
+	 * Tree mode only: the value built so far, the innermost container
+	 * that is still open, and the key of the member being read.
+	 */
+	JsonNode *root;
+	JsonNode *container;
+	char *key;
+};
+
+/* Characters that may appear in a number or a literal. */
+#define is_bare(c) (is_digit(c) || ((c) >= 'a' && (c) <= 'z') || (c) == '-' || (c) == '+' || (c) == '.' || (c) == 'E')
+
+/* Calls an optional callback.  Missing callbacks always succeed. */
+#define parser_emit(p, event, args) \
+	((p)->callbacks.event == NULL || (p)->callbacks.event args)
+
+static bool build_add(JsonParser *p, JsonNode *node)
+{
+	if (p->container == NULL) {
+		p->root = node;
+	} else if (p->container->tag == JSON_OBJECT) {
+		append_member(p->container, p->key, node);
+		p->key = NULL;
+	} else {
+		append_node(p->container, node);
+	}
+	return true;
+}
+
+static bool build_open(JsonParser *p, JsonNode *node)
+{
+	build_add(p, node);
+	p->container = node;
+	return true;
+}
+
+static bool build_null(void *ctx)
+{
+	return build_add((JsonParser*) ctx, json_mknull());
+}
+
+static bool build_bool(void *ctx, bool b)
+{
+	return build_add((JsonParser*) ctx, json_mkbool(b));
+}
+
+static bool build_number(void *ctx, double n)
+{
+	return build_add((JsonParser*) ctx, json_mknumber(n));
+}
+
+/*
+ * The number callback only carries a double, so tree mode calls this
+ * instead to keep exact integers the way json_decode does.
+ */
+static bool build_exact_number(JsonParser *p, const Number *num)
+{
+	JsonNode *node = json_mknumber(num->value);
+	
+	if (num->is_integer) {
+		node->integer_ = num->integer;
+		node->flags |= NODE_INTEGER;
+	}
+	return build_add(p, node);
+}
+
+static bool build_string(void *ctx, const char *str)
+{
+	return build_add((JsonParser*) ctx, json_mkstring(str));
+}
+
+static bool build_key(void *ctx, const char *key)
+{
+	((JsonParser*) ctx)->key = json_strdup(key);
+	return true;
+}
+
+static bool build_start_object(void *ctx)
+{
+	return build_open((JsonParser*) ctx, json_mkobject());
+}
+
+static bool build_start_array(void *ctx)
+{
+	return build_open((JsonParser*) ctx, json_mkarray());
+}
+
+static bool build_end(void *ctx)
+{
+	JsonParser *p = (JsonParser*) ctx;
+	p->container = p->container->parent;
+	return true;
+}
+
+/* Used when json_parser_new is not given any callbacks. */
+static const JsonCallbacks build_callbacks = {
+	build_null,
+	build_bool,
+	build_number,
+	build_string,
+	build_key,
+	build_start_object,
+	build_end,
+	build_start_array,
+	build_end,
+};
+
+static bool parser_expects_value(const JsonParser *p)
+{
+	return p->expect == EXPECT_VALUE || p->expect == EXPECT_VALUE_OR_END;
+}
+
+static bool parser_expects_key(const JsonParser *p)
+{
+	return p->expect == EXPECT_KEY || p->expect == EXPECT_KEY_OR_END;
+}
+
+/* A value has been read completely. */
+static void parser_value_end(JsonParser *p)
+{
+	p->expect = p->depth == 0 ? EXPECT_NOTHING : EXPECT_COMMA_OR_END;
+}
+
+/* Start a token with character @c. */
+static void parser_token_start(JsonParser *p, ParserLex lex, char c)
+{
+	p->lex = lex;
+	p->token.cur = p->token.start;
+	sb_putc(&p->token, c);
+}
+
+/* The closing quote of a string or key has been read. */
+static bool parser_string(JsonParser *p)
+{
+	Decoder dec;
+	const char *s = p->token.start;
+	char *str;
+	
+	/* The token is ours, so it can be unescaped in place. */
+	dec.doc = NULL;
+	dec.insitu = true;
+	*p->token.cur = 0;
+	if (!parse_string(&dec, &s, &str, NULL) || s != p->token.cur)
+		return false;
+	
+	if (parser_expects_key(p)) {
+		p->expect = EXPECT_COLON;
+		return parser_emit(p, key, (p->ctx, str));
+	}
+	
+	parser_value_end(p);
+	return parser_emit(p, string, (p->ctx, str));
+}
+
+/* A number or literal has been followed by something else. */
+static bool parser_bare(JsonParser *p)
+{
+	const char *s = p->token.start;
+	const char *end = p->token.cur;
+	Number num;
+	
+	*p->token.cur = 0;
+	parser_value_end(p);
+	
+	switch (*s) {
+		case 'n':
+			return expect_literal(&s, "null") && s == end &&
+				parser_emit(p, null_value, (p->ctx));
+		case 'f':
+			return expect_literal(&s, "false") && s == end &&
+				parser_emit(p, bool_value, (p->ctx, false));
+		case 't':
+			return expect_literal(&s, "true") && s == end &&
+				parser_emit(p, bool_value, (p->ctx, true));
+		default:
+			if (!parse_number(&s, &num) || s != end)
+				return false;
+			if (p->callbacks.number == build_number)
+				return build_exact_number(p, &num);
+			return parser_emit(p, number, (p->ctx, num.value));
+	}
+}
+
+static bool parser_open(JsonParser *p, char c)
+{
+	if (p->depth == p->stack_size) {
+		p->stack_size *= 2;
+		p->stack = (char*) realloc(p->stack, p->stack_size);
+		if (p->stack == NULL)
+			out_of_memory();
+	}
+	p->stack[p->depth++] = c;
+	
+	if (c == '{') {
+		p->expect = EXPECT_KEY_OR_END;
+		return parser_emit(p, start_object, (p->ctx));
+	}
+	
+	p->expect = EXPECT_VALUE_OR_END;
+	return parser_emit(p, start_array, (p->ctx));
+}
+
+static bool parser_close(JsonParser *p, char c)
+{
+	bool object = c == '}';
+	
+	if (p->depth == 0 || p->stack[p->depth - 1] != (object ? '{' : '['))
+		return false;
+	if (p->expect != EXPECT_COMMA_OR_END &&
+	    p->expect != (object ? EXPECT_KEY_OR_END : EXPECT_VALUE_OR_END))
+		return false;
+	
+	p->depth--;
+	parser_value_end(p);
+	
+	if (object)
+		return parser_emit(p, end_object, (p->ctx));
+	return parser_emit(p, end_array, (p->ctx));
+}
+
+/*
+ * Each lex_* function consumes input from @s for the parser's current
+ * lexer state, stopping at @end or when the state changes.  They return
+ * where they stopped, or NULL if the input is not valid JSON.
+ */
+
+static const char *lex_between(JsonParser *p, const char *s, const char *end)
+{
+	char c;
+	
+	while (is_space(*s))
+		if (++s == end)
+			return s;
+	
+	c = *s++;
+	switch (c) {
+		case '"':
+			if (!parser_expects_key(p) && !parser_expects_value(p))
+				return NULL;
+			parser_token_start(p, LEX_STRING, c);
+			return s;
+		case '{':
+		case '[':
+			if (!parser_expects_value(p))
+				return NULL;
+			return parser_open(p, c) ? s : NULL;
+		case '}':
+		case ']':
+			return parser_close(p, c) ? s : NULL;
+		case ':':
+			if (p->expect != EXPECT_COLON)
+				return NULL;
+			p->expect = EXPECT_VALUE;
+			return s;
+		case ',':
+			if (p->expect != EXPECT_COMMA_OR_END)
+				return NULL;
+			p->expect = p->stack[p->depth - 1] == '{' ? EXPECT_KEY : EXPECT_VALUE;
+			return s;
+		default:
+			if (!is_bare(c) || !parser_expects_value(p))
+				return NULL;
+			parser_token_start(p, LEX_BARE, c);
+			return s;
+	}
+}
+
+static const char *lex_string(JsonParser *p, const char *s, const char *end)
+{
+	while (s < end) {
+		const char *run = s;
+		char c;
+		
+		if (p->lex == LEX_ESCAPE) {
+			/* parse_string checks the escape once the string is complete. */
+			sb_putc(&p->token, *s++);
+			p->lex = LEX_STRING;
+			continue;
+		}
+		
+		while (s < end && *s != '"' && *s != '\\')
+			s++;
+		sb_put(&p->token, run, s - run);
+		if (s == end)
+			break;
+		
+		c = *s++;
+		sb_putc(&p->token, c);
+		if (c == '\\') {
+			p->lex = LEX_ESCAPE;
+		} else {
+			p->lex = LEX_BETWEEN;
+			return parser_string(p) ? s : NULL;
+		}
+	}
+	return s;
+}
+
+static const char *lex_bare(JsonParser *p, const char *s, const char *end)
+{
+	const char *run = s;
+	
+	while (s < end && is_bare(*s))
+		s++;
+	sb_put(&p->token, run, s - run);
+	if (s == end)
+		return s;
+	
+	p->lex = LEX_BETWEEN;
+	return parser_bare(p) ? s : NULL;
+}
+
+JsonParser *json_parser_new(const JsonCallbacks *callbacks, void *ctx)
+{
+	JsonParser *p = (JsonParser*) malloc(sizeof(JsonParser));
+	if (p == NULL)
+		out_of_memory();
+	
+	if (callbacks != NULL) {
+		p->callbacks = *callbacks;
+		p->ctx = ctx;
+	} else {
+		p->callbacks = build_callbacks;
+		p->ctx = p;
+	}
+	
+	p->lex = LEX_BETWEEN;
+	p->expect = EXPECT_VALUE;
+	p->failed = false;
+	sb_init(&p->token);
+	
+	p->depth = 0;
+	p->stack_size = 16;
+	p->stack = (char*) malloc(p->stack_size);
+	if (p->stack == NULL)
+		out_of_memory();
+	
+	p->root = NULL;
+	p->container = NULL;
+	p->key = NULL;
+	return p;
+}
+
+bool json_parser_feed(JsonParser *p, const char *buf, size_t len)
+{
+	const char *s = buf;
+	const char *end = buf + len;
+	
+	if (p->failed)
+		return false;
+	
+	while (s < end) {
+		switch (p->lex) {
+			case LEX_BETWEEN:
+				s = lex_between(p, s, end);
+				break;
+			case LEX_STRING:
+			case LEX_ESCAPE:
+				s = lex_string(p, s, end);
+				break;
+			case LEX_BARE:
+				s = lex_bare(p, s, end);
+				break;
+		}
+		
+		if (s == NULL) {
+			p->failed = true;
+			return false;
+		}
+	}
+	
+	return true;
+}
+
+bool json_parser_finish(JsonParser *p, JsonNode **root)
+{
+	bool ok = !p->failed;
+	
+	/* The end of the input ends a top-level number or literal. */
+	if (ok && p->lex == LEX_BARE) {
+		p->lex = LEX_BETWEEN;
+		ok = parser_bare(p);
+	}
+	ok = ok && p->lex == LEX_BETWEEN && p->expect == EXPECT_NOTHING;
+	
+	if (root != NULL)
+		*root = ok ? p->root : NULL;
+	if (!ok || root == NULL)
+		json_delete(p->root);
+	
+	pool_string_free(p->key);
+	free(p->stack);
+	sb_free(&p->token);
+	free(p);
+	return ok;
+}
+
+/*** Tape ***/
+
+/*
+ * A tape is built in two passes.  The first finds the offset of every
+ * structural character -- brackets, colons, commas, the opening quote of
+ * each string and the first byte of each number or literal -- 64 bytes at a
+ * time, using bit masks to work out which quotes are escaped and which bytes
+ * are inside strings.  The second walks those offsets, checks the grammar
+ * and writes one 64-bit word per value, with its type in the top byte.
+ *
+ * Containers store the index of their closing word and how many children
+ * they have, so skipping one is a single step.  An object member is a 'k'
+ * word for the key followed by the value.  Strings and keys point into a
+ * buffer of unescaped strings, and numbers into an array of Number.
+ */
+
+struct JsonTape
+{
+	uint64_t *words;
+	size_t length;
+	
+	char *strings;
+	
+	Number *numbers;
+	size_t number_count;
+	size_t number_capacity;
+};
 
-static JsonNode *mknode(JsonTag tag);
-static void append_node(JsonNode *parent, JsonNode *child);
-static void prepend_node(JsonNode *parent, JsonNode *child);
-static void append_member(JsonNode *object, char *key, JsonNode *value);
+#define TAPE_WORD(type, payload)    ((uint64_t) (unsigned char) (type) << 56 | (payload))
+#define TAPE_TYPE(word)             ((char) ((word) >> 56))
+#define TAPE_PAYLOAD(word)          ((word) & 0x00FFFFFFFFFFFFFFULL)
 
-/* Assertion-friendly validity checks */
-static bool tag_is_valid(unsigned int tag);
-static bool number_is_valid(const char *num);
+/* The payload of an opening word holds the length above the close index. */
+#define TAPE_CLOSE(word)            ((size_t) ((word) & 0xFFFFFFFF))
+#define TAPE_LENGTH(word)           ((size_t) (TAPE_PAYLOAD(word) >> 32))
+#define TAPE_MAX_LENGTH             0xFFFFFF
+
+/* Byte classes of a 64-byte block: bit i describes byte i. */
+typedef struct
+{
+	uint64_t backslash;
+	uint64_t quote;
+	uint64_t space;
+	uint64_t op;
+} BlockMasks;
+
+#if !JSON_SIMD_X86
+
+static void classify_block_bytewise(const char *p, BlockMasks *m)
+{
+	int i;
+	
+	memset(m, 0, sizeof(*m));
+	for (i = 0; i < 64; i++) {
+		uint64_t bit = (uint64_t) 1 << i;
+		
+		switch (p[i]) {
+			case '\\':
+				m->backslash |= bit;
+				break;
+			case '"':
+				m->quote |= bit;
+				break;
+			case ' ':
+			case '\t':
+			case '\n':
+			case '\r':
+				m->space |= bit;
+				break;
+			case '{':
+			case '}':
+			case '[':
+			case ']':
+			case ':':
+			case ',':
+				m->op |= bit;
+				break;
+		}
+	}
+}
+
+#else
+
+/*
+ * '[' and ']' are '{' and '}' with bit 5 clear, so one compare of the
+ * bytes with that bit set finds both kinds of bracket.
+ */
+
+static void classify_block_sse2(const char *p, BlockMasks *m)
+{
+	int i;
+	
+	memset(m, 0, sizeof(*m));
+	for (i = 0; i < 64; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i*) (p + i));
+		__m128i v20 = _mm_or_si128(v, _mm_set1_epi8(0x20));
+		__m128i space = _mm_or_si128(
+			_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),
+			             _mm_cmpeq_epi8(v, _mm_set1_epi8('\t'))),
+			_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')),
+			             _mm_cmpeq_epi8(v, _mm_set1_epi8('\r'))));
+		__m128i op = _mm_or_si128(
+			_mm_or_si128(_mm_cmpeq_epi8(v20, _mm_set1_epi8('{')),
+			             _mm_cmpeq_epi8(v20, _mm_set1_epi8('}'))),
+			_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(':')),
+			             _mm_cmpeq_epi8(v, _mm_set1_epi8(','))));
+		
+		m->backslash |= (uint64_t) (uint16_t) _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('\\'))) << i;
+		m->quote |= (uint64_t) (uint16_t) _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('"'))) << i;
+		m->space |= (uint64_t) (uint16_t) _mm_movemask_epi8(space) << i;
+		m->op |= (uint64_t) (uint16_t) _mm_movemask_epi8(op) << i;
+	}
+}
+
+__attribute__((target("avx2")))
+static void classify_block_avx2(const char *p, BlockMasks *m)
+{
+	int i;
+	
+	memset(m, 0, sizeof(*m));
+	for (i = 0; i < 64; i += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i*) (p + i));
+		__m256i v20 = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+		__m256i space = _mm256_or_si256(
+			_mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')),
+			                _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t'))),
+			_mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')),
+			                _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\r'))));
+		__m256i op = _mm256_or_si256(
+			_mm256_or_si256(_mm256_cmpeq_epi8(v20, _mm256_set1_epi8('{')),
+			                _mm256_cmpeq_epi8(v20, _mm256_set1_epi8('}'))),
+			_mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(':')),
+			                _mm256_cmpeq_epi8(v, _mm256_set1_epi8(','))));
+		
+		m->backslash |= (uint64_t) (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\\'))) << i;
+		m->quote |= (uint64_t) (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('"'))) << i;
+		m->space |= (uint64_t) (uint32_t) _mm256_movemask_epi8(space) << i;
+		m->op |= (uint64_t) (uint32_t) _mm256_movemask_epi8(op) << i;
+	}
+}
+
+#endif
+
+static void classify_block_init(const char *p, BlockMasks *m);
+
+/* Picks the best implementation for this CPU on first use. */
+static void (*classify_block)(const char *p, BlockMasks *m) = classify_block_init;
+
+static void classify_block_init(const char *p, BlockMasks *m)
+{
+#if JSON_SIMD_X86
+	if (__builtin_cpu_supports("avx2"))
+		classify_block = classify_block_avx2;
+	else
+		classify_block = classify_block_sse2;
+#else
+	classify_block = classify_block_bytewise;
+#endif
+	classify_block(p, m);
+}
+
+static int trailing_zeros64(uint64_t x)
+{
+#if defined(__GNUC__)
+	return __builtin_ctzll(x);
+#else
+	int n = 0;
+	while (!(x & 1)) {
+		x >>= 1;
+		n++;
+	}
+	return n;
+#endif
+}
+
+/* Bit i of the result is the parity of bits 0 to i of @x. */
+static uint64_t prefix_xor(uint64_t x)
+{
+	x ^= x << 1;
+	x ^= x << 2;
+	x ^= x << 4;
+	x ^= x << 8;
+	x ^= x << 16;
+	x ^= x << 32;
+	return x;
+}
+
+/* What the previous block tells the next one. */
+typedef struct
+{
+	uint64_t escaped;       /* 1 if its first byte follows an odd run of backslashes */
+	uint64_t in_string;     /* all ones if it starts inside a string */
+	uint64_t scalar;        /* 1 if it starts right after a number or literal byte */
+} IndexCarry;
+
+/*
+ * Returns the bytes escaped by a backslash.  A run of backslashes escapes
+ * the byte after it if it has odd length; adding the run to its start
+ * carries through it, which tells runs starting on even and odd bits apart.
+ */
+static uint64_t find_escaped(uint64_t backslash, uint64_t *carry)
+{
+	const uint64_t even = 0x5555555555555555ULL;
+	uint64_t follows_escape, odd_starts, sum;
+	
+	backslash &= ~*carry;
+	follows_escape = backslash << 1 | *carry;
+	odd_starts = backslash & ~even & ~follows_escape;
+	sum = odd_starts + backslash;
+	*carry = sum < odd_starts;
+	
+	return (even ^ sum << 1) & follows_escape;
+}
+
+/* Returns the structural characters of a block. */
+static uint64_t find_structurals(const BlockMasks *m, IndexCarry *carry)
+{
+	uint64_t escaped = find_escaped(m->backslash, &carry->escaped);
+	uint64_t quote = m->quote & ~escaped;
+	
+	/* Opening quotes and the insides of strings, but not closing quotes. */
+	uint64_t in_string = prefix_xor(quote) ^ carry->in_string;
+	uint64_t string_tail = in_string ^ quote;
+	
+	/* Bytes of numbers and literals; stray bytes count too, and fail later. */
+	uint64_t scalar = ~(m->op | m->space);
+	uint64_t bare = scalar & ~quote;
+	uint64_t follows_bare = bare << 1 | carry->scalar;
+	
+	carry->in_string = (uint64_t) ((int64_t) in_string >> 63);
+	carry->scalar = bare >> 63;
+	
+	return (m->op | (scalar & ~follows_bare)) & ~string_tail;
+}
+
+/*
+ * The stages take turns on batches of structurals, so the index never
+ * needs more memory than this, whatever the size of the input.
+ */
+#define TAPE_BATCH 1024
+
+typedef struct
+{
+	const char *json;
+	size_t len;
+	
+	/* Offset of the next block. */
+	size_t base;
+	IndexCarry carry;
+} Indexer;
+
+/*
+ * Stage one: store the offsets of the structural characters of the next
+ * blocks in @out, until the end of the input or until a block might not
+ * fit in @room.  Returns how many there are.
+ */
+static size_t tape_index(Indexer *ix, uint32_t *out, size_t room)
+{
+	BlockMasks m;
+	char tail[64];
+	size_t count = 0;
+	
+	for (; ix->base < ix->len && room - count >= 64; ix->base += 64) {
+		uint64_t structurals;
+		
+		if (ix->len - ix->base >= 64) {
+			classify_block(ix->json + ix->base, &m);
+		} else {
+			memset(tail, ' ', sizeof(tail));
+			memcpy(tail, ix->json + ix->base, ix->len - ix->base);
+			classify_block(tail, &m);
+		}
+		
+		for (structurals = find_structurals(&m, &ix->carry); structurals != 0; structurals &= structurals - 1)
+			out[count++] = (uint32_t) (ix->base + trailing_zeros64(structurals));
+	}
+	
+	return count;
+}
+
+/* A container that is still open: its opening word and children so far. */
+typedef struct
+{
+	size_t index;
+	size_t count;
+} TapeOpen;
+
+typedef struct
+{
+	JsonTape *tape;
+	size_t capacity;
+	const char *json;
+	
+	/* Where the next string is unescaped. */
+	char *string_end;
+	
+	Indexer ix;
+	uint32_t *index;
+	
+	TapeOpen *stack;
+	size_t stack_size;
+} TapeBuilder;
+
+/* Fill the index with the next batch of structurals, and return how many. */
+static size_t tape_refill(TapeBuilder *b)
+{
+	size_t count = tape_index(&b->ix, b->index, TAPE_BATCH - 1);
+	
+	/* At the end, there is always room left for the offset of the NUL. */
+	if (b->ix.base >= b->ix.len)
+		b->index[count++] = (uint32_t) b->ix.len;
+	return count;
+}
+
+static uint64_t *tape_grow(TapeBuilder *b)
+{
+	b->capacity *= 2;
+	b->tape->words = (uint64_t*) realloc(b->tape->words, b->capacity * sizeof(uint64_t));
+	if (b->tape->words == NULL)
+		out_of_memory();
+	return b->tape->words;
+}
+
+static TapeOpen *tape_grow_stack(TapeBuilder *b)
+{
+	b->stack_size *= 2;
+	b->stack = (TapeOpen*) realloc(b->stack, b->stack_size * sizeof(TapeOpen));
+	if (b->stack == NULL)
+		out_of_memory();
+	return b->stack;
+}
+
+/* Only whitespace may come between a string, number or literal and @next. */
+static bool tape_token_end(const char *s, const char *next)
+{
+	skip_space(&s);
+	return s == next;
+}
+
+/*
+ * Copy the plain run at @src to @dst, stopping at @end, and return its
+ * length.  The SSE2 version stores 16 bytes at a time whatever the length,
+ * so @dst needs that much room to spare.
+ */
+static size_t copy_plain(char *dst, const char *src, const char *end)
+{
+	const char *start = src;
+	
+#if JSON_SIMD_X86
+	while (end - src >= 16) {
+		__m128i v = _mm_loadu_si128((const __m128i*) src);
+		__m128i special = _mm_or_si128(
+			_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('"')),
+			             _mm_cmpeq_epi8(v, _mm_set1_epi8('\\'))),
+			_mm_cmplt_epi8(v, _mm_set1_epi8(' ')));
+		unsigned mask = (unsigned) _mm_movemask_epi8(special);
+		
+		_mm_storeu_si128((__m128i*) dst, v);
+		if (mask != 0)
+			return src - start + __builtin_ctz(mask);
+		src += 16;
+		dst += 16;
+	}
+	while (src < end && is_plain(*src))
+		*dst++ = *src++;
+#else
+	/* scan_plain stops at the closing quote, which comes before @end. */
+	(void) end;
+	src = scan_plain(src);
+	memcpy(dst, start, src - start);
+#endif
+	return src - start;
+}
+
+/*
+ * Unescape the string starting at @s, which ends before @next, into the
+ * string buffer, and return its offset there in *offset.  Escaped strings
+ * are copied first, so parse_string can unescape them in place.
+ */
+static bool tape_string(TapeBuilder *b, const char *s, const char *next, uint64_t *offset)
+{
+	Decoder dec;
+	char *copy = b->string_end;
+	const char *end = copy;
+	char *str;
+	size_t n;
+	
+	/* Most strings need neither unescaping nor validation. */
+	n = copy_plain(copy, s + 1, b->json + b->ix.len);
+	if (s[n + 1] == '"') {
+		if (!tape_token_end(s + n + 2, next))
+			return false;
+		copy[n] = 0;
+		*offset = copy - b->tape->strings;
+		b->string_end = copy + n + 1;
+		return true;
+	}
+	
+	n = next - s;
+	memcpy(copy, s, n);
+	copy[n] = 0;
+	
+	dec.doc = NULL;
+	dec.insitu = true;
+	if (!parse_string(&dec, &end, &str, NULL) || !tape_token_end(s + (end - copy), next))
+		return false;
+	
+	*offset = str - b->tape->strings;
+	b->string_end = (char*) end;
+	return true;
+}
+
+static bool tape_scalar(TapeBuilder *b, const char *s, const char *next, uint64_t *word)
+{
+	JsonTape *tape = b->tape;
+	Number num;
+	
+	switch (*s) {
+		case 'n':
+			if (!expect_literal(&s, "null"))
+				return false;
+			*word = TAPE_WORD('n', 0);
+			break;
+		case 'f':
+			if (!expect_literal(&s, "false"))
+				return false;
+			*word = TAPE_WORD('f', 0);
+			break;
+		case 't':
+			if (!expect_literal(&s, "true"))
+				return false;
+			*word = TAPE_WORD('t', 0);
+			break;
+		default:
+			if (!parse_number(&s, &num))
+				return false;
+			if (tape->number_count == tape->number_capacity) {
+				tape->number_capacity = tape->number_capacity ? tape->number_capacity * 2 : 16;
+				tape->numbers = (Number*) realloc(tape->numbers, tape->number_capacity * sizeof(Number));
+				if (tape->numbers == NULL)
+					out_of_memory();
+			}
+			tape->numbers[tape->number_count] = num;
+			*word = TAPE_WORD('N', tape->number_count++);
+	}
+	
+	return tape_token_end(s, next);
+}
+
+/*
+ * Stage two: read the structurals in grammar order and write the tape.
+ * Each label is a point in the grammar, with the innermost open container
+ * on the stack, so no state is kept between structurals.  The positions
+ * in the index, the tape and the stack are locals rather than fields of
+ * @b, so they can stay in registers.
+ */
+static bool tape_build(TapeBuilder *b)
+{
+	const char *json = b->json;
+	const uint32_t *index = b->index;
+	size_t pos = 0, count = 0;
+	uint64_t *words = b->tape->words;
+	size_t length = 0;
+	TapeOpen *stack = b->stack;
+	size_t depth = 0;
+	const char *s;
+	uint64_t word;
+	bool ok = false;
+	
+/* The next structural, or the terminating NUL once there are none left. */
+#define peek()      ((void) (pos == count && (count = tape_refill(b), pos = 0)), json + index[pos])
+#define advance()   ((void) peek(), json + index[pos++])
+
+#define push(w) do {                                        \
+		if (length == b->capacity)                          \
+			words = tape_grow(b);                           \
+		words[length++] = (w);                              \
+	} while (0)
+
+#define open_container(c) do {                              \
+		if (depth == b->stack_size)                         \
+			stack = tape_grow_stack(b);                     \
+		stack[depth].index = length;                        \
+		stack[depth++].count = 0;                           \
+		push(TAPE_WORD(c, 0));                              \
+	} while (0)
+
+/* The caller has checked that @c closes the innermost container. */
+#define close_container(c) do {                             \
+		TapeOpen *o = &stack[--depth];                      \
+		size_t n = o->count < TAPE_MAX_LENGTH ? o->count : TAPE_MAX_LENGTH; \
+		words[o->index] = TAPE_WORD(c == '}' ? '{' : '[', (uint64_t) n << 32 | length); \
+		push(TAPE_WORD(c, o->index));                       \
+	} while (0)
+	
+value:
+	if (depth > 0)
+		stack[depth - 1].count++;
+	
+	s = advance();
+	switch (*s) {
+		case '{':
+			open_container('{');
+			s = advance();
+			if (*s == '}') {
+				close_container('}');
+				goto value_end;
+			}
+			goto key;
+		case '[':
+			open_container('[');
+			if (*peek() == ']') {
+				pos++;
+				close_container(']');
+				goto value_end;
+			}
+			goto value;
+		case '"':
+			if (!tape_string(b, s, peek(), &word))
+				goto done;
+			push(TAPE_WORD('"', word));
+			goto value_end;
+		case '}':
+		case ']':
+		case ':':
+		case ',':
+		case '\0':
+			goto done;
+		default:
+			if (!tape_scalar(b, s, peek(), &word))
+				goto done;
+			push(word);
+			goto value_end;
+	}
+	
+key:
+	if (*s != '"' || !tape_string(b, s, peek(), &word) || *advance() != ':')
+		goto done;
+	push(TAPE_WORD('k', word));
+	goto value;
+	
+value_end:
+	if (depth == 0) {
+		ok = *advance() == '\0';
+		goto done;
+	}
+	
+	s = advance();
+	if (TAPE_TYPE(words[stack[depth - 1].index]) == '{') {
+		if (*s == ',') {
+			s = advance();
+			goto key;
+		}
+		if (*s != '}')
+			goto done;
+	} else {
+		if (*s == ',')
+			goto value;
+		if (*s != ']')
+			goto done;
+	}
+	close_container(*s);
+	goto value_end;
+	
+#undef peek
+#undef advance
+#undef push
+#undef open_container
+#undef close_container
+	
+done:
+	b->tape->length = length;
+	return ok;
+}
+
+JsonTape *json_tape_parse(const char *json)
+{
+	uint32_t index[TAPE_BATCH];
+	TapeBuilder b;
+	bool ok;
+	
+	b.ix.json = json;
+	b.ix.len = strlen(json);
+	b.ix.base = 0;
+	memset(&b.ix.carry, 0, sizeof(b.ix.carry));
+	b.index = index;
+	
+	/* Offsets and close indexes are 32 bits. */
+	if (b.ix.len > 0xFFFFFFFF)
+		return NULL;
+	
+	/*
+	 * Unescaping never makes the strings longer than the text; the rest is
+	 * for copy_plain.  Typical documents need a word for every 5 to 10
+	 * bytes, and growing the tape is expensive, so start a little above
+	 * that.
+	 */
+	b.tape = (JsonTape*) calloc(1, sizeof(JsonTape));
+	if (b.tape == NULL)
+		out_of_memory();
+	b.capacity = b.ix.len / 4 + 16;
+	b.tape->words = (uint64_t*) malloc(b.capacity * sizeof(uint64_t));
+	b.tape->strings = (char*) malloc(b.ix.len + 2 + 16);
+	b.stack_size = 16;
+	b.stack = (TapeOpen*) malloc(b.stack_size * sizeof(TapeOpen));
+	if (b.tape->words == NULL || b.tape->strings == NULL || b.stack == NULL)
+		out_of_memory();
+	b.json = json;
+	b.string_end = b.tape->strings;
+	
+	ok = tape_build(&b);
+	free(b.stack);
+	
+	if (!ok || b.ix.carry.in_string != 0) {
+		json_tape_free(b.tape);
+		return NULL;
+	}
+	return b.tape;
+}
+
+void json_tape_free(JsonTape *tape)
+{
+	if (tape == NULL)
+		return;
+	free(tape->words);
+	free(tape->strings);
+	free(tape->numbers);
+	free(tape);
+}
+
+JsonCursor json_tape_root(const JsonTape *tape)
+{
+	JsonCursor ret;
+	
+	ret.tape = tape;
+	ret.index = 0;
+	return ret;
+}
+
+/* The word of the value under @cursor. */
+#define cursor_word(cursor) ((cursor).tape->words[(cursor).index])
+
+JsonTag json_tape_tag(JsonCursor cursor)
+{
+	switch (TAPE_TYPE(cursor_word(cursor))) {
+		case 't':
+		case 'f':
+			return JSON_BOOL;
+		case '"':
+			return JSON_STRING;
+		case 'N':
+			return JSON_NUMBER;
+		case '[':
+			return JSON_ARRAY;
+		case '{':
+			return JSON_OBJECT;
+		default:
+			return JSON_NULL;
+	}
+}
+
+/* Index of the word after the value at @index. */
+static size_t tape_skip(const JsonTape *tape, size_t index)
+{
+	uint64_t word = tape->words[index];
+	char type = TAPE_TYPE(word);
+	
+	if (type == '{' || type == '[')
+		return TAPE_CLOSE(word) + 1;
+	return index + 1;
+}
+
+/* Point @cursor at the value at or after @index, unless @index ends a container. */
+static bool tape_seek(JsonCursor *cursor, size_t index)
+{
+	const JsonTape *tape = cursor->tape;
+	char type;
+	
+	if (index >= tape->length)
+		return false;
+	type = TAPE_TYPE(tape->words[index]);
+	if (type == '}' || type == ']')
+		return false;
+	
+	/* Step over the key of an object member. */
+	cursor->index = type == 'k' ? index + 1 : index;
+	return true;
+}
+
+bool json_tape_first(JsonCursor container, JsonCursor *out)
+{
+	char type = TAPE_TYPE(cursor_word(container));
+	JsonCursor child = container;
+	
+	if ((type != '{' && type != '[') || !tape_seek(&child, container.index + 1))
+		return false;
+	*out = child;
+	return true;
+}
+
+bool json_tape_next(JsonCursor *cursor)
+{
+	return tape_seek(cursor, tape_skip(cursor->tape, cursor->index));
+}
+
+bool json_tape_find(JsonCursor object, const char *key, JsonCursor *out)
+{
+	const JsonTape *tape = object.tape;
+	size_t index;
+	uint64_t word;
+	
+	if (TAPE_TYPE(cursor_word(object)) != '{')
+		return false;
+	
+	for (index = object.index + 1; TAPE_TYPE(word = tape->words[index]) == 'k';
+	     index = tape_skip(tape, index + 1)) {
+		if (strcmp(tape->strings + TAPE_PAYLOAD(word), key) == 0) {
+			out->tape = tape;
+			out->index = index + 1;
+			return true;
+		}
+	}
+	return false;
+}
 
-JsonNode *json_decode(const char *json)
+int json_tape_length(JsonCursor container)
 {
-	const char *s = json;
-	JsonNode *ret;
+	uint64_t word = cursor_word(container);
+	char type = TAPE_TYPE(word);
+	JsonCursor child;
+	int length;
 	
-	skip_space(&s);
-	if (!parse_value(&s, &ret))
-		return NULL;
+	if (type != '{' && type != '[')
+		return -1;
+	if (TAPE_LENGTH(word) < TAPE_MAX_LENGTH)
+		return (int) TAPE_LENGTH(word);
 	
-	skip_space(&s);
-	if (*s != 0) {
-		json_delete(ret);
+	/* Too many children to store; count them. */
+	length = 0;
+	if (json_tape_first(container, &child))
+		for (length = 1; json_tape_next(&child); length++)
+			;
+	return length;
+}
+
+const char *json_tape_key(JsonCursor cursor)
+{
+	uint64_t word;
+	
+	/* A value only ever follows a 'k' word if that is its key. */
+	if (cursor.index == 0)
 		return NULL;
-	}
+	word = cursor.tape->words[cursor.index - 1];
+	return TAPE_TYPE(word) == 'k' ? cursor.tape->strings + TAPE_PAYLOAD(word) : NULL;
+}
+
+const char *json_tape_string(JsonCursor cursor)
+{
+	uint64_t word = cursor_word(cursor);
 	
-	return ret;
+	return TAPE_TYPE(word) == '"' ? cursor.tape->strings + TAPE_PAYLOAD(word) : NULL;
 }
 
-char *json_encode(const JsonNode *node)
+double json_tape_number(JsonCursor cursor)
 {
-	return json_stringify(node, NULL);
+	uint64_t word = cursor_word(cursor);
+	
+	return TAPE_TYPE(word) == 'N' ? cursor.tape->numbers[TAPE_PAYLOAD(word)].value : 0;
 }
 
-char *json_encode_string(const char *str)
+bool json_tape_int64(JsonCursor cursor, int64_t *out)
 {
-	SB sb;
-	sb_init(&sb);
+	uint64_t word = cursor_word(cursor);
+	const Number *num;
 	
-	emit_string(&sb, str);
+	if (TAPE_TYPE(word) != 'N')
+		return false;
 	
-	return sb_finish(&sb);
+	/* The same rules as json_get_int64. */
+	num = &cursor.tape->numbers[TAPE_PAYLOAD(word)];
+	if (num->is_integer) {
+		*out = num->integer;
+		return true;
+	}
+	if (!(num->value >= -9007199254740992.0 && num->value <= 9007199254740992.0) ||
+	    num->value != (double) (int64_t) num->value)
+		return false;
+	*out = (int64_t) num->value;
+	return true;
 }
 
-char *json_stringify(const JsonNode *node, const char *space)
+bool json_tape_bool(JsonCursor cursor)
 {
-	SB sb;
-	sb_init(&sb);
+	return TAPE_TYPE(cursor_word(cursor)) == 't';
+}
+
+/*** Compact documents ***/
+
+/*
+ * A compact document is one block of 16-byte nodes followed by the strings
+ * they refer to.  Nodes are laid out breadth first, so the children of a
+ * container are contiguous and indexing one is O(1).  Every link is a
+ * 32-bit offset relative to the node holding it, so the block has no
+ * pointers in it at all, and strings of up to 7 bytes live in the node.
+ */
+
+struct JsonCompactNode
+{
+	unsigned char tag;
+	unsigned char flags;
 	
-	if (space != NULL)
-		emit_value_indented(&sb, node, space, 0);
-	else
-		emit_value(&sb, node);
+	/* Offset in bytes to the key, or 0 if the node is not a member. */
+	int32_t key;
 	
-	return sb_finish(&sb);
+	union {
+		bool bool_;
+		double number;
+		int64_t integer;            /* COMPACT_INTEGER */
+		char inline_[8];            /* COMPACT_INLINE */
+		
+		/*
+		 * Strings: bytes to the text, and its length.
+		 * Containers: nodes to the first child, and how many there are.
+		 */
+		struct {
+			int32_t offset;
+			uint32_t length;
+		} ref;
+	} u;
+};
+
+#define COMPACT_LAST        0x01    /* The last child of its parent. */
+#define COMPACT_INLINE      0x02    /* The string is in inline_. */
+#define COMPACT_INTEGER     0x04    /* The number is exact, in integer. */
+
+#define COMPACT_INLINE_MAX  7
+
+struct JsonCompact
+{
+	/* Of the whole block, this header included. */
+	size_t size;
+	
+	/* The root first, then the rest breadth first, then the strings. */
+	JsonCompactNode nodes[];
+};
+
+/* Count the nodes below and including @node, and the bytes of their strings. */
+static void compact_measure(const JsonNode *node, bool member, size_t *count, size_t *bytes)
+{
+	const JsonNode *child;
+	
+	(*count)++;
+	if (member)
+		*bytes += strlen(node->key) + 1;
+	if (node->tag == JSON_STRING && strlen(node->string_) > COMPACT_INLINE_MAX)
+		*bytes += strlen(node->string_) + 1;
+	
+	json_foreach(child, node)
+		compact_measure(child, node->tag == JSON_OBJECT, count, bytes);
 }
 
-void json_delete(JsonNode *node)
+/* Copy @str to *strings and return its offset from @node. */
+static int32_t compact_string(JsonCompactNode *node, char **strings, const char *str, size_t len)
 {
-	if (node != NULL) {
-		json_remove_from_parent(node);
+	int32_t offset = (int32_t) (*strings - (char*) node);
+	
+	memcpy(*strings, str, len + 1);
+	*strings += len + 1;
+	return offset;
+}
+
+JsonCompact *json_compact_from_node(const JsonNode *root)
+{
+	size_t count = 0, bytes = 0, size, i, next;
+	const JsonNode **sources;
+	JsonCompact *doc;
+	char *strings;
+	
+	compact_measure(root, false, &count, &bytes);
+	size = sizeof(JsonCompact) + count * sizeof(JsonCompactNode) + bytes;
+	if (size > INT32_MAX)
+		return NULL;
+	
+	doc = (JsonCompact*) calloc(1, size);
+	sources = (const JsonNode**) malloc(count * sizeof(*sources));
+	if (doc == NULL || sources == NULL)
+		out_of_memory();
+	doc->size = size;
+	strings = (char*) (doc->nodes + count);
+	
+	/* The nodes double as the queue of the breadth-first walk. */
+	sources[0] = root;
+	next = 1;
+	for (i = 0; i < count; i++) {
+		const JsonNode *src = sources[i];
+		JsonCompactNode *dst = &doc->nodes[i];
+		const JsonNode *child;
+		size_t len;
 		
-		switch (node->tag) {
+		dst->tag = (unsigned char) src->tag;
+		if (i == 0 || src->next == NULL)
+			dst->flags |= COMPACT_LAST;
+		if (i > 0 && src->parent->tag == JSON_OBJECT)
+			dst->key = compact_string(dst, &strings, src->key, strlen(src->key));
+		
+		switch (src->tag) {
+			case JSON_BOOL:
+				dst->u.bool_ = src->bool_;
+				break;
 			case JSON_STRING:
-				free(node->string_);
+				len = strlen(src->string_);
+				if (len <= COMPACT_INLINE_MAX) {
+					memcpy(dst->u.inline_, src->string_, len + 1);
+					dst->flags |= COMPACT_INLINE;
+				} else {
+					dst->u.ref.offset = compact_string(dst, &strings, src->string_, len);
+					dst->u.ref.length = (uint32_t) len;
+				}
+				break;
+			case JSON_NUMBER:
+				if ((src->flags & NODE_INTEGER) && (double) src->integer_ == src->number_) {
+					dst->u.integer = src->integer_;
+					dst->flags |= COMPACT_INTEGER;
+				} else {
+					dst->u.number = src->number_;
+				}
 				break;
 			case JSON_ARRAY:
 			case JSON_OBJECT:
-			{
-				JsonNode *child, *next;
-				for (child = node->children.head; child != NULL; child = next) {
-					next = child->next;
-					json_delete(child);
-				}
+				dst->u.ref.offset = (int32_t) (next - i);
+				dst->u.ref.length = (uint32_t) src->children.length;
+				json_foreach(child, src)
+					sources[next++] = child;
+				break;
+			default:
 				break;
-			}
-			default:;
 		}
-		
-		free(node);
 	}
+	
+	free(sources);
+	return doc;
 }
 
-bool json_validate(const char *json)
+JsonCompact *json_compact_decode(const char *json)
 {
-	const char *s = json;
+	JsonNode *root = json_decode_arena(json);
+	JsonCompact *doc;
 	
-	skip_space(&s);
-	if (!parse_value(&s, NULL))
-		return false;
+	if (root == NULL)
+		return NULL;
+	doc = json_compact_from_node(root);
+	json_delete(root);
+	return doc;
+}
+
+void json_compact_free(JsonCompact *doc)
+{
+	free(doc);
+}
+
+size_t json_compact_size(const JsonCompact *doc)
+{
+	return doc->size;
+}
+
+const JsonCompactNode *json_compact_root(const JsonCompact *doc)
+{
+	return doc->nodes;
+}
+
+/* The text @offset bytes away from @node. */
+#define compact_ptr(node, offset)   ((const char*) (node) + (offset))
+
+JsonTag json_compact_tag(const JsonCompactNode *node)
+{
+	return (JsonTag) node->tag;
+}
+
+const char *json_compact_key(const JsonCompactNode *node)
+{
+	return node != NULL && node->key != 0 ? compact_ptr(node, node->key) : NULL;
+}
+
+const char *json_compact_string(const JsonCompactNode *node)
+{
+	if (node == NULL || node->tag != JSON_STRING)
+		return NULL;
+	if (node->flags & COMPACT_INLINE)
+		return node->u.inline_;
+	return compact_ptr(node, node->u.ref.offset);
+}
+
+double json_compact_number(const JsonCompactNode *node)
+{
+	if (node == NULL || node->tag != JSON_NUMBER)
+		return 0;
+	return node->flags & COMPACT_INTEGER ? (double) node->u.integer : node->u.number;
+}
+
+bool json_compact_int64(const JsonCompactNode *node, int64_t *out)
+{
+	double n;
 	
-	skip_space(&s);
-	if (*s != 0)
+	if (node == NULL || node->tag != JSON_NUMBER)
 		return false;
+	if (node->flags & COMPACT_INTEGER) {
+		*out = node->u.integer;
+		return true;
+	}
 	
+	/* The same rules as json_get_int64. */
+	n = node->u.number;
+	if (!(n >= -9007199254740992.0 && n <= 9007199254740992.0) || n != (double) (int64_t) n)
+		return false;
+	*out = (int64_t) n;
 	return true;
 }
 
+bool json_compact_bool(const JsonCompactNode *node)
+{
+	return node != NULL && node->tag == JSON_BOOL && node->u.bool_;
+}
+
+int json_compact_length(const JsonCompactNode *node)
+{
+	if (node == NULL || (node->tag != JSON_ARRAY && node->tag != JSON_OBJECT))
+		return -1;
+	return (int) node->u.ref.length;
+}
+
+const JsonCompactNode *json_compact_first_child(const JsonCompactNode *node)
+{
+	if (json_compact_length(node) <= 0)
+		return NULL;
+	return node + node->u.ref.offset;
+}
+
+const JsonCompactNode *json_compact_next(const JsonCompactNode *node)
+{
+	return node->flags & COMPACT_LAST ? NULL : node + 1;
+}
+
+const JsonCompactNode *json_compact_find_element(const JsonCompactNode *array, int index)
+{
+	if (index < 0 || index >= json_compact_length(array))
+		return NULL;
+	return array + array->u.ref.offset + index;
+}
+
+const JsonCompactNode *json_compact_find_member(const JsonCompactNode *object, const char *key)
+{
+	const JsonCompactNode *member;
+	
+	if (object == NULL || object->tag != JSON_OBJECT)
+		return NULL;
+	
+	json_compact_foreach(member, object)
+		if (strcmp(compact_ptr(member, member->key), key) == 0)
+			return member;
+	return NULL;
+}
+
+JsonNode *json_compact_to_node(const JsonCompactNode *node)
+{
+	const JsonCompactNode *child;
+	JsonNode *ret;
+	
+	switch (node->tag) {
+		case JSON_BOOL:
+			return json_mkbool(node->u.bool_);
+		case JSON_STRING:
+			return json_mkstring(json_compact_string(node));
+		case JSON_NUMBER:
+			ret = json_mknumber(json_compact_number(node));
+			if (node->flags & COMPACT_INTEGER) {
+				ret->integer_ = node->u.integer;
+				ret->flags |= NODE_INTEGER;
+			}
+			return ret;
+		case JSON_ARRAY:
+			ret = json_mkarray();
+			json_compact_foreach(child, node)
+				json_append_element(ret, json_compact_to_node(child));
+			return ret;
+		case JSON_OBJECT:
+			ret = json_mkobject();
+			json_compact_foreach(child, node)
+				json_append_member(ret, json_compact_key(child), json_compact_to_node(child));
+			return ret;
+		default:
+			return json_mknull();
+	}
+}
+
 // We return the number of elements or -1 if there was a problem
 int json_array_length(JsonNode *array) {
 
-	int result = 0;
-	
 	// The node should not be null and it should be an array
 	if (array == NULL || array->tag != JSON_ARRAY)
 		return -1;
 	
-	// Loop and count!
-	JsonNode *element;
-	json_foreach(element, array) {
-		result++;
-	}
-	
-	return result;
+	return array->children.length;
 }
 
 JsonNode *json_find_element(JsonNode *array, int index)
 {
+	JsonIndex *elements;
 	JsonNode *element;
 	int i = 0;
 	
 	if (array == NULL || array->tag != JSON_ARRAY)
 		return NULL;
 	
+	if (index < 0 || index >= array->children.length)
+		return NULL;
+	
+	elements = array->children.index;
+	if (elements == NULL || elements->stale) {
+		if (index > INDEX_MIN_CHILDREN)
+			json_index_elements(array);
+		elements = array->children.index;
+	}
+	if (elements != NULL && !elements->stale) {
+		elements->hint = index;
+		return elements->elements[elements->start + index];
+	}
+	
 	json_foreach(element, array) {
 		if (i == index)
 			return element;
 		i++;
 	}
 	
-	return NULL;
+	return NULL;
+}
+
+void json_index_elements(JsonNode *array)
+{
+	if (array == NULL || array->tag != JSON_ARRAY)
+		return;
+	
+	if (array->children.index == NULL && index_new(array) == NULL)
+		return;
+	
+	if (array->children.index->stale)
+		index_rebuild(array);
+}
+
+JsonNode *json_find_member(JsonNode *object, const char *name)
+{
+	JsonIndex *index;
+	JsonNode *member;
+	int walked = 0;
+	
+	if (object == NULL || object->tag != JSON_OBJECT)
+		return NULL;
+	
+	index = object->children.index;
+	if (index != NULL && !index->stale)
+		return (JsonNode*) hashmap_get(&index->members, name, strlen(name));
+	
+	json_foreach(member, object) {
+		if (strcmp(member->key, name) == 0)
+			break;
+		walked++;
+	}
+	
+	if (walked > INDEX_MIN_CHILDREN)
+		json_index_members(object);
+	
+	return member;
+}
+
+JsonNode *json_find_member_interned(JsonNode *object, const char *key)
+{
+	JsonIndex *index;
+	JsonNode *member;
+	int walked = 0;
+	
+	if (object == NULL || object->tag != JSON_OBJECT)
+		return NULL;
+	
+	index = object->children.index;
+	if (index != NULL && !index->stale)
+		return (JsonNode*) hashmap_get(&index->members, key, strlen(key));
+	
+	/* An interned key is found by pointer; strcmp catches keys that were not interned. */
+	json_foreach(member, object) {
+		if (member->key == key || strcmp(member->key, key) == 0)
+			break;
+		walked++;
+	}
+	
+	if (walked > INDEX_MIN_CHILDREN)
+		json_index_members(object);
+	
+	return member;
+}
+
+void json_index_members(JsonNode *object)
+{
+	if (object == NULL || object->tag != JSON_OBJECT)
+		return;
+	
+	if (object->children.index == NULL && index_new(object) == NULL)
+		return;
+	
+	if (object->children.index->stale)
+		index_rebuild(object);
+}
+
+/* Schemas */
+
+static pthread_mutex_t schema_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Hash and intern the keys of @schema, once. */
+static void schema_prepare(JsonSchema *schema)
+{
+	size_t mask = sizeof(schema->slots) - 1;
+	int i;
+	
+	if (__atomic_load_n(&schema->ready, __ATOMIC_ACQUIRE))
+		return;
+	
+	pthread_mutex_lock(&schema_lock);
+	if (!schema->ready) {
+		assert(schema->count <= JSON_SCHEMA_MAX_KEYS);
+		memset(schema->slots, 0, sizeof(schema->slots));
+		for (i = 0; i < schema->count; i++) {
+			const char *key = schema->keys[i];
+			size_t slot;
+			
+			schema->interned[i] = json_intern(key);
+			schema->hashes[i] = intern_hash(key, strlen(key));
+			for (slot = schema->hashes[i] & mask; schema->slots[slot] != 0; slot = (slot + 1) & mask)
+				;
+			schema->slots[slot] = i + 1;
+		}
+		__atomic_store_n(&schema->ready, 1, __ATOMIC_RELEASE);
+	}
+	pthread_mutex_unlock(&schema_lock);
+}
+
+int json_extract(JsonSchema *schema, const JsonNode *object, JsonNode **fields)
+{
+	size_t mask = sizeof(schema->slots) - 1;
+	const JsonNode *member;
+	int found = 0;
+	
+	schema_prepare(schema);
+	memset(fields, 0, schema->count * sizeof(JsonNode*));
+	if (object == NULL || object->tag != JSON_OBJECT)
+		return -1;
+	
+	json_foreach(member, object) {
+		bool interned = (member->flags & NODE_INTERNED_KEY) != 0;
+		uint32_t hash;
+		size_t slot;
+		int i;
+		
+		/* Interned keys carry their hash already. */
+		if (interned)
+			hash = ((const InternKey*) (member->key - offsetof(InternKey, key)))->hash;
+		else
+			hash = intern_hash(member->key, strlen(member->key));
+		
+		for (slot = hash & mask; (i = schema->slots[slot]) != 0; slot = (slot + 1) & mask) {
+			i--;
+			if (schema->hashes[i] != hash)
+				continue;
+			if (interned ? member->key == schema->interned[i] : strcmp(member->key, schema->keys[i]) == 0)
+				break;
+		}
+		
+		/* Like json_find_member, the first of several members with a key wins. */
+		if (schema->slots[slot] != 0 && fields[i] == NULL) {
+			fields[i] = (JsonNode*) member;
+			if (++found == schema->count)
+				break;
+		}
+	}
+	
+	return found;
 }
 
-JsonNode *json_find_member(JsonNode *object, const char *name)
+bool json_get_int64(const JsonNode *node, int64_t *out)
 {
-	JsonNode *member;
+	double n;
 	
-	if (object == NULL || object->tag != JSON_OBJECT)
-		return NULL;
+	if (node == NULL || node->tag != JSON_NUMBER)
+		return false;
 	
-	json_foreach(member, object)
-		if (strcmp(member->key, name) == 0)
-			return member;
+	/* Ignore integer_ if number_ has been changed since it was parsed. */
+	if ((node->flags & NODE_INTEGER) && (double) node->integer_ == node->number_) {
+		*out = node->integer_;
+		return true;
+	}
 	
-	return NULL;
+	/* Beyond 2^53, number_ may not be the integer that was written. */
+	n = node->number_;
+	if (!(n >= -9007199254740992.0 && n <= 9007199254740992.0) || n != (double) (int64_t) n)
+		return false;
+	*out = (int64_t) n;
+	return true;
 }
 
 JsonNode *json_first_child(const JsonNode *node)
@@ -507,13 +3462,37 @@ JsonNode *json_first_child(const JsonNode *node)
 
 static JsonNode *mknode(JsonTag tag)
 {
-	JsonNode *ret = (JsonNode*) calloc(1, sizeof(JsonNode));
-	if (ret == NULL)
-		out_of_memory();
+	JsonNode *ret = pool_node_alloc();
+	
+	memset(ret, 0, sizeof(JsonNode));
 	ret->tag = tag;
 	return ret;
 }
 
+static JsonNode *decoder_mknode(Decoder *dec, JsonTag tag)
+{
+	JsonNode *ret;
+	
+	if (dec->doc == NULL)
+		return mknode(tag);
+	
+	ret = (JsonNode*) arena_alloc(dec->doc, sizeof(JsonNode));
+	memset(ret, 0, sizeof(JsonNode));
+	ret->tag = tag;
+	ret->flags = NODE_ARENA | NODE_SHARED_KEY | NODE_SHARED_STRING;
+	return ret;
+}
+
+/* Note that a heap node has been attached below arena node @parent. */
+static void note_heap_child(JsonNode *parent, JsonNode *child)
+{
+	if ((parent->flags & NODE_ARENA) && !(child->flags & NODE_ARENA)) {
+		JsonDocument *doc = document_of(parent);
+		if (doc != NULL)
+			doc->has_heap_nodes = true;
+	}
+}
+
 JsonNode *json_mknull(void)
 {
 	return mknode(JSON_NULL);
@@ -557,6 +3536,8 @@ JsonNode *json_mkobject(void)
 
 static void append_node(JsonNode *parent, JsonNode *child)
 {
+	note_heap_child(parent, child);
+	
 	child->parent = parent;
 	child->prev = parent->children.tail;
 	child->next = NULL;
@@ -566,10 +3547,15 @@ static void append_node(JsonNode *parent, JsonNode *child)
 	else
 		parent->children.head = child;
 	parent->children.tail = child;
+	parent->children.length++;
+	
+	index_link(parent, child);
 }
 
 static void prepend_node(JsonNode *parent, JsonNode *child)
 {
+	note_heap_child(parent, child);
+	
 	child->parent = parent;
 	child->prev = NULL;
 	child->next = parent->children.head;
@@ -579,6 +3565,9 @@ static void prepend_node(JsonNode *parent, JsonNode *child)
 	else
 		parent->children.tail = child;
 	parent->children.head = child;
+	parent->children.length++;
+	
+	index_link(parent, child);
 }
 
 static void append_member(JsonNode *object, char *key, JsonNode *value)
@@ -592,57 +3581,525 @@ void json_append_element(JsonNode *array, JsonNode *element)
 	assert(array->tag == JSON_ARRAY);
 	assert(element->parent == NULL);
 	
-	append_node(array, element);
+	append_node(array, element);
+}
+
+void json_prepend_element(JsonNode *array, JsonNode *element)
+{
+	assert(array->tag == JSON_ARRAY);
+	assert(element->parent == NULL);
+	
+	prepend_node(array, element);
+}
+
+void json_append_member(JsonNode *object, const char *key, JsonNode *value)
+{
+	assert(object->tag == JSON_OBJECT);
+	assert(value->parent == NULL);
+	
+	value->flags &= ~(NODE_SHARED_KEY | NODE_INTERNED_KEY);
+	append_member(object, json_strdup(key), value);
+}
+
+void json_prepend_member(JsonNode *object, const char *key, JsonNode *value)
+{
+	assert(object->tag == JSON_OBJECT);
+	assert(value->parent == NULL);
+	
+	value->flags &= ~(NODE_SHARED_KEY | NODE_INTERNED_KEY);
+	value->key = json_strdup(key);
+	prepend_node(object, value);
+}
+
+void json_remove_from_parent(JsonNode *node)
+{
+	JsonNode *parent = node->parent;
+	
+	if (parent != NULL) {
+		index_unlink(parent, node);
+		
+		if (node->prev != NULL)
+			node->prev->next = node->next;
+		else
+			parent->children.head = node->next;
+		if (node->next != NULL)
+			node->next->prev = node->prev;
+		else
+			parent->children.tail = node->prev;
+		parent->children.length--;
+		
+		if (!(node->flags & NODE_SHARED_KEY))
+			pool_string_free(node->key);
+		
+		node->parent = NULL;
+		node->prev = node->next = NULL;
+		node->key = NULL;
+		node->flags &= ~NODE_INTERNED_KEY;
+	}
+}
+
+/*** Patching ***/
+
+/*
+ * RFC 7396 merge patches and RFC 6902 JSON patches, applied to a tree in
+ * place.  Values are copied out of the patch, which is left untouched.
+ * Every node that changes is passed to the caller's JsonChangeFn, so it
+ * can rebuild only what depends on it.
+ */
+
+/* A heap copy of @node and everything below it. */
+static JsonNode *copy_node(const JsonNode *node)
+{
+	const JsonNode *child;
+	JsonNode *ret;
+	
+	switch (node->tag) {
+		case JSON_BOOL:
+			return json_mkbool(node->bool_);
+		case JSON_STRING:
+			return json_mkstring(node->string_);
+		case JSON_NUMBER:
+			ret = json_mknumber(node->number_);
+			ret->integer_ = node->integer_;
+			ret->flags |= node->flags & NODE_INTEGER;
+			return ret;
+		case JSON_ARRAY:
+		case JSON_OBJECT:
+			ret = mknode(node->tag);
+			json_foreach(child, node) {
+				JsonNode *copy = copy_node(child);
+				
+				if (node->tag == JSON_ARRAY) {
+					append_node(ret, copy);
+				} else if (child->flags & NODE_INTERNED_KEY) {
+					append_member(ret, child->key, copy);
+					copy->flags |= NODE_SHARED_KEY | NODE_INTERNED_KEY;
+				} else {
+					append_member(ret, json_strdup(child->key), copy);
+				}
+			}
+			return ret;
+		default:
+			return json_mknull();
+	}
+}
+
+static bool nodes_equal(const JsonNode *a, const JsonNode *b)
+{
+	const JsonNode *x, *y;
+	
+	if (a->tag != b->tag)
+		return false;
+	
+	switch (a->tag) {
+		case JSON_BOOL:
+			return a->bool_ == b->bool_;
+		case JSON_STRING:
+			return strcmp(a->string_, b->string_) == 0;
+		case JSON_NUMBER:
+			if ((a->flags & b->flags & NODE_INTEGER) != 0)
+				return a->integer_ == b->integer_;
+			return a->number_ == b->number_;
+		case JSON_ARRAY:
+			if (a->children.length != b->children.length)
+				return false;
+			for (x = a->children.head, y = b->children.head; x != NULL; x = x->next, y = y->next)
+				if (!nodes_equal(x, y))
+					return false;
+			return true;
+		case JSON_OBJECT:
+			if (a->children.length != b->children.length)
+				return false;
+			json_foreach(x, a) {
+				y = json_find_member((JsonNode*) b, x->key);
+				if (y == NULL || !nodes_equal(x, y))
+					return false;
+			}
+			return true;
+		default:
+			return true;
+	}
+}
+
+/* Link @child into the array @parent in front of @next, or at the end if @next is NULL. */
+static void insert_node(JsonNode *parent, JsonNode *next, JsonNode *child)
+{
+	assert(parent->tag == JSON_ARRAY);
+	
+	if (next == NULL) {
+		append_node(parent, child);
+		return;
+	}
+	
+	note_heap_child(parent, child);
+	
+	child->parent = parent;
+	child->prev = next->prev;
+	child->next = next;
+	if (next->prev != NULL)
+		next->prev->next = child;
+	else
+		parent->children.head = child;
+	next->prev = child;
+	parent->children.length++;
+	
+	index_link(parent, child);
+}
+
+/*
+ * Put @value where @old is, taking over its key, and delete @old.
+ * If @old is the root, *root becomes @value.
+ */
+static void replace_node(JsonNode **root, JsonNode *old, JsonNode *value)
+{
+	JsonNode *parent = old->parent;
+	
+	if (parent == NULL) {
+		assert(old == *root);
+		*root = value;
+		json_delete(old);
+		return;
+	}
+	
+	note_heap_child(parent, value);
+	
+	value->parent = parent;
+	value->prev = old->prev;
+	value->next = old->next;
+	if (old->prev != NULL)
+		old->prev->next = value;
+	else
+		parent->children.head = value;
+	if (old->next != NULL)
+		old->next->prev = value;
+	else
+		parent->children.tail = value;
+	if (old->key != NULL) {
+		value->key = old->key;
+		value->flags |= old->flags & (NODE_SHARED_KEY | NODE_INTERNED_KEY);
+	}
+	index_replace(parent, old, value);
+	
+	/* @old is on its own now, and its key has been handed over. */
+	old->parent = old->prev = old->next = NULL;
+	old->key = NULL;
+	json_delete(old);
+}
+
+static void report(JsonChangeFn changed, void *ctx, JsonNode *node)
+{
+	if (changed != NULL)
+		changed(node, ctx);
+}
+
+static void merge_patch(JsonNode **root, JsonNode *target, const JsonNode *patch, JsonChangeFn changed, void *ctx)
+{
+	const JsonNode *member;
+	
+	if (patch->tag != JSON_OBJECT || target->tag != JSON_OBJECT) {
+		JsonNode *value;
+		
+		if (patch->tag != JSON_OBJECT && nodes_equal(target, patch))
+			return;
+		
+		/* Members of an object patch that are null only delete, so they are not copied. */
+		if (patch->tag == JSON_OBJECT) {
+			value = json_mkobject();
+			merge_patch(&value, value, patch, NULL, NULL);
+		} else {
+			value = copy_node(patch);
+		}
+		replace_node(root, target, value);
+		report(changed, ctx, value);
+		return;
+	}
+	
+	json_foreach(member, patch) {
+		JsonNode *current = json_find_member(target, member->key);
+		
+		if (member->tag == JSON_NULL) {
+			if (current != NULL) {
+				json_delete(current);
+				report(changed, ctx, target);
+			}
+		} else if (current != NULL) {
+			merge_patch(root, current, member, changed, ctx);
+		} else {
+			JsonNode *value = json_mkobject();
+			
+			merge_patch(&value, value, member, NULL, NULL);
+			json_append_member(target, member->key, value);
+			report(changed, ctx, value);
+		}
+	}
+}
+
+void json_merge_patch(JsonNode **root, const JsonNode *patch, JsonChangeFn changed, void *ctx)
+{
+	merge_patch(root, *root, patch, changed, ctx);
+}
+
+/*
+ * Unescape the next reference token of the JSON pointer at *@sp into @token,
+ * returning false if it is malformed.  *@sp is left at the following '/'
+ * or the terminator.
+ */
+static bool pointer_token(const char **sp, SB *token)
+{
+	const char *s = *sp;
+	
+	token->cur = token->start;
+	for (; *s != '/' && *s != 0; s++) {
+		char c = *s;
+		
+		if (c == '~') {
+			s++;
+			if (*s == '0')
+				c = '~';
+			else if (*s == '1')
+				c = '/';
+			else
+				return false;
+		}
+		sb_putc(token, c);
+	}
+	sb_finish(token);
+	*sp = s;
+	return true;
+}
+
+/*
+ * Parse the array index @token into *@out.  "-" is the index just past the
+ * last element, and so is the length; anything beyond that fails.
+ */
+static bool pointer_index(const JsonNode *array, const char *token, int *out)
+{
+	long index = 0;
+	const char *s;
+	
+	if (strcmp(token, "-") == 0) {
+		*out = array->children.length;
+		return true;
+	}
+	if (*token == 0 || (token[0] == '0' && token[1] != 0))
+		return false;
+	for (s = token; *s != 0; s++) {
+		if (!is_digit(*s))
+			return false;
+		index = index * 10 + (*s - '0');
+		if (index > array->children.length)
+			return false;
+	}
+	*out = (int) index;
+	return true;
+}
+
+/* The child of @node named by @token, or NULL. */
+static JsonNode *pointer_child(JsonNode *node, const char *token)
+{
+	int index;
+	
+	if (node->tag == JSON_OBJECT)
+		return json_find_member(node, token);
+	if (node->tag == JSON_ARRAY && pointer_index(node, token, &index))
+		return json_find_element(node, index);
+	return NULL;
+}
+
+/*
+ * Resolve every token of @path but the last, setting *@parent to the
+ * container it names and @token to the last token.  The empty path, which
+ * names the root itself, sets *@parent to NULL.
+ */
+static bool pointer_parent(JsonNode *root, const char *path, JsonNode **parent, SB *token)
+{
+	JsonNode *node = root;
+	
+	*parent = NULL;
+	if (*path == 0)
+		return true;
+	if (*path != '/')
+		return false;
+	
+	for (;;) {
+		path++;
+		if (!pointer_token(&path, token))
+			return false;
+		if (*path == 0)
+			break;
+		node = pointer_child(node, token->start);
+		if (node == NULL)
+			return false;
+	}
+	
+	*parent = node;
+	return node->tag == JSON_OBJECT || node->tag == JSON_ARRAY;
+}
+
+/* The node at @path, or NULL. */
+static JsonNode *pointer_get(JsonNode *root, const char *path, SB *token)
+{
+	JsonNode *parent;
+	
+	if (!pointer_parent(root, path, &parent, token))
+		return NULL;
+	return parent == NULL ? root : pointer_child(parent, token->start);
+}
+
+/* The "add" operation: put @value at @path, consuming it either way. */
+static bool patch_add(JsonNode **root, const char *path, JsonNode *value, SB *token, JsonChangeFn changed, void *ctx)
+{
+	JsonNode *parent, *current;
+	int index;
+	
+	if (!pointer_parent(*root, path, &parent, token)) {
+		json_delete(value);
+		return false;
+	}
+	
+	if (parent == NULL) {
+		replace_node(root, *root, value);
+	} else if (parent->tag == JSON_OBJECT) {
+		current = json_find_member(parent, token->start);
+		if (current != NULL)
+			replace_node(root, current, value);
+		else
+			json_append_member(parent, token->start, value);
+	} else if (pointer_index(parent, token->start, &index)) {
+		insert_node(parent, json_find_element(parent, index), value);
+	} else {
+		json_delete(value);
+		return false;
+	}
+	
+	report(changed, ctx, value);
+	return true;
+}
+
+static bool patch_operation(JsonNode **root, const JsonNode *operation, SB *token, JsonChangeFn changed, void *ctx)
+{
+	const JsonNode *op = json_find_member((JsonNode*) operation, "op");
+	const JsonNode *path = json_find_member((JsonNode*) operation, "path");
+	const JsonNode *from = json_find_member((JsonNode*) operation, "from");
+	const JsonNode *value = json_find_member((JsonNode*) operation, "value");
+	JsonNode *target, *parent;
+	
+	if (op == NULL || op->tag != JSON_STRING || path == NULL || path->tag != JSON_STRING)
+		return false;
+	if (from != NULL && from->tag != JSON_STRING)
+		return false;
+	
+	if (strcmp(op->string_, "add") == 0) {
+		return value != NULL && patch_add(root, path->string_, copy_node(value), token, changed, ctx);
+	} else if (strcmp(op->string_, "remove") == 0) {
+		target = pointer_get(*root, path->string_, token);
+		if (target == NULL || target == *root)
+			return false;
+		parent = target->parent;
+		json_delete(target);
+		report(changed, ctx, parent);
+		return true;
+	} else if (strcmp(op->string_, "replace") == 0) {
+		target = pointer_get(*root, path->string_, token);
+		if (target == NULL || value == NULL)
+			return false;
+		if (!nodes_equal(target, value)) {
+			JsonNode *copy = copy_node(value);
+			
+			replace_node(root, target, copy);
+			report(changed, ctx, copy);
+		}
+		return true;
+	} else if (strcmp(op->string_, "copy") == 0 || strcmp(op->string_, "move") == 0) {
+		bool move = op->string_[0] == 'm';
+		size_t len;
+		
+		if (from == NULL || (target = pointer_get(*root, from->string_, token)) == NULL)
+			return false;
+		if (!move)
+			return patch_add(root, path->string_, copy_node(target), token, changed, ctx);
+		
+		/* A value cannot be moved into itself. */
+		len = strlen(from->string_);
+		if (strncmp(path->string_, from->string_, len) == 0 && path->string_[len] == '/')
+			return false;
+		if (strcmp(path->string_, from->string_) == 0)
+			return true;
+		
+		parent = target->parent;
+		if (parent == NULL)
+			return false;
+		if (target->flags & NODE_ARENA) {
+			/* Arena nodes cannot outlive their document, so move a copy. */
+			JsonNode *copy = copy_node(target);
+			
+			json_delete(target);
+			target = copy;
+		} else {
+			json_remove_from_parent(target);
+		}
+		report(changed, ctx, parent);
+		return patch_add(root, path->string_, target, token, changed, ctx);
+	} else if (strcmp(op->string_, "test") == 0) {
+		target = pointer_get(*root, path->string_, token);
+		return target != NULL && value != NULL && nodes_equal(target, value);
+	}
+	
+	return false;
 }
 
-void json_prepend_element(JsonNode *array, JsonNode *element)
+bool json_patch(JsonNode **root, const JsonNode *patch, JsonChangeFn changed, void *ctx)
 {
-	assert(array->tag == JSON_ARRAY);
-	assert(element->parent == NULL);
+	const JsonNode *operation;
+	bool ok = true;
+	SB token;
 	
-	prepend_node(array, element);
-}
-
-void json_append_member(JsonNode *object, const char *key, JsonNode *value)
-{
-	assert(object->tag == JSON_OBJECT);
-	assert(value->parent == NULL);
+	if (patch == NULL || patch->tag != JSON_ARRAY)
+		return false;
 	
-	append_member(object, json_strdup(key), value);
+	sb_init(&token);
+	json_foreach(operation, patch) {
+		if (operation->tag != JSON_OBJECT || !patch_operation(root, operation, &token, changed, ctx)) {
+			ok = false;
+			break;
+		}
+	}
+	sb_free(&token);
+	return ok;
 }
 
-void json_prepend_member(JsonNode *object, const char *key, JsonNode *value)
+/*** Hashing ***/
+
+static uint64_t hash_mix(uint64_t h)
 {
-	assert(object->tag == JSON_OBJECT);
-	assert(value->parent == NULL);
-	
-	value->key = json_strdup(key);
-	prepend_node(object, value);
+	h ^= h >> 32;
+	h *= 0xD6E8FEB86659FD93ull;
+	h ^= h >> 32;
+	return h;
 }
 
-void json_remove_from_parent(JsonNode *node)
+uint64_t json_hash_text(const char *json)
 {
-	JsonNode *parent = node->parent;
+	const unsigned char *p = (const unsigned char*) json;
+	size_t len = strlen(json);
+	uint64_t h = len * 0x9E3779B97F4A7C15ull;
+	uint64_t w;
 	
-	if (parent != NULL) {
-		if (node->prev != NULL)
-			node->prev->next = node->next;
-		else
-			parent->children.head = node->next;
-		if (node->next != NULL)
-			node->next->prev = node->prev;
-		else
-			parent->children.tail = node->prev;
-		
-		free(node->key);
-		
-		node->parent = NULL;
-		node->prev = node->next = NULL;
-		node->key = NULL;
+	for (; len >= 8; p += 8, len -= 8) {
+		memcpy(&w, p, 8);
+		h = (h ^ w) * 0x9E3779B97F4A7C15ull;
+		h ^= h >> 29;
 	}
+	if (len > 0) {
+		w = 0;
+		memcpy(&w, p, len);
+		h = (h ^ w) * 0x9E3779B97F4A7C15ull;
+	}
+	
+	return hash_mix(h);
 }
 
-static bool parse_value(const char **sp, JsonNode **out)
+static bool parse_value(Decoder *dec, const char **sp, JsonNode **out)
 {
 	const char *s = *sp;
 	
@@ -650,7 +4107,7 @@ static bool parse_value(const char **sp, JsonNode **out)
 		case 'n':
 			if (expect_literal(&s, "null")) {
 				if (out)
-					*out = json_mknull();
+					*out = decoder_mknode(dec, JSON_NULL);
 				*sp = s;
 				return true;
 			}
@@ -658,8 +4115,10 @@ static bool parse_value(const char **sp, JsonNode **out)
 		
 		case 'f':
 			if (expect_literal(&s, "false")) {
-				if (out)
-					*out = json_mkbool(false);
+				if (out) {
+					*out = decoder_mknode(dec, JSON_BOOL);
+					(*out)->bool_ = false;
+				}
 				*sp = s;
 				return true;
 			}
@@ -667,8 +4126,10 @@ static bool parse_value(const char **sp, JsonNode **out)
 		
 		case 't':
 			if (expect_literal(&s, "true")) {
-				if (out)
-					*out = json_mkbool(true);
+				if (out) {
+					*out = decoder_mknode(dec, JSON_BOOL);
+					(*out)->bool_ = true;
+				}
 				*sp = s;
 				return true;
 			}
@@ -676,9 +4137,11 @@ static bool parse_value(const char **sp, JsonNode **out)
 		
 		case '"': {
 			char *str;
-			if (parse_string(&s, out ? &str : NULL)) {
-				if (out)
-					*out = mkstring(str);
+			if (parse_string(dec, &s, out ? &str : NULL, NULL)) {
+				if (out) {
+					*out = decoder_mknode(dec, JSON_STRING);
+					(*out)->string_ = str;
+				}
 				*sp = s;
 				return true;
 			}
@@ -686,24 +4149,30 @@ static bool parse_value(const char **sp, JsonNode **out)
 		}
 		
 		case '[':
-			if (parse_array(&s, out)) {
+			if (parse_array(dec, &s, out)) {
 				*sp = s;
 				return true;
 			}
 			return false;
 		
 		case '{':
-			if (parse_object(&s, out)) {
+			if (parse_object(dec, &s, out)) {
 				*sp = s;
 				return true;
 			}
 			return false;
 		
 		default: {
-			double num;
+			Number num;
 			if (parse_number(&s, out ? &num : NULL)) {
-				if (out)
-					*out = json_mknumber(num);
+				if (out) {
+					*out = decoder_mknode(dec, JSON_NUMBER);
+					(*out)->number_ = num.value;
+					if (num.is_integer) {
+						(*out)->integer_ = num.integer;
+						(*out)->flags |= NODE_INTEGER;
+					}
+				}
 				*sp = s;
 				return true;
 			}
@@ -712,10 +4181,10 @@ static bool parse_value(const char **sp, JsonNode **out)
 	}
 }
 
-static bool parse_array(const char **sp, JsonNode **out)
+static bool parse_array(Decoder *dec, const char **sp, JsonNode **out)
 {
 	const char *s = *sp;
-	JsonNode *ret = out ? json_mkarray() : NULL;
+	JsonNode *ret = out ? decoder_mknode(dec, JSON_ARRAY) : NULL;
 	JsonNode *element;
 	
 	if (*s++ != '[')
@@ -728,7 +4197,7 @@ static bool parse_array(const char **sp, JsonNode **out)
 	}
 	
 	for (;;) {
-		if (!parse_value(&s, out ? &element : NULL))
+		if (!parse_value(dec, &s, out ? &element : NULL))
 			goto failure;
 		skip_space(&s);
 		
@@ -756,11 +4225,12 @@ failure:
 	return false;
 }
 
-static bool parse_object(const char **sp, JsonNode **out)
+static bool parse_object(Decoder *dec, const char **sp, JsonNode **out)
 {
 	const char *s = *sp;
-	JsonNode *ret = out ? json_mkobject() : NULL;
+	JsonNode *ret = out ? decoder_mknode(dec, JSON_OBJECT) : NULL;
 	char *key;
+	bool interned = false;
 	JsonNode *value;
 	
 	if (*s++ != '{')
@@ -773,7 +4243,7 @@ static bool parse_object(const char **sp, JsonNode **out)
 	}
 	
 	for (;;) {
-		if (!parse_string(&s, out ? &key : NULL))
+		if (!parse_string(dec, &s, out ? &key : NULL, out ? &interned : NULL))
 			goto failure;
 		skip_space(&s);
 		
@@ -781,12 +4251,15 @@ static bool parse_object(const char **sp, JsonNode **out)
 			goto failure_free_key;
 		skip_space(&s);
 		
-		if (!parse_value(&s, out ? &value : NULL))
+		if (!parse_value(dec, &s, out ? &value : NULL))
 			goto failure_free_key;
 		skip_space(&s);
 		
-		if (out)
+		if (out) {
 			append_member(ret, key, value);
+			if (interned)
+				value->flags |= NODE_SHARED_KEY | NODE_INTERNED_KEY;
+		}
 		
 		if (*s == '}') {
 			s++;
@@ -805,34 +4278,64 @@ success:
 	return true;
 
 failure_free_key:
-	if (out)
-		free(key);
+	if (out && dec->doc == NULL && !interned)
+		pool_string_free(key);
 failure:
 	json_delete(ret);
 	return false;
 }
 
-bool parse_string(const char **sp, char **out)
+bool parse_string(Decoder *dec, const char **sp, char **out, bool *interned)
 {
 	const char *s = *sp;
 	SB sb;
 	char throwaway_buffer[4];
 		/* enough space for a UTF-8 character */
 	char *b;
+	char *start = NULL;
+	bool insitu = out != NULL && dec->insitu;
 	
 	if (*s++ != '"')
 		return false;
 	
-	if (out) {
-		sb_init(&sb);
+	if (insitu) {
+		/*
+		 * An escape sequence is never shorter than the character it
+		 * stands for, so b never overtakes s and the string can be
+		 * unescaped over itself.
+		 */
+		start = b = (char*) s;
+	} else if (out) {
+		sb = dec->scratch;
+		sb.cur = sb.start;
 		sb_need(&sb, 4);
 		b = sb.cur;
 	} else {
 		b = throwaway_buffer;
 	}
 	
-	while (*s != '"') {
-		unsigned char c = *s++;
+	for (;;) {
+		const char *plain = scan_plain(s);
+		unsigned char c;
+		
+		/* Copy a run of plain ASCII in one go. */
+		if (plain != s) {
+			if (insitu) {
+				if (b != s)
+					memmove(b, s, plain - s);
+				b += plain - s;
+			} else if (out) {
+				sb.cur = b;
+				sb_put(&sb, s, plain - s);
+				sb_need(&sb, 4);
+				b = sb.cur;
+			}
+			s = plain;
+		}
+		
+		if (*s == '"')
+			break;
+		c = *s++;
 		
 		/* Parse next character, and write it to b. */
 		if (c == '\\') {
@@ -906,27 +4409,229 @@ bool parse_string(const char **sp, char **out)
 		 * Update sb to know about the new bytes,
 		 * and set up b to write another character.
 		 */
-		if (out) {
+		if (!out) {
+			b = throwaway_buffer;
+		} else if (!insitu) {
 			sb.cur = b;
 			sb_need(&sb, 4);
 			b = sb.cur;
-		} else {
-			b = throwaway_buffer;
 		}
 	}
 	s++;
 	
-	if (out)
-		*out = sb_finish(&sb);
+	if (insitu) {
+		/* Terminate the string over (or before) its closing quote. */
+		*b = 0;
+		*out = start;
+	} else if (out) {
+		size_t len = sb.cur - sb.start;
+		const char *key = NULL;
+		
+		if (interned != NULL && dec->intern_keys && len <= INTERN_MAX_DECODED_LENGTH)
+			key = intern(sb.start, len, INTERN_MAX_DECODED);
+		
+		if (key != NULL) {
+			*out = (char*) key;
+			*interned = true;
+		} else {
+			*out = decoder_strndup(dec, sb.start, len);
+			if (interned != NULL)
+				*interned = false;
+		}
+		dec->scratch = sb;
+	}
 	*sp = s;
 	return true;
 
 failed:
-	if (out)
-		sb_free(&sb);
+	if (out && !insitu)
+		dec->scratch = sb;
 	return false;
 }
 
+/*
+ * Number conversion
+ *
+ * parse_number collects up to 19 significant digits into a 64-bit mantissa
+ * and turns mantissa * 10^exponent into a double without going through
+ * strtod, which is slow and depends on the locale.
+ */
+
+#define MAX_MANTISSA_DIGITS 19
+
+/* The powers of ten that are exact doubles. */
+static const double exact_pow10[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+/* Returns the low half of a * b, and stores the high half in *hi. */
+static uint64_t mul64(uint64_t a, uint64_t b, uint64_t *hi)
+{
+#if defined(__SIZEOF_INT128__)
+	__extension__ unsigned __int128 r = __extension__ (unsigned __int128) a * b;
+	*hi = (uint64_t) (r >> 64);
+	return (uint64_t) r;
+#else
+	uint64_t a_lo = a & 0xFFFFFFFF, a_hi = a >> 32;
+	uint64_t b_lo = b & 0xFFFFFFFF, b_hi = b >> 32;
+	uint64_t lo_lo = a_lo * b_lo;
+	uint64_t hi_lo = a_hi * b_lo;
+	uint64_t lo_hi = a_lo * b_hi;
+	uint64_t cross = (lo_lo >> 32) + (hi_lo & 0xFFFFFFFF) + lo_hi;
+	*hi = a_hi * b_hi + (hi_lo >> 32) + (cross >> 32);
+	return (cross << 32) | (lo_lo & 0xFFFFFFFF);
+#endif
+}
+
+static int leading_zeros64(uint64_t x)
+{
+#if defined(__GNUC__)
+	return x == 0 ? 64 : __builtin_clzll(x);
+#else
+	int n = 0;
+	if (x == 0)
+		return 64;
+	while (!(x & 0x8000000000000000ULL)) {
+		x <<= 1;
+		n++;
+	}
+	return n;
+#endif
+}
+
+/*
+ * The Eisel-Lemire algorithm: multiply the mantissa by a 128-bit
+ * approximation of 10^exponent, and keep the top 53 bits, rounded.
+ * Returns false in the rare cases where the approximation is not precise
+ * enough to round correctly, or the result is subnormal or out of range.
+ *
+ * See Daniel Lemire, "Number Parsing at a Gigabyte per Second" (2021).
+ */
+static bool eisel_lemire(uint64_t mantissa, int exponent, bool negative, double *out)
+{
+	const uint64_t *pow10;
+	uint64_t x_hi, x_lo, msb, bits;
+	uint64_t ret_mantissa, ret_exp2;
+	int clz;
+	
+	if (mantissa == 0) {
+		*out = negative ? -0.0 : 0.0;
+		return true;
+	}
+	if (exponent < POW10_MIN_EXP10 || exponent > POW10_MAX_EXP10)
+		return false;
+	pow10 = pow10_table[exponent - POW10_MIN_EXP10];
+	
+	/* Normalization.  217706 / 2^16 approximates log2(10). */
+	clz = leading_zeros64(mantissa);
+	mantissa <<= clz;
+	ret_exp2 = (uint64_t) (((217706 * exponent) >> 16) + 64 + 1023) - (uint64_t) clz;
+	
+	/* Multiplication. */
+	x_lo = mul64(mantissa, pow10[0], &x_hi);
+	
+	/* Wider approximation, when the low bits might carry into the result. */
+	if ((x_hi & 0x1FF) == 0x1FF && x_lo + mantissa < mantissa) {
+		uint64_t y_hi, y_lo, merged_hi, merged_lo;
+		
+		y_lo = mul64(mantissa, pow10[1], &y_hi);
+		merged_hi = x_hi;
+		merged_lo = x_lo + y_hi;
+		if (merged_lo < x_lo)
+			merged_hi++;
+		if ((merged_hi & 0x1FF) == 0x1FF && merged_lo + 1 == 0 && y_lo + mantissa < mantissa)
+			return false;
+		x_hi = merged_hi;
+		x_lo = merged_lo;
+	}
+	
+	/* Shift to 54 bits. */
+	msb = x_hi >> 63;
+	ret_mantissa = x_hi >> (msb + 9);
+	ret_exp2 -= 1 ^ msb;
+	
+	/* Halfway between two doubles: cannot tell which way to round. */
+	if (x_lo == 0 && (x_hi & 0x1FF) == 0 && (ret_mantissa & 3) == 1)
+		return false;
+	
+	/* Round to 53 bits. */
+	ret_mantissa += ret_mantissa & 1;
+	ret_mantissa >>= 1;
+	if (ret_mantissa >> 53 > 0) {
+		ret_mantissa >>= 1;
+		ret_exp2++;
+	}
+	
+	/* Subnormal, infinite or NaN. */
+	if (ret_exp2 - 1 >= 0x7FF - 1)
+		return false;
+	
+	bits = ret_exp2 << 52 | (ret_mantissa & 0x000FFFFFFFFFFFFFULL);
+	if (negative)
+		bits |= 0x8000000000000000ULL;
+	memcpy(out, &bits, sizeof(*out));
+	return true;
+}
+
+/* strtod, but with '.' as the decimal point whatever the locale. */
+static double strtod_c(const char *start, const char *end)
+{
+	const char *point = localeconv()->decimal_point;
+	size_t point_len = strlen(point);
+	char *buf, *b;
+	double ret;
+	
+	if (point_len == 1 && *point == '.')
+		return strtod(start, NULL);
+	
+	buf = b = (char*) malloc((end - start) + point_len + 1);
+	if (buf == NULL)
+		out_of_memory();
+	for (; start < end; start++) {
+		if (*start == '.') {
+			memcpy(b, point, point_len);
+			b += point_len;
+		} else {
+			*b++ = *start;
+		}
+	}
+	*b = 0;
+	
+	ret = strtod(buf, NULL);
+	free(buf);
+	return ret;
+}
+
+/*
+ * Returns mantissa * 10^exponent, where the number spans [start, end).
+ * If @truncated, digits were dropped from the mantissa, so the exact value
+ * lies somewhere between mantissa and mantissa + 1.
+ */
+static double number_value(const char *start, const char *end,
+                           uint64_t mantissa, int exponent, bool negative, bool truncated)
+{
+	double ret, upper;
+	
+#if FLT_EVAL_METHOD == 0
+	/* Clinger's fast path: both operands are exact, so the result is too. */
+	if (!truncated && mantissa <= (1ULL << 53) && exponent >= -22 && exponent <= 22) {
+		ret = (double) mantissa;
+		if (exponent < 0)
+			ret /= exact_pow10[-exponent];
+		else
+			ret *= exact_pow10[exponent];
+		return negative ? -ret : ret;
+	}
+#endif
+	
+	if (eisel_lemire(mantissa, exponent, negative, &ret) &&
+	    (!truncated || (eisel_lemire(mantissa + 1, exponent, negative, &upper) && ret == upper)))
+		return ret;
+	
+	return strtod_c(start, end);
+}
+
 /*
  * The JSON spec says that a number shall follow this precise pattern
  * (spaces and quotes added for readability):
@@ -937,13 +4642,21 @@ failed:
  *
  * This function takes the strict approach.
  */
-bool parse_number(const char **sp, double *out)
+bool parse_number(const char **sp, Number *out)
 {
 	const char *s = *sp;
+	bool negative = false;
+	bool is_integer = true;
+	bool truncated = false;
+	uint64_t mantissa = 0;
+	int digits = 0;
+	int exponent = 0;
 
 	/* '-'? */
-	if (*s == '-')
+	if (*s == '-') {
+		negative = true;
 		s++;
+	}
 
 	/* (0 | [1-9][0-9]*) */
 	if (*s == '0') {
@@ -952,6 +4665,13 @@ bool parse_number(const char **sp, double *out)
 		if (!is_digit(*s))
 			return false;
 		do {
+			if (digits < MAX_MANTISSA_DIGITS) {
+				mantissa = mantissa * 10 + (*s - '0');
+				digits++;
+			} else {
+				truncated |= *s != '0';
+				exponent++;
+			}
 			s++;
 		} while (is_digit(*s));
 	}
@@ -961,25 +4681,48 @@ bool parse_number(const char **sp, double *out)
 		s++;
 		if (!is_digit(*s))
 			return false;
+		is_integer = false;
 		do {
+			if (digits < MAX_MANTISSA_DIGITS) {
+				mantissa = mantissa * 10 + (*s - '0');
+				exponent--;
+				/* Leading zeros are not significant. */
+				if (mantissa != 0)
+					digits++;
+			} else {
+				truncated |= *s != '0';
+			}
 			s++;
 		} while (is_digit(*s));
 	}
 
 	/* ([Ee] [+-]? [0-9]+)? */
 	if (*s == 'E' || *s == 'e') {
+		bool negative_exponent = false;
+		int e = 0;
+
 		s++;
 		if (*s == '+' || *s == '-')
-			s++;
+			negative_exponent = *s++ == '-';
 		if (!is_digit(*s))
 			return false;
+		is_integer = false;
 		do {
+			/* Beyond this, the number is zero or infinite anyway. */
+			if (e < 100000)
+				e = e * 10 + (*s - '0');
 			s++;
 		} while (is_digit(*s));
+		exponent += negative_exponent ? -e : e;
 	}
 
-	if (out)
-		*out = strtod(*sp, NULL);
+	if (out) {
+		out->value = number_value(*sp, s, mantissa, exponent, negative, truncated);
+		out->is_integer = is_integer && exponent == 0 &&
+			mantissa <= (negative ? (uint64_t) INT64_MAX + 1 : (uint64_t) INT64_MAX);
+		if (out->is_integer)
+			out->integer = negative && mantissa != 0 ? -(int64_t) (mantissa - 1) - 1 : (int64_t) mantissa;
+	}
 
 	*sp = s;
 	return true;
@@ -1007,7 +4750,7 @@ static void emit_value(SB *out, const JsonNode *node)
 			emit_string(out, node->string_);
 			break;
 		case JSON_NUMBER:
-			emit_number(out, node->number_);
+			emit_number(out, node);
 			break;
 		case JSON_ARRAY:
 			emit_array(out, node);
@@ -1034,7 +4777,7 @@ void emit_value_indented(SB *out, const JsonNode *node, const char *space, int i
 			emit_string(out, node->string_);
 			break;
 		case JSON_NUMBER:
-			emit_number(out, node->number_);
+			emit_number(out, node);
 			break;
 		case JSON_ARRAY:
 			emit_array_indented(out, node, space, indent_level);
@@ -1133,16 +4876,27 @@ void emit_string(SB *out, const char *str)
 	
 	assert(utf8_validate(str));
 	
-	/*
-	 * 14 bytes is enough space to write up to two
-	 * \uXXXX escapes and two quotation marks.
-	 */
-	sb_need(out, 14);
-	b = out->cur;
-	
-	*b++ = '"';
-	while (*s != 0) {
-		unsigned char c = *s++;
+	sb_putc(out, '"');
+	for (;;) {
+		const char *plain = scan_plain(s);
+		unsigned char c;
+		
+		/* Copy a run that needs no escaping in one go. */
+		if (plain != s) {
+			sb_put(out, s, plain - s);
+			s = plain;
+		}
+		
+		c = *s++;
+		if (c == 0)
+			break;
+		
+		/*
+		 * 12 bytes is enough space to write up to two
+		 * \uXXXX escapes.
+		 */
+		sb_need(out, 12);
+		b = out->cur;
 		
 		/* Encode the next character, and write it to b. */
 		switch (c) {
@@ -1230,45 +4984,296 @@ void emit_string(SB *out, const char *str)
 				break;
 			}
 		}
-	
-		/*
-		 * Update *out to know about the new bytes,
-		 * and set up b to write another encoded character.
-		 */
+		
 		out->cur = b;
-		sb_need(out, 14);
-		b = out->cur;
 	}
-	*b++ = '"';
+	sb_putc(out, '"');
+}
+
+/*
+ * Number formatting
+ *
+ * Doubles are printed with the fewest digits that read back as the same
+ * double, using Florian Loitsch's Grisu2 algorithm ("Printing Floating-Point
+ * Numbers Quickly and Accurately with Integers", 2010).  The layout follows
+ * JavaScript's Number.prototype.toString, so the webview sees what
+ * JSON.stringify would have produced.
+ */
+
+/* A floating point number f * 2^e with a 64-bit significand. */
+typedef struct
+{
+	uint64_t f;
+	int e;
+} DiyFp;
+
+/* Grisu2 needs products with a binary exponent in [-60, -32]. */
+#define GRISU_ALPHA (-60)
+
+static const char digit_pairs[] =
+	"00010203040506070809"
+	"10111213141516171819"
+	"20212223242526272829"
+	"30313233343536373839"
+	"40414243444546474849"
+	"50515253545556575859"
+	"60616263646566676869"
+	"70717273747576777879"
+	"80818283848586878889"
+	"90919293949596979899";
+
+/* Writes the digits of @n to @out, and returns how many there are. */
+static int write_uint64(char *out, uint64_t n)
+{
+	char buf[20];
+	char *p = buf + sizeof(buf);
+	int len;
+	
+	while (n >= 100) {
+		p -= 2;
+		memcpy(p, &digit_pairs[(n % 100) * 2], 2);
+		n /= 100;
+	}
+	if (n >= 10) {
+		p -= 2;
+		memcpy(p, &digit_pairs[n * 2], 2);
+	} else {
+		*--p = (char) ('0' + n);
+	}
 	
-	out->cur = b;
+	len = (int) (buf + sizeof(buf) - p);
+	memcpy(out, p, len);
+	return len;
 }
 
-static void emit_number(SB *out, double num)
+/* Returns x * y, rounded to 64 bits. */
+static DiyFp diyfp_mul(DiyFp x, DiyFp y)
 {
-	/*
-	 * This isn't exactly how JavaScript renders numbers,
-	 * but it should produce valid JSON for reasonable numbers
-	 * preserve precision well enough, and avoid some oddities
-	 * like 0.3 -> 0.299999999999999988898 .
-	 */
-	char buf[64];
-	sprintf(buf, "%.16g", num);
+	DiyFp ret;
+	uint64_t hi, lo = mul64(x.f, y.f, &hi);
 	
-	if (number_is_valid(buf))
-		sb_puts(out, buf);
-	else
-		sb_puts(out, "null");
+	ret.f = hi + (lo >> 63);
+	ret.e = x.e + y.e + 64;
+	return ret;
 }
 
-static bool tag_is_valid(unsigned int tag)
+static DiyFp diyfp_normalize(DiyFp x)
 {
-	return (/* tag >= JSON_NULL && */ tag <= JSON_OBJECT);
+	int shift = leading_zeros64(x.f);
+	x.f <<= shift;
+	x.e -= shift;
+	return x;
+}
+
+/*
+ * Splits @v into a normalized DiyFp, and the boundaries halfway to its
+ * neighbours, normalized to the same exponent as the upper one.
+ */
+static void diyfp_boundaries(double v, DiyFp *w, DiyFp *w_minus, DiyFp *w_plus)
+{
+	uint64_t bits, fraction;
+	int biased_exponent;
+	DiyFp x, m_minus, m_plus;
+	
+	memcpy(&bits, &v, sizeof(bits));
+	fraction = bits & 0x000FFFFFFFFFFFFFULL;
+	biased_exponent = (int) (bits >> 52 & 0x7FF);
+	
+	if (biased_exponent == 0) {
+		/* Subnormal */
+		x.f = fraction;
+		x.e = 1 - 1075;
+	} else {
+		x.f = fraction | 0x0010000000000000ULL;
+		x.e = biased_exponent - 1075;
+	}
+	
+	m_plus.f = 2 * x.f + 1;
+	m_plus.e = x.e - 1;
+	
+	/* The gap below a power of two is half the gap above it. */
+	if (fraction == 0 && biased_exponent > 1) {
+		m_minus.f = 4 * x.f - 1;
+		m_minus.e = x.e - 2;
+	} else {
+		m_minus.f = 2 * x.f - 1;
+		m_minus.e = x.e - 1;
+	}
+	
+	*w = diyfp_normalize(x);
+	*w_plus = diyfp_normalize(m_plus);
+	w_minus->f = m_minus.f << (m_minus.e - w_plus->e);
+	w_minus->e = w_plus->e;
+}
+
+/* Returns a power of ten c = 10^*k such that GRISU_ALPHA <= c.e + e + 64 <= GRISU_ALPHA + 3. */
+static DiyFp cached_power(int e, int *k)
+{
+	const uint64_t *pow10;
+	DiyFp c;
+	int f = GRISU_ALPHA - e - 1;
+	
+	/* ceil(f * log10(2)) */
+	*k = (f * 78913) / (1 << 18) + (f > 0);
+	pow10 = pow10_table[*k - POW10_MIN_EXP10];
+	
+	/* Round the 128-bit table entry to 64 bits.  floor(k * log2(10)) - 63 */
+	c.f = pow10[0] + (pow10[1] >> 63);
+	c.e = ((217706 * *k) >> 16) - 63;
+	return c;
+}
+
+/* Nudge the last digit towards w while the result stays within the boundaries. */
+static void grisu_round(char *buf, int len, uint64_t dist, uint64_t delta,
+                        uint64_t rest, uint64_t ten_k)
+{
+	while (rest < dist && delta - rest >= ten_k &&
+	       (rest + ten_k < dist || dist - rest > rest + ten_k - dist)) {
+		buf[len - 1]--;
+		rest += ten_k;
+	}
+}
+
+/*
+ * Writes the shortest digits of a finite, positive @v to @buf, and returns
+ * how many there are.  The value is digits * 10^*exponent.
+ */
+static int grisu2(char *buf, double v, int *exponent)
+{
+	DiyFp w, w_minus, w_plus, c, one;
+	uint64_t delta, dist, p2, rest;
+	uint32_t p1, pow10;
+	int k, digits, len = 0;
+	
+	diyfp_boundaries(v, &w, &w_minus, &w_plus);
+	c = cached_power(w_plus.e, &k);
+	
+	w = diyfp_mul(w, c);
+	w_minus = diyfp_mul(w_minus, c);
+	w_plus = diyfp_mul(w_plus, c);
+	
+	/* Stay strictly inside the boundaries, whatever the rounding above did. */
+	w_minus.f++;
+	w_plus.f--;
+	*exponent = -k;
+	
+	delta = w_plus.f - w_minus.f;
+	dist = w_plus.f - w.f;
+	
+	/* Split w_plus into integral (p1) and fractional (p2) parts. */
+	one.e = w_plus.e;
+	one.f = (uint64_t) 1 << -one.e;
+	p1 = (uint32_t) (w_plus.f >> -one.e);
+	p2 = w_plus.f & (one.f - 1);
+	
+	for (digits = 1, pow10 = 1; digits < 10 && p1 / pow10 >= 10; digits++)
+		pow10 *= 10;
+	
+	while (digits > 0) {
+		buf[len++] = (char) ('0' + p1 / pow10);
+		p1 %= pow10;
+		digits--;
+		
+		rest = ((uint64_t) p1 << -one.e) + p2;
+		if (rest <= delta) {
+			*exponent += digits;
+			grisu_round(buf, len, dist, delta, rest, (uint64_t) pow10 << -one.e);
+			return len;
+		}
+		pow10 /= 10;
+	}
+	
+	for (;;) {
+		p2 *= 10;
+		delta *= 10;
+		dist *= 10;
+		buf[len++] = (char) ('0' + (p2 >> -one.e));
+		p2 &= one.f - 1;
+		(*exponent)--;
+		if (p2 <= delta)
+			break;
+	}
+	grisu_round(buf, len, dist, delta, p2, one.f);
+	return len;
+}
+
+/*
+ * Lays out digits * 10^exponent the way JavaScript does: plain decimals
+ * from 1e-7 up to 1e21, exponential notation outside that range.
+ */
+static int format_decimal(char *out, const char *digits, int len, int exponent)
+{
+	/* Position of the decimal point relative to the first digit. */
+	int point = len + exponent;
+	char *p = out;
+	
+	if (len <= point && point <= 21) {
+		memcpy(p, digits, len);
+		memset(p + len, '0', point - len);
+		p += point;
+	} else if (0 < point && point <= 21) {
+		memcpy(p, digits, point);
+		p[point] = '.';
+		memcpy(p + point + 1, digits + point, len - point);
+		p += len + 1;
+	} else if (-6 < point && point <= 0) {
+		*p++ = '0';
+		*p++ = '.';
+		memset(p, '0', -point);
+		p += -point;
+		memcpy(p, digits, len);
+		p += len;
+	} else {
+		*p++ = digits[0];
+		if (len > 1) {
+			*p++ = '.';
+			memcpy(p, digits + 1, len - 1);
+			p += len - 1;
+		}
+		*p++ = 'e';
+		*p++ = point - 1 < 0 ? '-' : '+';
+		p += write_uint64(p, point - 1 < 0 ? 1 - point : point - 1);
+	}
+	
+	return (int) (p - out);
+}
+
+static void emit_number(SB *out, const JsonNode *node)
+{
+	double num = node->number_;
+	int64_t integer;
+	char digits[32];
+	int len, exponent;
+	
+	sb_need(out, 32);
+	
+	if (json_get_int64(node, &integer)) {
+		if (integer < 0) {
+			*out->cur++ = '-';
+			out->cur += write_uint64(out->cur, 0 - (uint64_t) integer);
+		} else {
+			out->cur += write_uint64(out->cur, (uint64_t) integer);
+		}
+		return;
+	}
+	
+	/* Infinities and NaN have no JSON representation. */
+	if (!(num - num == 0)) {
+		sb_puts(out, "null");
+		return;
+	}
+	
+	if (num < 0) {
+		*out->cur++ = '-';
+		num = -num;
+	}
+	len = grisu2(digits, num, &exponent);
+	out->cur += format_decimal(out->cur, digits, len, exponent);
 }
 
-static bool number_is_valid(const char *num)
+static bool tag_is_valid(unsigned int tag)
 {
-	return (parse_number(&num, NULL) && *num == '\0');
+	return (/* tag >= JSON_NULL && */ tag <= JSON_OBJECT);
 }
 
 static bool expect_literal(const char **sp, const char *str)
@@ -1363,9 +5368,12 @@ bool json_check(const JsonNode *node, char errmsg[256])
 				problem("tail is NULL, but head is not");
 			if (tail != NULL)
 				problem("head is NULL, but tail is not");
+			if (node->children.length != 0)
+				problem("length (%d) of an empty node is not 0", node->children.length);
 		} else {
 			JsonNode *child;
 			JsonNode *last = NULL;
+			int length = 0;
 			
 			if (head->prev != NULL)
 				problem("First child's prev pointer is not NULL");
@@ -1390,11 +5398,18 @@ bool json_check(const JsonNode *node, char errmsg[256])
 				
 				if (!json_check(child, errmsg))
 					return false;
+				
+				length++;
 			}
 			
 			if (last != tail)
 				problem("tail does not match pointer found by starting at head and following next links");
+			if (length != node->children.length)
+				problem("length (%d) does not match the number of children (%d)", node->children.length, length);
 		}
+		
+		if (!index_matches(node))
+			problem("index does not match the children");
 	}
 	
 	return true;
@@ -28,6 +28,7 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
 typedef enum {
 	JSON_NULL,
@@ -39,6 +40,7 @@ typedef enum {
 } JsonTag;
 
 typedef struct JsonNode JsonNode;
+typedef struct JsonIndex JsonIndex;
 
 struct JsonNode
 {
@@ -50,6 +52,10 @@ struct JsonNode
 	char *key; /* Must be valid UTF-8. */
 	
 	JsonTag tag;
+	
+	/* Ownership bookkeeping, private to json.c. */
+	unsigned short flags;
+	
 	union {
 		/* JSON_BOOL */
 		bool bool_;
@@ -58,38 +64,310 @@ struct JsonNode
 		char *string_; /* Must be valid UTF-8. */
 		
 		/* JSON_NUMBER */
-		double number_;
+		struct {
+			double number_;
+			
+			/* Exact value of integers, private to json.c (see json_get_int64). */
+			int64_t integer_;
+		};
 		
 		/* JSON_ARRAY */
 		/* JSON_OBJECT */
 		struct {
 			JsonNode *head, *tail;
+			
+			/* Number of children. */
+			int length;
+			
+			/* Lookup index, private to json.c (may be NULL). */
+			JsonIndex *index;
 		} children;
 	};
 };
 
 /*** Encoding, decoding, and validation ***/
 
+/* Receives encoded text in chunks; return false to stop. */
+typedef bool (*JsonWriteFn)(const char *data, size_t length, void *ctx);
+
 JsonNode   *json_decode         (const char *json);
+JsonNode   *json_decode_arena   (const char *json);
+JsonNode   *json_decode_insitu  (char *json);
 char       *json_encode         (const JsonNode *node);
 char       *json_encode_string  (const char *str);
 char       *json_stringify      (const JsonNode *node, const char *space);
+size_t      json_encoded_length (const JsonNode *node);
+size_t      json_encode_into    (const JsonNode *node, char *buf, size_t size);
+bool        json_write          (const JsonNode *node, JsonWriteFn write, void *ctx, const char *space);
+bool        json_file_writer    (const char *data, size_t length, void *file);
 void        json_delete         (JsonNode *node);
 
 bool        json_validate       (const char *json);
 
+/*
+ * json_decode_arena parses like json_decode, but carves every node, key and
+ * string of the document out of one growable arena.  Calling json_delete on
+ * the returned root releases the whole document at once; calling it on any
+ * other node of the document only unlinks that node, and frees whatever
+ * json_mk* nodes were attached below it.
+ *
+ * Nodes of an arena document must not outlive it, so do not move them into
+ * another document.  Nodes made with json_mk* may be attached to it freely.
+ *
+ * json_decode_insitu builds an arena document too, but does not copy strings
+ * at all: they are unescaped in place, and the keys and string_ of its nodes
+ * point into @json.  The buffer is borrowed, not owned, so it must stay
+ * alive and unmodified until the document is deleted, and json_delete leaves
+ * it alone.  Its contents are unspecified after a failed parse.
+ */
+
+/*
+ * json_write streams the text json_stringify would return to @write, at
+ * most 4 KB at a time, so the whole encoding is never held in memory.
+ * @write is called with @ctx until it returns false, after which the rest
+ * is dropped and json_write returns false.  json_file_writer is a
+ * JsonWriteFn for a FILE *, such as stdout.
+ */
+
+/*
+ * json_encode_into writes the same text as json_encode to @buf, with the
+ * semantics of snprintf: at most @size - 1 bytes and a NUL terminator are
+ * written, and the full length of the encoding is returned, so a result
+ * >= @size means the output was truncated.  It does not allocate.
+ * json_encoded_length returns that length without writing anything.
+ */
+
+/*** Streaming ***/
+
+typedef struct JsonParser JsonParser;
+
+/*
+ * Events reported by a streaming parser, in document order.  Strings and
+ * keys are unescaped and NUL-terminated, but only valid during the call.
+ * Returning false stops the parse, which then fails.  Callbacks may be NULL.
+ */
+typedef struct
+{
+	bool (*null_value)   (void *ctx);
+	bool (*bool_value)   (void *ctx, bool b);
+	bool (*number)       (void *ctx, double n);
+	bool (*string)       (void *ctx, const char *str);
+	bool (*key)          (void *ctx, const char *key);
+	bool (*start_object) (void *ctx);
+	bool (*end_object)   (void *ctx);
+	bool (*start_array)  (void *ctx);
+	bool (*end_array)    (void *ctx);
+} JsonCallbacks;
+
+JsonParser *json_parser_new     (const JsonCallbacks *callbacks, void *ctx);
+bool        json_parser_feed    (JsonParser *parser, const char *buf, size_t len);
+bool        json_parser_finish  (JsonParser *parser, JsonNode **root);
+
+/*
+ * A streaming parser accepts a document in chunks of any size, which need
+ * not be NUL-terminated, and reports events as soon as the input allows.
+ * json_parser_feed returns false once the input so far cannot be the start
+ * of a JSON value.
+ *
+ * json_parser_finish ends the input, frees the parser and returns whether
+ * it was exactly one JSON value.  Without callbacks the parser builds the
+ * same tree json_decode would, which is stored in *root on success.
+ */
+
+/*** Tape ***/
+
+typedef struct JsonTape JsonTape;
+
+/* A value in a tape.  Cursors are plain values and need no freeing. */
+typedef struct
+{
+	const JsonTape *tape;
+	size_t index;
+} JsonCursor;
+
+JsonTape   *json_tape_parse     (const char *json);
+void        json_tape_free      (JsonTape *tape);
+
+JsonCursor  json_tape_root      (const JsonTape *tape);
+bool        json_tape_find      (JsonCursor object, const char *key, JsonCursor *out);
+bool        json_tape_first     (JsonCursor container, JsonCursor *out);
+bool        json_tape_next      (JsonCursor *cursor);
+
+JsonTag     json_tape_tag       (JsonCursor cursor);
+int         json_tape_length    (JsonCursor container);
+const char *json_tape_key       (JsonCursor cursor);
+const char *json_tape_string    (JsonCursor cursor);
+double      json_tape_number    (JsonCursor cursor);
+bool        json_tape_int64     (JsonCursor cursor, int64_t *out);
+bool        json_tape_bool      (JsonCursor cursor);
+
+/*
+ * json_tape_parse accepts the same documents as json_decode, but instead of
+ * a node per value it builds a flat array of words and one buffer of
+ * unescaped strings, so it makes a handful of allocations whatever the size
+ * of the document.  It suits code that reads a few fields and throws the
+ * rest away.  The tape does not refer to @json once it has been built.
+ *
+ * Cursors are read-only and never allocate.  json_tape_next moves to the
+ * next sibling, skipping a whole array or object in one step, and returns
+ * false at the end of the container; json_tape_find only visits the keys of
+ * an object.  json_tape_key is the key of an object member, or NULL.
+ * Strings stay valid until the tape is freed.  Accessors that are given a
+ * value of the wrong type return NULL, 0, false or -1.
+ */
+
+/*** Compact documents ***/
+
+typedef struct JsonCompact JsonCompact;
+typedef struct JsonCompactNode JsonCompactNode;
+
+JsonCompact *json_compact_decode        (const char *json);
+JsonCompact *json_compact_from_node     (const JsonNode *node);
+void         json_compact_free          (JsonCompact *doc);
+size_t       json_compact_size          (const JsonCompact *doc);
+
+const JsonCompactNode *json_compact_root            (const JsonCompact *doc);
+const JsonCompactNode *json_compact_first_child     (const JsonCompactNode *node);
+const JsonCompactNode *json_compact_next            (const JsonCompactNode *node);
+const JsonCompactNode *json_compact_find_element    (const JsonCompactNode *array, int index);
+const JsonCompactNode *json_compact_find_member     (const JsonCompactNode *object, const char *key);
+
+JsonTag      json_compact_tag           (const JsonCompactNode *node);
+const char  *json_compact_key           (const JsonCompactNode *node);
+const char  *json_compact_string        (const JsonCompactNode *node);
+double       json_compact_number        (const JsonCompactNode *node);
+bool         json_compact_int64         (const JsonCompactNode *node, int64_t *out);
+bool         json_compact_bool          (const JsonCompactNode *node);
+int          json_compact_length        (const JsonCompactNode *node);
+
+JsonNode    *json_compact_to_node       (const JsonCompactNode *node);
+
+/*
+ * A compact document holds an immutable copy of a tree in a single block,
+ * at 16 bytes a value instead of a JsonNode each.  The children of a
+ * container are stored next to each other, so walking or indexing them
+ * stays in cache, and short strings are stored in the value itself.
+ * It suits documents that are built once and read many times.
+ *
+ * It is a separate read-only format, not a view of a JsonNode tree: the
+ * json_* accessors, and code built on them such as json_extract and the
+ * menu readers, cannot read it.  The json_compact_* accessors mirror the
+ * json_* ones of the same name instead, and return NULL, 0, false or -1
+ * for values of the wrong type.  json_compact_to_node copies a value back
+ * into a regular tree for code that needs JsonNode.  json_compact_size is
+ * the size of the block.
+ */
+
+#define json_compact_foreach(i, object_or_array)            \
+	for ((i) = json_compact_first_child(object_or_array);   \
+		 (i) != NULL;                                       \
+		 (i) = json_compact_next(i))
+
+/*** Node pool ***/
+
+/* Counters of the calling thread's pool. */
+typedef struct
+{
+	size_t node_hits, node_misses;
+	size_t string_hits, string_misses;
+	
+	/* Nodes and strings waiting in the pool to be reused. */
+	size_t nodes_cached, strings_cached;
+} JsonPoolStats;
+
+void        json_pool_stats     (JsonPoolStats *out);
+void        json_pool_trim      (void);
+
+/*
+ * Nodes made by json_decode and json_mk*, and the strings of up to 31 bytes
+ * that they own, are recycled through a pool private to each thread
+ * instead of going back to the system allocator, so decoding small
+ * documents over and over stops calling malloc and free.  Each thread keeps
+ * at most 1024 nodes and 1024 strings, and they are freed when it exits.
+ * json_pool_trim frees them earlier.  Building with JSON_NO_POOL turns the
+ * pool off, which helps tools that track every allocation.
+ */
+
 /*** Lookup and traversal ***/
 
 JsonNode   *json_find_element   (JsonNode *array, int index);
 JsonNode   *json_find_member    (JsonNode *object, const char *key);
+JsonNode   *json_find_member_interned (JsonNode *object, const char *key);
+void        json_index_members  (JsonNode *object);
+void        json_index_elements (JsonNode *array);
 
 JsonNode   *json_first_child    (const JsonNode *node);
 
+bool        json_get_int64      (const JsonNode *node, int64_t *out);
+
+const char *json_intern         (const char *key);
+
+/*
+ * json_find_member builds a hash index of an object's members once a lookup
+ * has had to walk past more than a few of them, so repeated lookups in large
+ * objects are O(1).  json_find_element does the same for arrays with an
+ * array of element pointers.  json_index_members and json_index_elements
+ * build the index up front.  None of these are safe to call on the same
+ * node from several threads at once.
+ *
+ * json_intern returns the process-wide copy of @key, which is never freed,
+ * and is safe to call from any thread.  json_decode shares the keys of the
+ * objects it builds through the same table, up to a few thousand keys of at
+ * most 32 bytes, and copies any others as before.  The arena decoders copy
+ * keys into the document, which is cheaper than looking them up.
+ * json_find_member_interned takes a key returned by json_intern and compares
+ * it to member keys by pointer before falling back to strcmp, so it finds
+ * the same members as json_find_member for any key, only faster for
+ * interned ones.
+ *
+ * json_get_int64 stores the value of a JSON_NUMBER in *out if it is an
+ * integer that fits in 64 bits.  Integers read by the decoders are exact
+ * even beyond 2^53, where number_ has already been rounded; other numbers
+ * only qualify up to 2^53.
+ */
+
 #define json_foreach(i, object_or_array)            \
 	for ((i) = json_first_child(object_or_array);   \
 		 (i) != NULL;                               \
 		 (i) = (i)->next)
 
+/*** Schemas ***/
+
+#define JSON_SCHEMA_MAX_KEYS 32
+
+/* A fixed set of keys to read from objects.  Declare it with JSON_SCHEMA. */
+typedef struct
+{
+	const char *const *keys;
+	int count;
+	
+	/* Filled in on first use, private to json.c. */
+	int ready;
+	const char *interned[JSON_SCHEMA_MAX_KEYS];
+	uint32_t hashes[JSON_SCHEMA_MAX_KEYS];
+	unsigned char slots[2 * JSON_SCHEMA_MAX_KEYS];
+} JsonSchema;
+
+#define JSON_SCHEMA(key_array) { .keys = (key_array), .count = (int) (sizeof(key_array) / sizeof((key_array)[0])) }
+
+int         json_extract        (JsonSchema *schema, const JsonNode *object, JsonNode **fields);
+
+/*
+ * json_extract looks up every key of @schema in @object in a single pass
+ * over its members, instead of one json_find_member call per key.  It
+ * stores the member for schema->keys[i] in fields[i], or NULL if there is
+ * none, and returns how many it found, or -1 if @object is not an object.
+ * The keys are hashed and interned the first time the schema is used, so
+ * a schema is best declared static, and it is safe to share between
+ * threads.  It may have up to JSON_SCHEMA_MAX_KEYS keys, without repeats.
+ *
+ *     static const char *const keys[] = {"ID", "Label"};
+ *     static JsonSchema schema = JSON_SCHEMA(keys);
+ *     JsonNode *fields[2];
+ *
+ *     json_extract(&schema, object, fields);
+ */
+
 /*** Construction and manipulation ***/
 
 JsonNode *json_mknull(void);
@@ -106,6 +384,41 @@ void json_prepend_member(JsonNode *object, const char *key, JsonNode *value);
 
 void json_remove_from_parent(JsonNode *node);
 
+/*** Patching ***/
+
+typedef void (*JsonChangeFn)(JsonNode *node, void *ctx);
+
+void json_merge_patch(JsonNode **root, const JsonNode *patch, JsonChangeFn changed, void *ctx);
+bool json_patch(JsonNode **root, const JsonNode *patch, JsonChangeFn changed, void *ctx);
+
+/*
+ * Apply a small update to a tree in place, so that changing one checkbox
+ * does not mean decoding the whole menu again.  json_merge_patch applies
+ * an RFC 7396 merge patch, and json_patch the operations of an RFC 6902
+ * JSON patch, returning false if the patch is malformed, an operation
+ * fails or a "test" does not hold.  The operations before a failed one
+ * stay applied, so callers should fall back to sending the whole tree.
+ *
+ * *@root may be replaced, and the old root deleted.  @patch is only read.
+ * If @changed is not NULL it is called with every value that was added or
+ * replaced, and with every container that lost a member or element.
+ * Values equal to the ones they would replace are left alone and not
+ * reported.  A node reported early may be deleted by a later operation of
+ * the same patch.
+ */
+
+/*** Hashing ***/
+
+uint64_t json_hash_text(const char *json);
+
+/*
+ * A 64-bit hash of the text of a document, byte for byte, for telling
+ * whether a document that is sent again has changed without decoding it.
+ * Go marshals the same value to the same text, so equal hashes mean the
+ * same menu.  It is fast, not cryptographic, so it is no defence against
+ * documents crafted to collide.
+ */
+
 /*** Debugging ***/
 
 /*
@@ -117,6 +430,7 @@ void json_remove_from_parent(JsonNode *node);
 bool json_check(const JsonNode *node, char errmsg[256]);
 
 // Added by Lea Anthony 28/11/2020
+// Returns the number of elements in O(1), or -1 if array is not an array
 int json_array_length(JsonNode *array);
 
 #endif
\ No newline at end of file
@@ -32,6 +32,7 @@ Menu* NewMenu(JsonNode *menuData) {
     // Init other members
     result->menu = NULL;
     result->parentData = NULL;
+    result->hash = 0;
 
     return result;
 }
@@ -47,6 +48,7 @@ Menu* NewApplicationMenu(const char *menuAsJSON) {
 
     Menu *result = NewMenu(processedMenu);
     result->menuType = ApplicationMenuType;
+    result->hash = json_hash_text(menuAsJSON);
     return result;
 }
 
@@ -95,8 +97,29 @@ void DeleteMenu(Menu *menu) {
     free(menu);
 }
 
-// Creates a JSON message for the given menuItemID and data
-const char* createMenuClickedMessage(const char *menuItemID, const char *data, enum MenuType menuType, const char *parentID) {
+bool MenuBuiltFrom(Menu *menu, uint64_t hash) {
+    return hash != 0 && __atomic_load_n(&menu->hash, __ATOMIC_ACQUIRE) == hash;
+}
+
+void MarkMenuChanged(Menu *menu) {
+    __atomic_store_n(&menu->hash, 0, __ATOMIC_RELEASE);
+}
+
+// Menus are updated from more than one thread, so the counter is atomic
+static unsigned long skippedMenuRebuilds = 0;
+
+void CountSkippedMenuRebuild() {
+    __atomic_add_fetch(&skippedMenuRebuilds, 1, __ATOMIC_RELAXED);
+}
+
+unsigned long SkippedMenuRebuilds() {
+    return __atomic_load_n(&skippedMenuRebuilds, __ATOMIC_RELAXED);
+}
+
+// Creates a JSON message for the given menuItemID and data.
+// The message is written to buffer if it fits, otherwise it is allocated
+// and must be freed by the caller.
+const char* createMenuClickedMessage(char *buffer, size_t bufferSize, const char *menuItemID, const char *data, enum MenuType menuType, const char *parentID) {
 
     JsonNode *jsonObject = json_mkobject();
     if (menuItemID == NULL ) {
@@ -110,10 +133,17 @@ const char* createMenuClickedMessage(const char *menuItemID, const char *data, e
     if (parentID != NULL) {
         json_append_member(jsonObject, "parentID", json_mkstring(parentID));
     }
-    const char *payload = json_encode(jsonObject);
+
+    // "MC" + payload
+    char *result = buffer;
+    size_t length = json_encode_into(jsonObject, buffer + 2, bufferSize - 2);
+    if( length + 2 >= bufferSize ) {
+        result = malloc(length + 3);
+        json_encode_into(jsonObject, result + 2, length + 1);
+    }
+    result[0] = 'M';
+    result[1] = 'C';
     json_delete(jsonObject);
-    const char *result = concat("MC", payload);
-    MEMFREE(payload);
     return result;
 }
 
@@ -121,12 +151,15 @@ const char* createMenuClickedMessage(const char *menuItemID, const char *data, e
 void menuItemCallback(id self, SEL cmd, id sender) {
     MenuItemCallbackData *callbackData = (MenuItemCallbackData *)msg_reg(msg_reg(sender, s("representedObject")), s("pointerValue"));
     const char *message;
+    char messageBuffer[512];
 
     // Update checkbox / radio item
     if( callbackData->menuItemType == Checkbox) {
         // Toggle state
         bool state = msg_reg(callbackData->menuItem, s("state"));
         msg_int(callbackData->menuItem, s("setState:"), (state? NSControlStateValueOff : NSControlStateValueOn));
+        // The menu no longer matches its JSON, so resending that must rebuild it
+        MarkMenuChanged(callbackData->menu);
     } else if( callbackData->menuItemType == Radio ) {
         // Check the menu items' current state
         bool selected = (bool)msg_reg(callbackData->menuItem, s("state"));
@@ -148,6 +181,7 @@ void menuItemCallback(id self, SEL cmd, id sender) {
 
         // check the selected menu item
         msg_int(callbackData->menuItem, s("setState:"), NSControlStateValueOn);
+        MarkMenuChanged(callbackData->menu);
     }
 
     const char *menuID = callbackData->menuID;
@@ -165,11 +199,13 @@ void menuItemCallback(id self, SEL cmd, id sender) {
         parentID = (const char*) callbackData->menu->parentData;
     }
 
-    message = createMenuClickedMessage(menuID, data, menuType, parentID);
+    message = createMenuClickedMessage(messageBuffer, sizeof(messageBuffer), menuID, data, menuType, parentID);
 
     // Notify the backend
     messageFromWindowCallback(message);
-    MEMFREE(message);
+    if( message != messageBuffer ) {
+        MEMFREE(message);
+    }
 }
 
 id processAcceleratorKey(const char *key) {
@@ -584,7 +620,7 @@ const char* getColour(JsonNode *styledLabelEntry, const char* key) {
     if( colEntry == NULL ) {
         return NULL;
     }
-    return getJSONString(colEntry, "hex");
+    return getJSONString(colEntry, JSONKEY("hex"));
 }
 
 id createAttributedStringFromStyledLabel(JsonNode *styledLabel, const char* fontName, int fontSize) {
@@ -625,10 +661,10 @@ id createAttributedStringFromStyledLabel(JsonNode *styledLabel, const char* font
         msg_id_id(dictionary, s("setObject:forKey:"), font, fan);
 
         // Get Text
-        const char* thisLabel = mustJSONString(styledLabelEntry, "Label");
+        const char* thisLabel = mustJSONString(styledLabelEntry, JSONKEY("Label"));
 
         // Get foreground colour
-        const char *hexColour = getColour(styledLabelEntry, "FgCol");
+        const char *hexColour = getColour(styledLabelEntry, JSONKEY("FgCol"));
         if( hexColour != NULL) {
             unsigned short r, g, b, a;
 
@@ -646,7 +682,7 @@ id createAttributedStringFromStyledLabel(JsonNode *styledLabel, const char* font
         }
 
         // Get background colour
-        hexColour = getColour(styledLabelEntry, "BgCol");
+        hexColour = getColour(styledLabelEntry, JSONKEY("BgCol"));
         if( hexColour != NULL) {
             unsigned short r, g, b, a;
 
@@ -782,15 +818,17 @@ id processTextMenuItem(Menu *menu, id parentMenu, const char *title, const char
 
 void processMenuItem(Menu *menu, id parentMenu, JsonNode *item) {
 
+    // Read all the fields of the item in one go
+    MenuItemFields fields;
+    ReadMenuItemFields(item, &fields);
+
     // Check if this item is hidden and if so, exit early!
-    bool hidden = false;
-    getJSONBool(item, "Hidden", &hidden);
-    if( hidden ) {
+    if( fields.hidden ) {
         return;
     }
 
     // Get the role
-    JsonNode *role = json_find_member(item, "Role");
+    JsonNode *role = fields.role;
     if( role != NULL ) {
         processMenuRole(menu, parentMenu, role);
         return;
@@ -798,47 +836,37 @@ void processMenuItem(Menu *menu, id parentMenu, JsonNode *item) {
 
     // This is a user menu. Get the common data
     // Get the label
-    const char *label = getJSONString(item, "Label");
-    if ( label == NULL) {
-        label = "(empty)";
-    }
+    const char *label = fields.label;
 
     // Check for a styled label
-    JsonNode *styledLabel = getJSONObject(item, "StyledLabel");
+    JsonNode *styledLabel = fields.styledLabel;
 
     // Is this an alternate menu item?
-    bool alternate = false;
-    getJSONBool(item, "MacAlternate", &alternate);
+    bool alternate = fields.alternate;
 
-    const char *menuid = getJSONString(item, "ID");
-    if ( menuid == NULL) {
-        menuid = "";
-    }
+    const char *menuid = fields.ID;
 
-    bool disabled = false;
-    getJSONBool(item, "Disabled", &disabled);
+    bool disabled = fields.disabled;
 
     // Get the Accelerator
-    JsonNode *accelerator = json_find_member(item, "Accelerator");
+    JsonNode *accelerator = fields.accelerator;
     const char *acceleratorkey = NULL;
     const char **modifiers = NULL;
 
-    const char *tooltip = getJSONString(item, "Tooltip");
-    const char *image = getJSONString(item, "Image");
-    const char *fontName = getJSONString(item, "FontName");
-    const char *RGBA = getJSONString(item, "RGBA");
-    bool templateImage = false;
-    getJSONBool(item, "MacTemplateImage", &templateImage);
+    const char *tooltip = fields.tooltip;
+    const char *image = fields.image;
+    const char *fontName = fields.fontName;
+    const char *RGBA = fields.RGBA;
+    bool templateImage = fields.templateImage;
 
-    int fontSize = 0;
-    getJSONInt(item, "FontSize", &fontSize);
+    int fontSize = fields.fontSize;
 
     // If we have an accelerator
     if( accelerator != NULL ) {
         // Get the key
-        acceleratorkey = getJSONString(accelerator, "Key");
+        acceleratorkey = getJSONString(accelerator, JSONKEY("Key"));
         // Check if there are modifiers
-        JsonNode *modifiersList = json_find_member(accelerator, "Modifiers");
+        JsonNode *modifiersList = json_find_member_interned(accelerator, JSONKEY("Modifiers"));
         if ( modifiersList != NULL ) {
             // Allocate an array of strings
             int noOfModifiers = json_array_length(modifiersList);
@@ -861,26 +889,19 @@ void processMenuItem(Menu *menu, id parentMenu, JsonNode *item) {
     }
 
     // Get the Type
-    JsonNode *type = json_find_member(item, "Type");
+    const char *type = fields.type;
     if( type != NULL ) {
-        if( STREQ(type->string_, "Text") || STREQ(type->string_, "Submenu")) {
+        if( STREQ(type, "Text") || STREQ(type, "Submenu")) {
             id thisMenuItem = processTextMenuItem(menu, parentMenu, label, menuid, disabled, acceleratorkey, modifiers, tooltip, image, fontName, fontSize, RGBA, templateImage, alternate, styledLabel);
 
             // Check if this node has a submenu
-            JsonNode *submenu = json_find_member(item, "SubMenu");
+            JsonNode *submenu = fields.subMenu;
             if( submenu != NULL ) {
-                // Get the label
-                JsonNode *menuNameNode = json_find_member(item, "Label");
-                const char *name = "";
-                if ( menuNameNode != NULL) {
-                    name = menuNameNode->string_;
-                }
-
-                id thisMenu = createMenu(str(name));
+                id thisMenu = createMenu(str(label));
 
                 msg_id(thisMenuItem, s("setSubmenu:"), thisMenu);
 
-                JsonNode *submenuItems = json_find_member(submenu, "Items");
+                JsonNode *submenuItems = json_find_member_interned(submenu, JSONKEY("Items"));
                 // If we have no items, just return
                 if ( submenuItems == NULL ) {
                     return;
@@ -894,22 +915,14 @@ void processMenuItem(Menu *menu, id parentMenu, JsonNode *item) {
                 }
             }
         }
-        else if ( STREQ(type->string_, "Separator")) {
+        else if ( STREQ(type, "Separator")) {
             addSeparator(parentMenu);
         }
-        else if ( STREQ(type->string_, "Checkbox")) {
-            // Get checked state
-            bool checked = false;
-            getJSONBool(item, "Checked", &checked);
-
-            processCheckboxMenuItem(menu, parentMenu, label, menuid, disabled, checked, "");
+        else if ( STREQ(type, "Checkbox")) {
+            processCheckboxMenuItem(menu, parentMenu, label, menuid, disabled, fields.checked, "");
         }
-        else if ( STREQ(type->string_, "Radio")) {
-            // Get checked state
-            bool checked = false;
-            getJSONBool(item, "Checked", &checked);
-
-            processRadioMenuItem(menu, parentMenu, label, menuid, disabled, checked, "");
+        else if ( STREQ(type, "Radio")) {
+            processRadioMenuItem(menu, parentMenu, label, menuid, disabled, fields.checked, "");
         }
     }
 
@@ -921,7 +934,7 @@ void processMenuItem(Menu *menu, id parentMenu, JsonNode *item) {
 }
 
 void processMenuData(Menu *menu, JsonNode *menuData) {
-    JsonNode *items = json_find_member(menuData, "Items");
+    JsonNode *items = json_find_member_interned(menuData, JSONKEY("Items"));
     if( items == NULL ) {
         // Parse error!
         ABORT("Unable to find 'Items' in menu JSON!");
@@ -938,8 +951,8 @@ void processMenuData(Menu *menu, JsonNode *menuData) {
 void processRadioGroupJSON(Menu *menu, JsonNode *radioGroup) {
 
     int groupLength;
-    getJSONInt(radioGroup, "Length", &groupLength);
-    JsonNode *members = json_find_member(radioGroup, "Members");
+    getJSONInt(radioGroup, JSONKEY("Length"), &groupLength);
+    JsonNode *members = json_find_member_interned(radioGroup, JSONKEY("Members"));
     JsonNode *member;
 
     // Allocate array
@@ -972,7 +985,7 @@ void processRadioGroupJSON(Menu *menu, JsonNode *radioGroup) {
 id GetMenu(Menu *menu) {
 
     // Pull out the menu data
-    JsonNode *menuData = json_find_member(menu->processedMenu, "Menu");
+    JsonNode *menuData = json_find_member_interned(menu->processedMenu, JSONKEY("Menu"));
     if( menuData == NULL ) {
         ABORT("Unable to find Menu data: %s", menu->processedMenu);
     }
@@ -983,7 +996,7 @@ id GetMenu(Menu *menu) {
     processMenuData(menu, menuData);
 
     // Create the radiogroup cache
-    JsonNode *radioGroups = json_find_member(menu->processedMenu, "RadioGroups");
+    JsonNode *radioGroups = json_find_member_interned(menu->processedMenu, JSONKEY("RadioGroups"));
     if( radioGroups == NULL ) {
         // Parse error!
         ABORT("Unable to find RadioGroups data: %s", menu->processedMenu);
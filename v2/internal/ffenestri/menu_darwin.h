@@ -7,6 +7,7 @@
 
 #include "common.h"
 #include "ffenestri_darwin.h"
+#include "menuschema.h"
 
 enum MenuItemType {Text = 0, Checkbox = 1, Radio = 2};
 enum MenuType {ApplicationMenuType = 0, ContextMenuType = 1, TrayMenuType = 2};
@@ -40,6 +41,11 @@ typedef struct {
     // The decoded version of the Menu JSON
     JsonNode *processedMenu;
 
+    // json_hash_text of the Menu JSON, or 0 if it is not known or the
+    // native menu has changed since it was built. Use MenuBuiltFrom and
+    // MarkMenuChanged, as it is read and written from more than one thread
+    uint64_t hash;
+
     struct hashmap_s menuItemMap;
     struct hashmap_s radioGroupMap;
 
@@ -79,8 +85,19 @@ MenuItemCallbackData* CreateMenuItemCallbackData(Menu *menu, id menuItem, const
 
 void DeleteMenu(Menu *menu);
 
+// Whether the menu was built from JSON with this json_hash_text, and has not
+// changed since
+bool MenuBuiltFrom(Menu *menu, uint64_t hash);
+// Records that the native menu no longer matches the JSON it was built from
+void MarkMenuChanged(Menu *menu);
+
+// Counts a menu update that was skipped because the menu had not changed
+void CountSkippedMenuRebuild();
+// The number of menu rebuilds skipped so far
+unsigned long SkippedMenuRebuilds();
+
 // Creates a JSON message for the given menuItemID and data
-const char* createMenuClickedMessage(const char *menuItemID, const char *data, enum MenuType menuType, const char *parentID);
+const char* createMenuClickedMessage(char *buffer, size_t bufferSize, const char *menuItemID, const char *data, enum MenuType menuType, const char *parentID);
 // Callback for text menu items
 void menuItemCallback(id self, SEL cmd, id sender);
 id processAcceleratorKey(const char *key);
@@ -0,0 +1,163 @@
+// +build !windows
+
+//
+// Schemas of the menu JSON sent by the Go side.
+//
+
+#include "menuschema.h"
+#include <limits.h>
+
+// Same as getJSONString: "" unless the member is a string
+static const char* fieldString(JsonNode *node) {
+    if ( node != NULL && node->tag == JSON_STRING ) {
+        return node->string_;
+    }
+    return "";
+}
+
+// Same as getJSONBool
+static bool fieldBool(JsonNode *node) {
+    return node != NULL && node->tag == JSON_BOOL && node->bool_;
+}
+
+// Same as getJSONInt
+static int fieldInt(JsonNode *node) {
+    int64_t value;
+    if ( json_get_int64(node, &value) && value >= INT_MIN && value <= INT_MAX ) {
+        return (int) value;
+    }
+    return 0;
+}
+
+enum {
+    MenuItemID, MenuItemLabel, MenuItemTooltip, MenuItemImage, MenuItemFontName, MenuItemRGBA,
+    MenuItemType, MenuItemHidden, MenuItemDisabled, MenuItemChecked, MenuItemMacAlternate,
+    MenuItemMacTemplateImage, MenuItemFontSize, MenuItemRole, MenuItemStyledLabel,
+    MenuItemAccelerator, MenuItemSubMenu, MenuItemKeyCount
+};
+
+static const char *const menuItemKeys[MenuItemKeyCount] = {
+    [MenuItemID] = "ID",
+    [MenuItemLabel] = "Label",
+    [MenuItemTooltip] = "Tooltip",
+    [MenuItemImage] = "Image",
+    [MenuItemFontName] = "FontName",
+    [MenuItemRGBA] = "RGBA",
+    [MenuItemType] = "Type",
+    [MenuItemHidden] = "Hidden",
+    [MenuItemDisabled] = "Disabled",
+    [MenuItemChecked] = "Checked",
+    [MenuItemMacAlternate] = "MacAlternate",
+    [MenuItemMacTemplateImage] = "MacTemplateImage",
+    [MenuItemFontSize] = "FontSize",
+    [MenuItemRole] = "Role",
+    [MenuItemStyledLabel] = "StyledLabel",
+    [MenuItemAccelerator] = "Accelerator",
+    [MenuItemSubMenu] = "SubMenu",
+};
+
+static JsonSchema menuItemSchema = JSON_SCHEMA(menuItemKeys);
+
+void ReadMenuItemFields(JsonNode *item, MenuItemFields *fields) {
+    JsonNode *values[MenuItemKeyCount];
+    json_extract(&menuItemSchema, item, values);
+
+    fields->ID = fieldString(values[MenuItemID]);
+    fields->label = fieldString(values[MenuItemLabel]);
+    fields->tooltip = fieldString(values[MenuItemTooltip]);
+    fields->image = fieldString(values[MenuItemImage]);
+    fields->fontName = fieldString(values[MenuItemFontName]);
+    fields->RGBA = fieldString(values[MenuItemRGBA]);
+
+    fields->type = NULL;
+    if ( values[MenuItemType] != NULL && values[MenuItemType]->tag == JSON_STRING ) {
+        fields->type = values[MenuItemType]->string_;
+    }
+
+    fields->hidden = fieldBool(values[MenuItemHidden]);
+    fields->disabled = fieldBool(values[MenuItemDisabled]);
+    fields->checked = fieldBool(values[MenuItemChecked]);
+    fields->alternate = fieldBool(values[MenuItemMacAlternate]);
+    fields->templateImage = fieldBool(values[MenuItemMacTemplateImage]);
+    fields->fontSize = fieldInt(values[MenuItemFontSize]);
+
+    fields->role = values[MenuItemRole];
+    fields->styledLabel = values[MenuItemStyledLabel];
+    fields->accelerator = values[MenuItemAccelerator];
+    fields->subMenu = values[MenuItemSubMenu];
+}
+
+enum {
+    TrayMenuID, TrayMenuLabel, TrayMenuImage, TrayMenuTooltip, TrayMenuFontName, TrayMenuRGBA,
+    TrayMenuMacTemplateImage, TrayMenuDisabled, TrayMenuFontSize, TrayMenuStyledLabel,
+    TrayMenuProcessedMenu, TrayMenuKeyCount
+};
+
+static const char *const trayMenuKeys[TrayMenuKeyCount] = {
+    [TrayMenuID] = "ID",
+    [TrayMenuLabel] = "Label",
+    [TrayMenuImage] = "Image",
+    [TrayMenuTooltip] = "Tooltip",
+    [TrayMenuFontName] = "FontName",
+    [TrayMenuRGBA] = "RGBA",
+    [TrayMenuMacTemplateImage] = "MacTemplateImage",
+    [TrayMenuDisabled] = "Disabled",
+    [TrayMenuFontSize] = "FontSize",
+    [TrayMenuStyledLabel] = "StyledLabel",
+    [TrayMenuProcessedMenu] = "ProcessedMenu",
+};
+
+static JsonSchema trayMenuSchema = JSON_SCHEMA(trayMenuKeys);
+
+void ReadTrayMenuFields(JsonNode *trayMenu, TrayMenuFields *fields) {
+    JsonNode *values[TrayMenuKeyCount];
+    json_extract(&trayMenuSchema, trayMenu, values);
+
+    fields->ID = fieldString(values[TrayMenuID]);
+    fields->label = fieldString(values[TrayMenuLabel]);
+    fields->icon = fieldString(values[TrayMenuImage]);
+    fields->tooltip = fieldString(values[TrayMenuTooltip]);
+    fields->fontName = fieldString(values[TrayMenuFontName]);
+    fields->RGBA = fieldString(values[TrayMenuRGBA]);
+
+    fields->templateImage = fieldBool(values[TrayMenuMacTemplateImage]);
+    fields->disabled = fieldBool(values[TrayMenuDisabled]);
+    fields->fontSize = fieldInt(values[TrayMenuFontSize]);
+
+    fields->styledLabel = values[TrayMenuStyledLabel];
+    fields->processedMenu = values[TrayMenuProcessedMenu];
+}
+
+enum {
+    TrayLabelID, TrayLabelLabel, TrayLabelTooltip, TrayLabelFontName, TrayLabelRGBA,
+    TrayLabelDisabled, TrayLabelFontSize, TrayLabelStyledLabel, TrayLabelKeyCount
+};
+
+static const char *const trayLabelKeys[TrayLabelKeyCount] = {
+    [TrayLabelID] = "ID",
+    [TrayLabelLabel] = "Label",
+    [TrayLabelTooltip] = "Tooltip",
+    [TrayLabelFontName] = "FontName",
+    [TrayLabelRGBA] = "RGBA",
+    [TrayLabelDisabled] = "Disabled",
+    [TrayLabelFontSize] = "FontSize",
+    [TrayLabelStyledLabel] = "StyledLabel",
+};
+
+static JsonSchema trayLabelSchema = JSON_SCHEMA(trayLabelKeys);
+
+void ReadTrayLabelFields(JsonNode *update, TrayLabelFields *fields) {
+    JsonNode *values[TrayLabelKeyCount];
+    json_extract(&trayLabelSchema, update, values);
+
+    fields->ID = fieldString(values[TrayLabelID]);
+    fields->label = fieldString(values[TrayLabelLabel]);
+    fields->tooltip = fieldString(values[TrayLabelTooltip]);
+    fields->fontName = fieldString(values[TrayLabelFontName]);
+    fields->RGBA = fieldString(values[TrayLabelRGBA]);
+
+    fields->disabled = fieldBool(values[TrayLabelDisabled]);
+    fields->fontSize = fieldInt(values[TrayLabelFontSize]);
+
+    fields->styledLabel = values[TrayLabelStyledLabel];
+}
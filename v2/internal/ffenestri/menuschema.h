@@ -0,0 +1,77 @@
+//
+// Schemas of the menu JSON sent by the Go side.
+//
+// Each Read*Fields function reads every field it knows about in one pass
+// over the object, with the same defaults the getJSON* helpers use.
+// They are portable so they can be tested without Cocoa.
+//
+
+#ifndef MENUSCHEMA_H
+#define MENUSCHEMA_H
+
+#include "json.h"
+
+// A menu item, as read by processMenuItem
+typedef struct {
+    const char *ID;
+    const char *label;
+    const char *tooltip;
+    const char *image;
+    const char *fontName;
+    const char *RGBA;
+
+    // NULL if missing or not a string
+    const char *type;
+
+    bool hidden;
+    bool disabled;
+    bool checked;
+    bool alternate;
+    bool templateImage;
+    int fontSize;
+
+    // NULL if missing
+    JsonNode *role;
+    JsonNode *styledLabel;
+    JsonNode *accelerator;
+    JsonNode *subMenu;
+} MenuItemFields;
+
+// A tray menu, as read by NewTrayMenu
+typedef struct {
+    const char *ID;
+    const char *label;
+    const char *icon;
+    const char *tooltip;
+    const char *fontName;
+    const char *RGBA;
+
+    bool templateImage;
+    bool disabled;
+    int fontSize;
+
+    // NULL if missing
+    JsonNode *styledLabel;
+    JsonNode *processedMenu;
+} TrayMenuFields;
+
+// A tray label update, as read by UpdateTrayMenuLabelInStore
+typedef struct {
+    const char *ID;
+    const char *label;
+    const char *tooltip;
+    const char *fontName;
+    const char *RGBA;
+
+    bool disabled;
+    int fontSize;
+
+    // NULL if missing
+    JsonNode *styledLabel;
+} TrayLabelFields;
+
+void ReadMenuItemFields(JsonNode *item, MenuItemFields *fields);
+void ReadTrayMenuFields(JsonNode *trayMenu, TrayMenuFields *fields);
+void ReadTrayLabelFields(JsonNode *update, TrayLabelFields *fields);
+
+#endif //MENUSCHEMA_H
@@ -0,0 +1,456 @@
+/*
+ * Tests for hashmap.h.
+ *
+ *     cc -o hashmap_test hashmap_test.c && ./hashmap_test
+ */
+
+#include "../hashmap.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int failures;
+
+#define CHECK(cond) do {                                                \
+		if (!(cond)) {                                                  \
+			fprintf(stderr, "%s:%d: check failed: %s\n",                \
+				__FILE__, __LINE__, #cond);                             \
+			failures++;                                                 \
+		}                                                               \
+	} while (0)
+
+/* xorshift64, so runs are reproducible. */
+static uint64_t random_state = 88172645463325252ULL;
+
+static uint64_t random_bits(void)
+{
+	random_state ^= random_state << 13;
+	random_state ^= random_state >> 7;
+	random_state ^= random_state << 17;
+	return random_state;
+}
+
+#define KEYS 5000
+
+/* Menu item IDs, as the menu manager hands them out. */
+static char keys[KEYS][16];
+
+static void make_keys(void)
+{
+	int i;
+
+	for (i = 0; i < KEYS; i++)
+		snprintf(keys[i], sizeof(keys[i]), "%d", i);
+}
+
+static void *value_of(int i)
+{
+	return (void*) (intptr_t) (i + 1);
+}
+
+static int count_element(void *const context, struct hashmap_element_s *const e)
+{
+	(void) e;
+	(*(int*) context)++;
+	return 0;
+}
+
+static int remove_even(void *const context, struct hashmap_element_s *const e)
+{
+	(void) context;
+	return ((intptr_t) e->data - 1) % 2 == 0 ? -1 : 0;
+}
+
+static int stop_at_first(void *const context, struct hashmap_element_s *const e)
+{
+	(void) e;
+	(*(int*) context)++;
+	return 1;
+}
+
+static void test_group_match(void)
+{
+	unsigned char ctrl[HASHMAP_GROUP_WIDTH];
+	int round, i;
+
+	for (round = 0; round < 1000; round++) {
+		unsigned match = 0, empty = 0, found;
+		unsigned char h2 = random_bits() & 0x7f;
+
+		for (i = 0; i < HASHMAP_GROUP_WIDTH; i++) {
+			switch (random_bits() % 3) {
+			case 0: ctrl[i] = HASHMAP_EMPTY; break;
+			case 1: ctrl[i] = h2; break;
+			default: ctrl[i] = random_bits() & 0x7f;
+			}
+			if (ctrl[i] == h2)
+				match |= 1u << i;
+			if (ctrl[i] == HASHMAP_EMPTY)
+				empty |= 1u << i;
+		}
+
+		/* Matches may include false positives, but only on used slots. */
+		found = hashmap_group_match(ctrl, h2);
+		CHECK((found & match) == match);
+		CHECK((found & empty) == 0);
+		CHECK(hashmap_group_match_empty(ctrl) == empty);
+	}
+}
+
+static void test_hash(void)
+{
+	unsigned hashes[65], tags[128] = {0}, buckets[256] = {0};
+	char *key;
+	int len, i, j, used = 0;
+
+	/* Every length reads only its own bytes, which ASan checks here, and
+	 * keys of zero bytes still hash differently by length. */
+	for (len = 0; len <= 64; len++) {
+		key = malloc(len ? len : 1);
+		memset(key, 0, len);
+		hashes[len] = hashmap_hash_helper_int_helper(key, len);
+		for (j = 0; j < len; j++) {
+			key[j] = 'a';
+			CHECK(hashmap_hash_helper_int_helper(key, len) != hashes[len]);
+			key[j] = 0;
+		}
+		free(key);
+		for (j = 0; j < len; j++)
+			CHECK(hashes[j] != hashes[len]);
+	}
+
+	/* Both the control byte and the slot bits are spread over menu IDs. */
+	for (i = 0; i < KEYS; i++) {
+		unsigned hash = hashmap_hash_helper_int_helper(keys[i], strlen(keys[i]));
+		tags[hash & 0x7f]++;
+		buckets[(hash >> 7) & 0xff]++;
+	}
+	for (i = 0; i < 128; i++)
+		CHECK(tags[i] > KEYS / 128 / 2 && tags[i] < KEYS / 128 * 2);
+	for (i = 0; i < 256; i++)
+		used += buckets[i] > 0;
+	CHECK(used == 256);
+}
+
+static void test_put_get_remove(void)
+{
+	struct hashmap_s map;
+	int i, count;
+
+	CHECK(hashmap_create(3, &map) != 0);
+	CHECK(hashmap_create(0, &map) != 0);
+	CHECK(hashmap_create(4, &map) == 0);
+
+	for (i = 0; i < KEYS; i++)
+		CHECK(hashmap_put(&map, keys[i], strlen(keys[i]), value_of(i)) == 0);
+	CHECK(hashmap_num_entries(&map) == KEYS);
+
+	for (i = 0; i < KEYS; i++)
+		CHECK(hashmap_get(&map, keys[i], strlen(keys[i])) == value_of(i));
+	CHECK(hashmap_get(&map, "missing", 7) == NULL);
+	CHECK(hashmap_get(&map, "1", 0) == NULL);
+
+	/* Putting a key again replaces its value. */
+	CHECK(hashmap_put(&map, keys[7], strlen(keys[7]), value_of(70)) == 0);
+	CHECK(hashmap_num_entries(&map) == KEYS);
+	CHECK(hashmap_get(&map, keys[7], strlen(keys[7])) == value_of(70));
+	CHECK(hashmap_put(&map, keys[7], strlen(keys[7]), value_of(7)) == 0);
+
+	/* Keys are compared by length as well as content. */
+	CHECK(hashmap_get(&map, "12", 1) == value_of(1));
+
+	for (i = 0; i < KEYS; i += 3)
+		CHECK(hashmap_remove(&map, keys[i], strlen(keys[i])) == 0);
+	CHECK(hashmap_remove(&map, keys[0], strlen(keys[0])) != 0);
+	CHECK(hashmap_num_entries(&map) == KEYS - (KEYS + 2) / 3);
+
+	for (i = 0; i < KEYS; i++) {
+		void *expected = i % 3 == 0 ? NULL : value_of(i);
+		CHECK(hashmap_get(&map, keys[i], strlen(keys[i])) == expected);
+	}
+
+	count = 0;
+	CHECK(hashmap_iterate_pairs(&map, count_element, &count) == 0);
+	CHECK(count == (int) hashmap_num_entries(&map));
+
+	count = 0;
+	CHECK(hashmap_iterate_pairs(&map, stop_at_first, &count) == 1);
+	CHECK(count == 1);
+
+	/* Returning -1 removes the element and carries on. */
+	CHECK(hashmap_iterate_pairs(&map, remove_even, NULL) == 0);
+	for (i = 0; i < KEYS; i++) {
+		void *expected = i % 3 == 0 || i % 2 == 0 ? NULL : value_of(i);
+		CHECK(hashmap_get(&map, keys[i], strlen(keys[i])) == expected);
+	}
+
+	hashmap_destroy(&map);
+	CHECK(map.data == NULL);
+}
+
+static void test_reserve(void)
+{
+	struct hashmap_s map;
+	struct hashmap_element_s *data;
+	int i;
+
+	CHECK(hashmap_create(16, &map) == 0);
+	CHECK(hashmap_capacity(&map) == 14);
+
+	/* A reserved map is filled without rehashing. */
+	CHECK(hashmap_reserve(&map, 1000) == 0);
+	CHECK(hashmap_capacity(&map) >= 1000);
+	CHECK(map.table_size == 2048);
+	data = map.data;
+	for (i = 0; i < 1000; i++)
+		CHECK(hashmap_put(&map, keys[i], strlen(keys[i]), value_of(i)) == 0);
+	CHECK(map.data == data);
+	CHECK(hashmap_capacity(&map) == 1792);
+
+	/* Reserving no more than there is room for does nothing. */
+	CHECK(hashmap_reserve(&map, 10) == 0);
+	CHECK(hashmap_reserve(&map, hashmap_capacity(&map)) == 0);
+	CHECK(map.data == data);
+
+	/* Growing moves every element by its stored hash. */
+	CHECK(hashmap_reserve(&map, 3000) == 0);
+	CHECK(map.data != data);
+	for (i = 0; i < 1000; i++)
+		CHECK(hashmap_get(&map, keys[i], strlen(keys[i])) == value_of(i));
+	for (i = 0; i < (int) map.table_size; i++) {
+		struct hashmap_element_s *e = &map.data[i];
+		if (map.ctrl[i] < HASHMAP_EMPTY)
+			CHECK(e->hash == hashmap_hash_helper_int_helper(e->key, e->key_len));
+	}
+
+	/* A count no table size can hold fails instead of looping. */
+	data = map.data;
+	CHECK(hashmap_reserve(&map, 0xF0000000u) != 0);
+	CHECK(hashmap_reserve(&map, UINT_MAX) != 0);
+	CHECK(map.data == data);
+
+	hashmap_destroy(&map);
+}
+
+/* Removes and puts keys at random, comparing the map with a plain array. */
+/*
+ * Checks that no element has an empty slot between its home slot and the
+ * slot it is in, which lookups rely on now that removal leaves no
+ * tombstones, and that the control bytes agree with the elements.
+ */
+static void check_layout(const struct hashmap_s *map)
+{
+	const unsigned mask = map->table_size - 1;
+	unsigned i, j, used = 0;
+
+	for (i = 0; i < map->table_size; i++) {
+		const struct hashmap_element_s *e = &map->data[i];
+
+		if (i < HASHMAP_GROUP_WIDTH)
+			CHECK(map->ctrl[map->table_size + i] == map->ctrl[i]);
+		if (map->ctrl[i] == HASHMAP_EMPTY) {
+			CHECK(!e->in_use);
+			continue;
+		}
+		used++;
+		CHECK(e->in_use);
+		CHECK(map->ctrl[i] == (e->hash & 0x7f));
+		for (j = (e->hash >> 7) & mask; j != i; j = (j + 1) & mask)
+			CHECK(map->ctrl[j] != HASHMAP_EMPTY);
+	}
+	CHECK(used == map->size);
+}
+
+static void test_churn(void)
+{
+	static void *expected[KEYS];
+	struct hashmap_s map;
+	unsigned size = 0;
+	int round, i;
+
+	memset(expected, 0, sizeof(expected));
+	CHECK(hashmap_create(16, &map) == 0);
+
+	for (round = 0; round < 200000; round++) {
+		i = random_bits() % (round < 100000 ? KEYS : 64);
+		if (random_bits() % 2) {
+			CHECK(hashmap_put(&map, keys[i], strlen(keys[i]), value_of(round)) == 0);
+			size += expected[i] == NULL;
+			expected[i] = value_of(round);
+		} else {
+			CHECK((hashmap_remove(&map, keys[i], strlen(keys[i])) == 0) == (expected[i] != NULL));
+			size -= expected[i] != NULL;
+			expected[i] = NULL;
+		}
+		if (round % 1000 == 0)
+			check_layout(&map);
+	}
+
+	CHECK(hashmap_num_entries(&map) == size);
+	for (i = 0; i < KEYS; i++)
+		CHECK(hashmap_get(&map, keys[i], strlen(keys[i])) == expected[i]);
+	check_layout(&map);
+
+	/* Once the keys from the first half are gone the map has shrunk back
+	 * down from holding thousands of them. */
+	for (i = 64; i < KEYS; i++)
+		hashmap_remove(&map, keys[i], strlen(keys[i]));
+	CHECK(hashmap_num_entries(&map) <= 64);
+	CHECK(map.table_size <= 256);
+	check_layout(&map);
+	for (i = 0; i < 64; i++)
+		CHECK(hashmap_get(&map, keys[i], strlen(keys[i])) == expected[i]);
+
+	hashmap_destroy(&map);
+}
+
+/* Removes the odd elements and counts every visit. */
+static int remove_odd(void *const context, struct hashmap_element_s *const e)
+{
+	int *visits = context;
+	int i = (int) (intptr_t) e->data - 1;
+
+	visits[i]++;
+	return i % 2 ? -1 : 0;
+}
+
+static void test_iterate_churn(void)
+{
+	static int visits[KEYS];
+	struct hashmap_s map;
+	int round, i, n;
+
+	for (round = 0; round < 200; round++) {
+		n = 1 + random_bits() % KEYS;
+		CHECK(hashmap_create(16, &map) == 0);
+		for (i = 0; i < n; i++)
+			CHECK(hashmap_put(&map, keys[i], strlen(keys[i]), value_of(i)) == 0);
+
+		/* Removing elements shifts others back into their slots, but
+		 * every element is still visited exactly once. */
+		memset(visits, 0, sizeof(visits));
+		CHECK(hashmap_iterate_pairs(&map, remove_odd, visits) == 0);
+		for (i = 0; i < n; i++)
+			CHECK(visits[i] == 1);
+		CHECK(hashmap_num_entries(&map) == (unsigned) (n + 1) / 2);
+		check_layout(&map);
+		for (i = 0; i < n; i++)
+			CHECK(hashmap_get(&map, keys[i], strlen(keys[i])) == (i % 2 ? NULL : value_of(i)));
+
+		/* Removing everything shrinks the map to its smallest size. */
+		CHECK(hashmap_iterate_pairs(&map, remove_even, NULL) == 0);
+		CHECK(hashmap_num_entries(&map) == 0);
+		CHECK(map.table_size == HASHMAP_GROUP_WIDTH);
+
+		hashmap_destroy(&map);
+	}
+}
+
+/* Every third key is too long to be kept inline. */
+static void make_owned_key(char *buffer, size_t size, int i)
+{
+	if (i % 3 == 0)
+		snprintf(buffer, size, "main.App.SomeBoundStructWithALongName.Method%d", i);
+	else
+		snprintf(buffer, size, "item-%d", i);
+}
+
+static int check_owned_key(void *const context, struct hashmap_element_s *const e)
+{
+	const struct hashmap_s *map = context;
+	const char *inline_end = map->inline_keys + map->table_size * HASHMAP_INLINE_KEY_SIZE;
+	char buffer[128];
+
+	make_owned_key(buffer, sizeof(buffer), (int) (intptr_t) e->data - 1);
+	CHECK(e->key_len == strlen(buffer));
+	CHECK(strcmp(e->key, buffer) == 0);
+	CHECK((e->key >= map->inline_keys && e->key < inline_end) == (e->key_len < HASHMAP_INLINE_KEY_SIZE));
+	return 0;
+}
+
+static void test_owned_keys(void)
+{
+	static void *expected[KEYS];
+	struct hashmap_s map;
+	char buffer[128];
+	const char *key;
+	unsigned size = 0;
+	int round, i;
+
+	/* Keys of HASHMAP_INLINE_KEY_SIZE bytes and more go into the arena. */
+	CHECK(hashmap_create_owned(16, &map) == 0);
+	memset(buffer, 'k', sizeof(buffer));
+	CHECK(hashmap_put(&map, buffer, HASHMAP_INLINE_KEY_SIZE - 1, value_of(0)) == 0);
+	CHECK(map.arena_live == 0);
+	CHECK(hashmap_put(&map, buffer, HASHMAP_INLINE_KEY_SIZE, value_of(1)) == 0);
+	CHECK(map.arena_live == HASHMAP_INLINE_KEY_SIZE + 1);
+	hashmap_destroy(&map);
+
+	memset(expected, 0, sizeof(expected));
+	CHECK(hashmap_create_owned(16, &map) == 0);
+
+	/* One buffer is reused for every key, so the map has to copy them. */
+	for (round = 0; round < 100000; round++) {
+		i = random_bits() % (round < 50000 ? KEYS : 256);
+		make_owned_key(buffer, sizeof(buffer), i);
+		if (random_bits() % 2) {
+			CHECK(hashmap_put(&map, buffer, strlen(buffer), value_of(i)) == 0);
+			size += expected[i] == NULL;
+			expected[i] = value_of(i);
+		} else {
+			CHECK((hashmap_remove(&map, buffer, strlen(buffer)) == 0) == (expected[i] != NULL));
+			size -= expected[i] != NULL;
+			expected[i] = NULL;
+		}
+		memset(buffer, '?', sizeof(buffer));
+
+		/* Removed keys are compacted away before they fill the arena. */
+		CHECK(map.arena_dead <= HASHMAP_ARENA_BLOCK_SIZE || map.arena_dead <= map.arena_live);
+	}
+
+	CHECK(hashmap_num_entries(&map) == size);
+	for (i = 0; i < KEYS; i++) {
+		make_owned_key(buffer, sizeof(buffer), i);
+		CHECK(hashmap_get(&map, buffer, strlen(buffer)) == expected[i]);
+	}
+	check_layout(&map);
+	CHECK(hashmap_iterate_pairs(&map, check_owned_key, &map) == 0);
+
+	/* Replacing a value keeps the copy of the key the map already has. */
+	make_owned_key(buffer, sizeof(buffer), 1);
+	CHECK(hashmap_put(&map, buffer, strlen(buffer), value_of(1)) == 0);
+	for (i = 0; map.ctrl[i] == HASHMAP_EMPTY || map.data[i].data != value_of(1); i++)
+		;
+	key = map.data[i].key;
+	CHECK(hashmap_put(&map, buffer, strlen(buffer), value_of(1)) == 0);
+	CHECK(map.data[i].key == key && key != buffer);
+
+	/* Keys that move with their elements are still found. */
+	CHECK(hashmap_iterate_pairs(&map, remove_even, NULL) == 0);
+	CHECK(hashmap_iterate_pairs(&map, check_owned_key, &map) == 0);
+	check_layout(&map);
+
+	hashmap_destroy(&map);
+}
+
+int main(void)
+{
+	make_keys();
+
+	test_group_match();
+	test_hash();
+	test_put_get_remove();
+	test_reserve();
+	test_churn();
+	test_iterate_churn();
+	test_owned_keys();
+
+	if (failures) {
+		fprintf(stderr, "%d checks failed\n", failures);
+		return 1;
+	}
+	printf("PASS\n");
+	return 0;
+}
@@ -0,0 +1,1315 @@
+/*
+ * Tests for the portable JSON helpers in ffenestri.
+ *
+ * They do not depend on Cocoa, GTK or cgo:
+ *
+ *     cc -o json_test ../json.c ../menuschema.c json_test.c && ./json_test
+ *
+ * Run them again built with -DJSON_NO_SIMD, which swaps in the portable
+ * string scanning, and with -DJSON_NO_POOL.
+ */
+
+#include "../json.h"
+#include "../menuschema.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static int failures;
+
+#define CHECK(cond) do {                                                \
+		if (!(cond)) {                                                  \
+			fprintf(stderr, "%s:%d: check failed: %s\n",                \
+				__FILE__, __LINE__, #cond);                             \
+			failures++;                                                 \
+		}                                                               \
+	} while (0)
+
+/* xorshift64, so runs are reproducible. */
+static uint64_t random_state = 88172645463325252ULL;
+
+static uint64_t random_bits(void)
+{
+	random_state ^= random_state << 13;
+	random_state ^= random_state >> 7;
+	random_state ^= random_state << 17;
+	return random_state;
+}
+
+static char *encode_number(double n)
+{
+	JsonNode *node = json_mknumber(n);
+	char *ret = json_encode(node);
+	json_delete(node);
+	return ret;
+}
+
+/* Decodes a single number, or returns false if @json is not one. */
+static bool decode_number(const char *json, double *out)
+{
+	JsonNode *node = json_decode(json);
+	bool ok = node != NULL && node->tag == JSON_NUMBER;
+
+	if (ok)
+		*out = node->number_;
+	json_delete(node);
+	return ok;
+}
+
+static void test_encode_number(void)
+{
+	static const struct {
+		double value;
+		const char *json;
+	} cases[] = {
+		{0, "0"},
+		{-0.0, "0"},
+		{1, "1"},
+		{-42, "-42"},
+		{0.1, "0.1"},
+		{0.1 + 0.2, "0.30000000000000004"},
+		{-2.5, "-2.5"},
+		{1234.5678, "1234.5678"},
+		{1e20, "100000000000000000000"},
+		{1e21, "1e+21"},
+		{123456789012345680000.0, "123456789012345680000"},
+		{1e-6, "0.000001"},
+		{1.5e-7, "1.5e-7"},
+		{9007199254740992.0, "9007199254740992"},
+		{5e-324, "5e-324"},
+		{2.2250738585072014e-308, "2.2250738585072014e-308"},
+		{1.7976931348623157e308, "1.7976931348623157e+308"},
+	};
+	size_t i;
+
+	for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+		char *json = encode_number(cases[i].value);
+		if (strcmp(json, cases[i].json) != 0) {
+			fprintf(stderr, "encoding %.17g: got %s, want %s\n", cases[i].value, json, cases[i].json);
+			failures++;
+		}
+		free(json);
+	}
+}
+
+static void test_encode_non_finite(void)
+{
+	char *json;
+	double zero = 0;
+
+	json = encode_number(1 / zero);
+	CHECK(strcmp(json, "null") == 0);
+	free(json);
+
+	json = encode_number(zero / zero);
+	CHECK(strcmp(json, "null") == 0);
+	free(json);
+}
+
+/* Every finite double must come back bit for bit. */
+static void test_number_round_trip(void)
+{
+	int i, mismatches = 0;
+
+	for (i = 0; i < 1000000; i++) {
+		uint64_t bits = random_bits();
+		double value, back;
+		char *json;
+
+		/* Mix in short decimals, which are what payloads mostly carry. */
+		if (i % 2 == 0)
+			value = (double) (int64_t) (random_bits() % 2000000) / (double) (1 + random_bits() % 1000);
+		else
+			memcpy(&value, &bits, sizeof(value));
+		if (!(value - value == 0))
+			continue;
+
+		/* -0 is written as 0, like JavaScript does. */
+		json = encode_number(value);
+		if (!decode_number(json, &back) ||
+		    (memcmp(&back, &value, sizeof(value)) != 0 && value != 0)) {
+			if (mismatches++ < 10)
+				fprintf(stderr, "%.17g encoded as %s does not round-trip\n", value, json);
+			failures++;
+		}
+		free(json);
+	}
+}
+
+static void test_integers_are_exact(void)
+{
+	static const char *const cases[] = {
+		"9007199254740993",
+		"-9007199254740993",
+		"9223372036854775807",
+		"-9223372036854775808",
+		"1234567890123456789",
+	};
+	size_t i;
+
+	for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+		JsonNode *node = json_decode(cases[i]);
+		char *json = json_encode(node);
+		int64_t value;
+
+		CHECK(json_get_int64(node, &value));
+		CHECK(value == strtoll(cases[i], NULL, 10));
+		CHECK(strcmp(json, cases[i]) == 0);
+		free(json);
+		json_delete(node);
+	}
+}
+
+static void test_integer_bounds(void)
+{
+	JsonNode *node;
+	int64_t value;
+
+	node = json_decode("9223372036854775808");
+	CHECK(!json_get_int64(node, &value));
+	json_delete(node);
+
+	node = json_decode("12.5");
+	CHECK(!json_get_int64(node, &value));
+	json_delete(node);
+
+	node = json_decode("1e2");
+	CHECK(json_get_int64(node, &value) && value == 100);
+	json_delete(node);
+}
+
+/* json_encode_into behaves like snprintf for every buffer size. */
+static void test_encode_into(void)
+{
+	JsonNode *node = json_decode("{\"menuItemID\":\"42\",\"menuType\":\"TrayMenu\","
+		"\"data\":\"a \\\"quoted\\\" \\u00e9 value\",\"RGBA\":[0.25,1,-3e-7]}");
+	char *json = json_encode(node);
+	size_t length = strlen(json), size;
+	char buf[256];
+
+	CHECK(json_encoded_length(node) == length);
+	CHECK(json_encode_into(node, NULL, 0) == length);
+
+	for (size = 1; size <= sizeof(buf); size++) {
+		size_t written = size - 1 < length ? size - 1 : length;
+
+		memset(buf, 'x', sizeof(buf));
+		CHECK(json_encode_into(node, buf, size) == length);
+		CHECK(memcmp(buf, json, written) == 0 && buf[written] == 0);
+		CHECK(size == sizeof(buf) || buf[size] == 'x');
+	}
+
+	free(json);
+	json_delete(node);
+}
+
+/*
+ * Strings are scanned 8, 16 or 32 bytes at a time, so put a character that
+ * ends a plain run at every position of strings that straddle those
+ * boundaries, at every alignment, and check that it is encoded and decoded
+ * the same as anywhere else.
+ */
+static void test_plain_runs(void)
+{
+	static const char *const specials[][2] = {
+		{"\"", "\\\""}, {"\\", "\\\\"}, {"\n", "\\n"}, {"\x01", "\\u0001"}, {"\xc3\xa9", "\xc3\xa9"},
+	};
+	static const int lengths[] = {0, 1, 7, 8, 9, 15, 16, 17, 31, 32, 33, 47, 48, 49, 63, 64, 65};
+	static char area[512];
+	char *base = (char*) (((uintptr_t) area + 63) & ~(uintptr_t) 63);
+	char str[128], expected[256], *text, *encoded, *s, *e;
+	JsonNode *node;
+	JsonTape *tape;
+	int offset, l, pos, k, i, mismatches = 0;
+
+	for (offset = 0; offset < 32; offset++) {
+		for (l = 0; l < (int) (sizeof(lengths) / sizeof(lengths[0])); l++) {
+			int len = lengths[l];
+
+			/* pos == len puts no special character in at all. */
+			for (pos = 0; pos <= len; pos++) {
+				for (k = 0; k < (pos < len ? 5 : 1); k++) {
+					text = base + offset;
+					s = str;
+					e = expected;
+					*e++ = '"';
+					for (i = 0; i < len; i++) {
+						if (i == pos) {
+							s += sprintf(s, "%s", specials[k][0]);
+							e += sprintf(e, "%s", specials[k][1]);
+						} else {
+							*s++ = *e++ = 'a' + i % 26;
+						}
+					}
+					*s = 0;
+					strcpy(e, "\"");
+
+					/* Encode from every alignment. */
+					strcpy(text, str);
+					encoded = json_encode_string(text);
+					if (strcmp(encoded, expected) != 0)
+						mismatches++;
+					free(encoded);
+
+					/* And decode from every alignment. */
+					strcpy(text, expected);
+					node = json_decode(text);
+					if (node == NULL || node->tag != JSON_STRING || strcmp(node->string_, str) != 0)
+						mismatches++;
+					json_delete(node);
+					tape = json_tape_parse(text);
+					if (tape == NULL || strcmp(json_tape_string(json_tape_root(tape)), str) != 0)
+						mismatches++;
+					json_tape_free(tape);
+					if (!json_validate(text))
+						mismatches++;
+				}
+			}
+		}
+	}
+	CHECK(mismatches == 0);
+}
+
+/* Heap nodes attached to an arena document are freed with whatever held them. */
+static void test_arena(void)
+{
+	JsonNode *root = json_decode_arena("{\"menu\":{\"items\":[1,2,3],\"label\":\"File\"},\"tray\":{\"items\":[]},\"count\":3}");
+	JsonNode *menu, *tray, *heap;
+	char *json;
+
+	CHECK(root != NULL && json_check(root, NULL));
+	menu = json_find_member(root, "menu");
+	tray = json_find_member(root, "tray");
+
+	heap = json_mkobject();
+	json_append_member(heap, "name", json_mkstring("a string too long for the string pool"));
+	json_append_element(json_find_member(menu, "items"), heap);
+	json_append_member(menu, "enabled", json_mkbool(true));
+	json_append_element(json_find_member(tray, "items"), json_mkstring("a heap string below the tray"));
+	json_prepend_member(root, "first", json_mkstring("x"));
+	json_append_member(root, "last", json_mkarray());
+	json_append_element(json_find_member(root, "last"), json_mknumber(4));
+	CHECK(json_check(root, NULL));
+
+	json = json_encode(root);
+	CHECK(strcmp(json, "{\"first\":\"x\",\"menu\":{\"items\":[1,2,3,{\"name\":\"a string too long for the string pool\"}],"
+		"\"label\":\"File\",\"enabled\":true},\"tray\":{\"items\":[\"a heap string below the tray\"]},"
+		"\"count\":3,\"last\":[4]}") == 0);
+	free(json);
+
+	/* A heap node taken out belongs to the caller again. */
+	heap = json_find_member(root, "first");
+	json_remove_from_parent(heap);
+	json_delete(heap);
+
+	/* Deleting an arena node unlinks it and frees the heap nodes below it, */
+	json_delete(menu);
+	CHECK(json_find_member(root, "menu") == NULL && json_check(root, NULL));
+
+	/* even once it has been detached. */
+	json_remove_from_parent(tray);
+	CHECK(json_find_member(tray, "items") != NULL);
+	json_delete(tray);
+
+	json_index_members(root);
+	CHECK(json_find_member(root, "last") != NULL && json_find_member(root, "tray") == NULL);
+	CHECK(json_check(root, NULL));
+
+	json = json_encode(root);
+	CHECK(strcmp(json, "{\"count\":3,\"last\":[4]}") == 0);
+	free(json);
+	json_delete(root);
+}
+
+/* In-situ documents point into the caller's buffer, and never free it. */
+static void test_insitu(void)
+{
+	char *buf = strdup("{\"key\":\"caf\\u00e9 \\\"quoted\\\"\",\"list\":[\"a\",\"b\"],\"n\":1}");
+	char *end = buf + strlen(buf);
+	JsonNode *root = json_decode_insitu(buf);
+	JsonNode *node, *list;
+	char *json;
+
+	CHECK(root != NULL && json_check(root, NULL));
+	node = json_find_member(root, "key");
+	CHECK(node != NULL && strcmp(node->string_, "caf\xc3\xa9 \"quoted\"") == 0);
+	CHECK(node->key >= buf && node->key < end);
+	CHECK(node->string_ >= buf && node->string_ < end);
+
+	list = json_find_member(root, "list");
+	json_delete(json_first_child(list));
+	json_append_element(list, json_mkstring("a heap string appended to the list"));
+	json_prepend_member(root, "heap", json_mkobject());
+	json_append_member(json_find_member(root, "heap"), "flag", json_mkbool(false));
+	json_delete(json_find_member(root, "n"));
+	CHECK(json_check(root, NULL));
+
+	json = json_encode(root);
+	CHECK(strcmp(json, "{\"heap\":{\"flag\":false},\"key\":\"caf\xc3\xa9 \\\"quoted\\\"\","
+		"\"list\":[\"b\",\"a heap string appended to the list\"]}") == 0);
+	free(json);
+
+	/* The buffer is still the caller's to free. */
+	json_delete(root);
+	free(buf);
+
+	buf = strdup("{\"a\":\"b\\n\",}");
+	CHECK(json_decode_insitu(buf) == NULL);
+	free(buf);
+}
+
+/* The first member of @object named @key, found the slow way. */
+static JsonNode *first_member(JsonNode *object, const char *key)
+{
+	JsonNode *member;
+
+	json_foreach(member, object)
+		if (strcmp(member->key, key) == 0)
+			return member;
+	return NULL;
+}
+
+/* Member indexes keep finding the first of duplicate keys as members come and go. */
+static void test_member_index(void)
+{
+	JsonNode *object = json_mkobject();
+	JsonNode *member;
+	char key[16];
+	int i, k, n, mismatches = 0;
+
+	json_index_members(object);
+	for (i = 0; i < 5000; i++) {
+		sprintf(key, "key%d", (int) (random_bits() % 32));
+		switch (random_bits() % 4) {
+		case 0:
+			json_append_member(object, key, json_mknumber(i));
+			break;
+		case 1:
+			json_prepend_member(object, key, json_mknumber(i));
+			break;
+		case 2:
+			json_delete(first_member(object, key));
+			break;
+		default:
+			/* Any member, which may be shadowed by an earlier one. */
+			n = 0;
+			json_foreach(member, object)
+				n++;
+			member = json_first_child(object);
+			for (k = n > 0 ? (int) (random_bits() % n) : 0; k > 0; k--)
+				member = member->next;
+			json_delete(member);
+		}
+
+		for (k = 0; k < 32; k++) {
+			sprintf(key, "key%d", k);
+			member = first_member(object, key);
+			if (json_find_member(object, key) != member || json_find_member_interned(object, json_intern(key)) != member)
+				mismatches++;
+		}
+		if (!json_check(object, NULL))
+			mismatches++;
+	}
+	CHECK(mismatches == 0);
+	json_delete(object);
+}
+
+/* Element indexes stay in order as elements are added and removed at either end and in between. */
+static void test_element_index(void)
+{
+	JsonNode *array = json_mkarray();
+	JsonNode *element;
+	static int expected[20000];
+	int i, k, n = 0, mismatches = 0;
+
+	json_index_elements(array);
+	for (i = 0; i < 20000; i++) {
+		switch (random_bits() % 5) {
+		case 0:
+		case 1:
+			json_append_element(array, json_mknumber(i));
+			expected[n++] = i;
+			break;
+		case 2:
+			json_prepend_element(array, json_mknumber(i));
+			memmove(expected + 1, expected, n++ * sizeof(int));
+			expected[0] = i;
+			break;
+		case 3:
+			if (n == 0)
+				break;
+			k = random_bits() % 4 == 0 ? (int) (random_bits() % n) : (random_bits() % 2 ? 0 : n - 1);
+			json_delete(json_find_element(array, k));
+			memmove(expected + k, expected + k + 1, (--n - k) * sizeof(int));
+			break;
+		default:
+			if (n == 0)
+				break;
+			element = json_find_element(array, n - 1);
+			json_remove_from_parent(element);
+			json_prepend_element(array, element);
+			memmove(expected + 1, expected, (n - 1) * sizeof(int));
+			expected[0] = (int) element->number_;
+		}
+
+		for (k = 0; k < 8 && n > 0; k++) {
+			int at = k < 2 ? (k == 0 ? 0 : n - 1) : (int) (random_bits() % n);
+
+			element = json_find_element(array, at);
+			if (element == NULL || element->number_ != expected[at])
+				mismatches++;
+		}
+		if (json_find_element(array, n) != NULL || json_array_length(array) != n)
+			mismatches++;
+		if (i % 64 == 0 && !json_check(array, NULL))
+			mismatches++;
+	}
+	CHECK(mismatches == 0 && json_check(array, NULL));
+	json_delete(array);
+}
+
+/* Taking elements off either end of an indexed array, or deleting it, is not quadratic. */
+static void test_indexed_array_removal(void)
+{
+	JsonNode *array = json_mkarray();
+	JsonNode *element;
+	clock_t start;
+	int i, mismatches = 0;
+
+	for (i = 0; i < 200000; i++)
+		json_append_element(array, json_mknumber(i));
+	json_index_elements(array);
+
+	start = clock();
+	for (i = 0; i < 50000; i++) {
+		json_delete(json_find_element(array, 0));
+		json_delete(json_find_element(array, json_array_length(array) - 1));
+		element = json_find_element(array, 1000);
+		if (element == NULL || element->number_ != i + 1001)
+			mismatches++;
+	}
+	CHECK(mismatches == 0);
+	CHECK(json_array_length(array) == 100000 && json_check(array, NULL));
+	CHECK(json_find_element(array, 0)->number_ == 50000);
+	CHECK(json_find_element(array, 99999)->number_ == 149999);
+
+	json_delete(array);
+	CHECK(clock() - start < CLOCKS_PER_SEC);
+}
+
+/* Appends a random JSON value of at most @depth levels to @out. */
+static void random_value(char **out, int depth)
+{
+	static const char *const scalars[] = {
+		"null", "true", "false", "0", "-0", "7", "-12.5e3", "1E-2", "0.000001", "123456789012345678901",
+		"9223372036854775807", "\"\"", "\"label\"", "\"a \\\"quoted\\\" \\\\ \\/ \\b\\f\\n\\r\\t value\"",
+		"\"\\u00e9\\ud83d\\ude00\"", "\"caf\xc3\xa9 \xf0\x9f\x8d\xb0\"",
+		"\"a plain string long enough to span more than one block of sixteen bytes\"",
+	};
+	static const char *const spaces[] = {"", "", " ", "\n\t ", "\r\n"};
+	int i, n;
+
+	*out += sprintf(*out, "%s", spaces[random_bits() % 5]);
+	switch (depth > 0 ? random_bits() % 4 : 0) {
+	case 1:
+		*out += sprintf(*out, "[");
+		n = (int) (random_bits() % 5);
+		for (i = 0; i < n; i++) {
+			if (i > 0)
+				*out += sprintf(*out, ",");
+			random_value(out, depth - 1);
+		}
+		*out += sprintf(*out, "]");
+		break;
+	case 2:
+		*out += sprintf(*out, "{");
+		n = (int) (random_bits() % 5);
+		for (i = 0; i < n; i++) {
+			*out += sprintf(*out, "%s\"key%d\"%s:", i > 0 ? "," : "", (int) (random_bits() % 4), spaces[random_bits() % 5]);
+			random_value(out, depth - 1);
+		}
+		*out += sprintf(*out, "}");
+		break;
+	default:
+		*out += sprintf(*out, "%s", scalars[random_bits() % (sizeof(scalars) / sizeof(scalars[0]))]);
+	}
+	*out += sprintf(*out, "%s", spaces[random_bits() % 5]);
+}
+
+/* Feeds @json to a streaming parser in random chunks, each in a buffer of its own. */
+static JsonNode *parse_in_chunks(const char *json)
+{
+	JsonParser *parser = json_parser_new(NULL, NULL);
+	size_t len = strlen(json), off = 0;
+	JsonNode *root = NULL;
+	bool ok = true;
+
+	while (ok && off < len) {
+		size_t n = random_bits() % 4 == 0 ? 1 + random_bits() % 64 : 1 + random_bits() % 4;
+		char *chunk;
+
+		if (n > len - off)
+			n = len - off;
+		chunk = malloc(n);
+		memcpy(chunk, json + off, n);
+		ok = json_parser_feed(parser, chunk, n);
+		free(chunk);
+		off += n;
+	}
+	if (!json_parser_finish(parser, &root))
+		return NULL;
+	return root;
+}
+
+static bool stop_at_key(void *ctx, const char *key)
+{
+	(void) ctx;
+	return strcmp(key, "stop") != 0;
+}
+
+/* Whether two trees encode the same. */
+static bool same_tree(const JsonNode *a, const JsonNode *b)
+{
+	char *x = json_encode(a), *y = json_encode(b);
+	bool same = strcmp(x, y) == 0;
+
+	free(x);
+	free(y);
+	return same;
+}
+
+/* The streaming parser accepts what json_decode accepts and builds the same tree. */
+static void test_parser(void)
+{
+	static const char mutations[] = "{}[],:\"\\ 0-+.eEtfnu\x01\xc3\xa9";
+	JsonCallbacks callbacks = {0};
+	JsonParser *parser;
+	char json[8192], *out;
+	int i, mismatches = 0, valid = 0;
+
+	for (i = 0; i < 100000; i++) {
+		JsonNode *expected, *node;
+		size_t len;
+
+		out = json;
+		random_value(&out, (int) (random_bits() % 5));
+		len = out - json;
+
+		/* Break half of them, by a byte or by cutting them short. */
+		if (i % 2 == 1 && len > 0) {
+			size_t at = random_bits() % len;
+
+			switch (random_bits() % 3) {
+			case 0:
+				memmove(json + at, json + at + 1, len - at);
+				break;
+			case 1:
+				json[at] = mutations[random_bits() % (sizeof(mutations) - 1)];
+				break;
+			default:
+				json[at] = 0;
+			}
+		}
+
+		expected = json_decode(json);
+		node = parse_in_chunks(json);
+		if (expected != NULL)
+			valid++;
+		if ((expected == NULL) != (node == NULL) ||
+		    (expected != NULL && (!json_check(node, NULL) || !same_tree(expected, node)))) {
+			if (mismatches++ < 10)
+				fprintf(stderr, "streaming parser and json_decode disagree on %s\n", json);
+			failures++;
+		}
+		json_delete(expected);
+		json_delete(node);
+	}
+	CHECK(valid > 50000 && valid < 90000);
+
+	/* A callback that returns false fails the parse. */
+	callbacks.key = stop_at_key;
+	parser = json_parser_new(&callbacks, NULL);
+	CHECK(json_parser_feed(parser, "{\"go\":1,", 8));
+	CHECK(!json_parser_feed(parser, "\"stop\":2}", 9));
+	CHECK(!json_parser_finish(parser, NULL));
+}
+
+/* Whether the value under @cursor is @node, compared the slow way. */
+static bool tape_matches(JsonCursor cursor, JsonNode *node)
+{
+	JsonCursor child;
+	JsonNode *n;
+	int64_t a, b;
+	bool more;
+
+	if (json_tape_tag(cursor) != node->tag)
+		return false;
+
+	switch (node->tag) {
+	case JSON_BOOL:
+		return json_tape_bool(cursor) == node->bool_;
+	case JSON_STRING:
+		return strcmp(json_tape_string(cursor), node->string_) == 0;
+	case JSON_NUMBER:
+		if (json_tape_int64(cursor, &a) != json_get_int64(node, &b) || (json_get_int64(node, &b) && a != b))
+			return false;
+		return json_tape_number(cursor) == node->number_;
+	case JSON_ARRAY:
+	case JSON_OBJECT:
+		if (json_tape_length(cursor) != node->children.length)
+			return false;
+		more = json_tape_first(cursor, &child);
+		json_foreach(n, node) {
+			const char *key = json_tape_key(child);
+
+			if (!more || !tape_matches(child, n))
+				return false;
+			if (node->tag == JSON_OBJECT && (key == NULL || strcmp(key, n->key) != 0))
+				return false;
+			if (node->tag == JSON_ARRAY && key != NULL)
+				return false;
+			more = json_tape_next(&child);
+		}
+		return !more;
+	default:
+		return true;
+	}
+}
+
+static void test_tape(void)
+{
+	static const char *const valid[] = {
+		"null",
+		" true ",
+		"-12.5e3",
+		"9223372036854775807",
+		"\"\"",
+		"[]",
+		"{}",
+		"[[], {}, [[]]]",
+		"{\"a\":[1,2,{\"b\":\"c\\\\\\\"d\"}],\"e\":null,\"f\":true,\"g\":false}",
+		"{\"k\\u00e9y\" : \"\\ud83d\\ude00 \u00e9\" , \"\" : [ \"\\\\\" , \"\\/\" ] }",
+		"[\"a string long enough to span more than one block of the index, with {brackets}, [more brackets], colons: and, commas\"]",
+	};
+	static const char *const invalid[] = {
+		"",
+		" ",
+		"[",
+		"]",
+		"[1,]",
+		"[1 2]",
+		"{\"a\"}",
+		"{\"a\":}",
+		"{\"a\":1,}",
+		"{1:2}",
+		"[1}",
+		"{\"a\":1]",
+		"tru",
+		"truex",
+		"nul",
+		"1 2",
+		"01",
+		"\"unterminated",
+		"\"bad \\x escape\"",
+		"\"a\"\"b\"",
+		"[\"a\"1]",
+		"[1\"a\"]",
+		"{}{}",
+		"[\"\t\"]",
+	};
+	JsonCursor root, value, child;
+	JsonTape *tape;
+	JsonNode *node;
+	size_t i;
+
+	for (i = 0; i < sizeof(valid) / sizeof(valid[0]); i++) {
+		tape = json_tape_parse(valid[i]);
+		node = json_decode(valid[i]);
+		CHECK(tape != NULL && node != NULL);
+		if (tape != NULL && node != NULL && !tape_matches(json_tape_root(tape), node)) {
+			fprintf(stderr, "tape of %s differs from the tree\n", valid[i]);
+			failures++;
+		}
+		json_delete(node);
+		json_tape_free(tape);
+	}
+
+	for (i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++) {
+		tape = json_tape_parse(invalid[i]);
+		if (tape != NULL) {
+			fprintf(stderr, "tape accepted %s\n", invalid[i]);
+			failures++;
+		}
+		json_tape_free(tape);
+	}
+
+	/* Skipping a member skips everything inside it. */
+	tape = json_tape_parse("{\"Menu\":{\"Items\":[{\"ID\":\"1\"},{\"ID\":\"2\"}]},\"ID\":\"root\",\"Count\":3}");
+	root = json_tape_root(tape);
+	CHECK(json_tape_find(root, "ID", &value) && strcmp(json_tape_string(value), "root") == 0);
+	CHECK(strcmp(json_tape_key(value), "ID") == 0);
+	CHECK(json_tape_find(root, "Count", &value) && json_tape_number(value) == 3);
+	CHECK(!json_tape_find(root, "Missing", &value));
+	CHECK(!json_tape_find(value, "ID", &child));
+	CHECK(json_tape_key(root) == NULL);
+
+	CHECK(json_tape_find(root, "Menu", &value) && json_tape_find(value, "Items", &value));
+	CHECK(json_tape_length(value) == 2);
+	CHECK(json_tape_first(value, &child) && json_tape_key(child) == NULL);
+	CHECK(json_tape_next(&child) && json_tape_find(child, "ID", &value));
+	CHECK(strcmp(json_tape_string(value), "2") == 0);
+	CHECK(!json_tape_next(&child));
+	CHECK(json_tape_string(child) == NULL && json_tape_length(value) == -1);
+	json_tape_free(tape);
+}
+
+static void test_compact(void)
+{
+	static const char json[] =
+		"{\"Menu\":{\"Items\":[{\"ID\":\"1\",\"Label\":\"A label too long to be inline\",\"Checked\":true},"
+		"{\"ID\":\"2\",\"Type\":\"Text\",\"Disabled\":false,\"Submenu\":[]}]},"
+		"\"Big\":9007199254740993,\"RGBA\":[0.25,1,-3e-7],\"Empty\":{},\"Nothing\":null}";
+	JsonCompact *doc = json_compact_decode(json);
+	const JsonCompactNode *root, *items, *item;
+	JsonNode *node = json_decode(json), *back;
+	char *a, *b;
+	int64_t big;
+	int count = 0;
+
+	CHECK(doc != NULL);
+	CHECK(json_compact_decode("[1,") == NULL);
+	root = json_compact_root(doc);
+
+	/* Converting back gives the same document. */
+	back = json_compact_to_node(root);
+	a = json_encode(node);
+	b = json_encode(back);
+	CHECK(strcmp(a, b) == 0);
+	free(a);
+	free(b);
+	json_delete(back);
+
+	items = json_compact_find_member(json_compact_find_member(root, "Menu"), "Items");
+	CHECK(json_compact_length(items) == 2);
+	CHECK(json_compact_key(items) != NULL && strcmp(json_compact_key(items), "Items") == 0);
+	json_compact_foreach(item, items) {
+		CHECK(json_compact_key(item) == NULL);
+		CHECK(json_compact_tag(item) == JSON_OBJECT);
+		count++;
+	}
+	CHECK(count == 2);
+
+	item = json_compact_find_element(items, 0);
+	CHECK(strcmp(json_compact_string(json_compact_find_member(item, "ID")), "1") == 0);
+	CHECK(strcmp(json_compact_string(json_compact_find_member(item, "Label")), "A label too long to be inline") == 0);
+	CHECK(json_compact_bool(json_compact_find_member(item, "Checked")));
+	CHECK(json_compact_find_member(item, "Type") == NULL);
+	item = json_compact_find_element(items, 1);
+	CHECK(strcmp(json_compact_string(json_compact_find_member(item, "Type")), "Text") == 0);
+	CHECK(!json_compact_bool(json_compact_find_member(item, "Disabled")));
+	CHECK(json_compact_first_child(json_compact_find_member(item, "Submenu")) == NULL);
+	CHECK(json_compact_find_element(items, 2) == NULL);
+	CHECK(json_compact_find_element(items, -1) == NULL);
+
+	CHECK(json_compact_int64(json_compact_find_member(root, "Big"), &big) && big == 9007199254740993LL);
+	CHECK(json_compact_number(json_compact_find_element(json_compact_find_member(root, "RGBA"), 2)) == -3e-7);
+	CHECK(json_compact_length(json_compact_find_member(root, "Empty")) == 0);
+	CHECK(json_compact_tag(json_compact_find_member(root, "Nothing")) == JSON_NULL);
+	CHECK(json_compact_string(root) == NULL && json_compact_length(json_compact_find_member(item, "ID")) == -1);
+
+	json_delete(node);
+	json_compact_free(doc);
+}
+
+static void test_intern(void)
+{
+	static const char long_key[] = "a key that is much too long to be interned by the decoder";
+	const char *label = json_intern("Label");
+	const char *checked = json_intern("Checked");
+	JsonNode *a = json_decode("{\"Label\":\"a\",\"Checked\":true,\"a key that is much too long to be interned by the decoder\":1}");
+	JsonNode *b = json_decode_arena("[{\"Checked\":false,\"Label\":\"b\"}]");
+	char buf[] = "{\"Label\":\"c\"}";
+	JsonNode *c = json_decode_insitu(buf);
+	JsonNode *item = json_find_element(b, 0);
+	JsonNode *node;
+	int i;
+	char key[16];
+
+	CHECK(json_intern("Label") == label && strcmp(label, "Label") == 0);
+	CHECK(label != checked);
+
+	/* Decoded keys are shared, except the long one and those of arena documents. */
+	CHECK(json_find_member(a, "Label")->key == label);
+	CHECK(json_find_member(a, "Checked")->key == checked);
+	CHECK(json_find_member(a, long_key)->key != json_intern(long_key));
+	CHECK(json_find_member(item, "Label")->key != label);
+
+	CHECK(strcmp(json_find_member_interned(a, label)->string_, "a") == 0);
+	CHECK(strcmp(json_find_member_interned(item, label)->string_, "b") == 0);
+	CHECK(json_find_member_interned(item, checked)->bool_ == false);
+	CHECK(json_find_member_interned(a, json_intern(long_key))->number_ == 1);
+	CHECK(json_find_member_interned(a, json_intern("Missing")) == NULL);
+
+	/* Keys that were not interned are still found, either way round. */
+	CHECK(strcmp(json_find_member_interned(c, label)->string_, "c") == 0);
+	strcpy(key, "Label");
+	CHECK(strcmp(json_find_member_interned(a, key)->string_, "a") == 0);
+	CHECK(json_find_member_interned(item, key) == json_find_member(item, "Label"));
+	json_append_member(a, "Tooltip", json_mkstring("t"));
+	CHECK(strcmp(json_find_member_interned(a, json_intern("Tooltip"))->string_, "t") == 0);
+
+	/* A member that moves to another object gets its own key. */
+	node = json_find_member(a, "Label");
+	json_remove_from_parent(node);
+	json_append_member(a, "Label", node);
+	CHECK(node->key != label && json_find_member_interned(a, label) == node);
+
+	/* Indexed objects are looked up the same way. */
+	for (i = 0; i < 20; i++) {
+		sprintf(key, "key%d", i);
+		json_append_member(a, key, json_mknumber(i));
+	}
+	json_index_members(a);
+	CHECK(json_find_member_interned(a, json_intern("key17"))->number_ == 17);
+	CHECK(json_find_member_interned(a, checked)->bool_);
+
+	json_delete(a);
+	json_delete(b);
+	json_delete(c);
+}
+
+#ifndef JSON_NO_POOL
+/* A small document decoded over and over is served from the pool. */
+static void test_pool(void)
+{
+	static const char json[] = "{\"ID\":\"tray-1\",\"Label\":\"a label longer than thirty-one bytes\","
+		"\"FontSize\":12,\"StyledLabel\":[{\"Label\":\"x\"}]}";
+	JsonPoolStats before, after;
+	JsonNode *node;
+	int i;
+
+	json_delete(json_decode(json));
+	json_pool_stats(&before);
+	for (i = 0; i < 100; i++) {
+		node = json_decode(json);
+		CHECK(strcmp(json_find_member(node, "ID")->string_, "tray-1") == 0);
+		json_delete(node);
+	}
+	json_pool_stats(&after);
+
+	CHECK(after.node_misses == before.node_misses);
+	CHECK(after.string_misses == before.string_misses);
+	CHECK(after.node_hits - before.node_hits == 100 * 7);
+	CHECK(after.string_hits - before.string_hits == 100 * 2);
+	CHECK(after.nodes_cached == before.nodes_cached && after.nodes_cached >= 7);
+
+	/* Nodes made by hand come from the same pool. */
+	node = json_mkobject();
+	json_append_member(node, "Label", json_mkstring("short"));
+	json_delete(node);
+	json_pool_stats(&before);
+	CHECK(before.node_misses == after.node_misses);
+
+	json_pool_trim();
+	json_pool_stats(&after);
+	CHECK(after.nodes_cached == 0 && after.strings_cached == 0);
+	json_delete(json_decode(json));
+	json_pool_stats(&after);
+	CHECK(after.node_misses == before.node_misses + 7);
+}
+#endif
+
+static void test_extract(void)
+{
+	static const char *const keys[] = {"ID", "Label", "Checked", "a key that is much too long to be interned by the decoder", "Missing"};
+	static JsonSchema schema = JSON_SCHEMA(keys);
+	static const char json[] = "{\"Label\":\"first\",\"Other\":1,\"ID\":\"7\",\"Label\":\"second\","
+		"\"a key that is much too long to be interned by the decoder\":true,\"Checked\":false}";
+	JsonNode *fields[5];
+	JsonNode *node;
+	char buf[sizeof(json)];
+	int i;
+
+	/* Interned keys, copied keys and keys added by hand all match. */
+	for (i = 0; i < 3; i++) {
+		if (i == 0) {
+			node = json_decode(json);
+		} else if (i == 1) {
+			node = json_decode_insitu(strcpy(buf, json));
+		} else {
+			node = json_mkobject();
+			json_append_member(node, "Checked", json_mkbool(false));
+			json_append_member(node, keys[3], json_mkbool(true));
+			json_append_member(node, "ID", json_mkstring("7"));
+			json_append_member(node, "Label", json_mkstring("first"));
+		}
+
+		CHECK(json_extract(&schema, node, fields) == 4);
+		CHECK(fields[0] != NULL && strcmp(fields[0]->string_, "7") == 0);
+		CHECK(fields[1] != NULL && strcmp(fields[1]->string_, "first") == 0);
+		CHECK(fields[2] != NULL && fields[2]->tag == JSON_BOOL && !fields[2]->bool_);
+		CHECK(fields[3] != NULL && fields[3]->bool_);
+		CHECK(fields[4] == NULL);
+		json_delete(node);
+	}
+
+	node = json_decode("[1]");
+	CHECK(json_extract(&schema, node, fields) == -1 && fields[0] == NULL);
+	CHECK(json_extract(&schema, NULL, fields) == -1);
+	json_delete(node);
+}
+
+static void test_menu_schema(void)
+{
+	JsonNode *item = json_decode("{\"ID\":\"3\",\"Label\":\"Open\",\"Type\":\"Checkbox\",\"Checked\":true,"
+		"\"FontSize\":13,\"Accelerator\":{\"Key\":\"o\"},\"Tooltip\":5}");
+	JsonNode *tray = json_decode("{\"ID\":\"tray\",\"Label\":\"CPU\",\"Image\":\"icon\",\"MacTemplateImage\":true,"
+		"\"FontSize\":99999999999,\"ProcessedMenu\":{\"Menu\":{}}}");
+	JsonNode *update = json_decode("{\"ID\":\"tray\",\"Label\":\"CPU 42%\",\"Disabled\":true,\"StyledLabel\":[]}");
+	MenuItemFields itemFields;
+	TrayMenuFields trayFields;
+	TrayLabelFields labelFields;
+
+	ReadMenuItemFields(item, &itemFields);
+	CHECK(strcmp(itemFields.ID, "3") == 0 && strcmp(itemFields.label, "Open") == 0);
+	CHECK(strcmp(itemFields.type, "Checkbox") == 0 && itemFields.checked && !itemFields.disabled);
+	CHECK(itemFields.fontSize == 13 && strcmp(itemFields.tooltip, "") == 0 && strcmp(itemFields.image, "") == 0);
+	CHECK(itemFields.accelerator == json_find_member(item, "Accelerator"));
+	CHECK(itemFields.role == NULL && itemFields.subMenu == NULL && itemFields.styledLabel == NULL);
+
+	ReadTrayMenuFields(tray, &trayFields);
+	CHECK(strcmp(trayFields.ID, "tray") == 0 && strcmp(trayFields.icon, "icon") == 0);
+	CHECK(trayFields.templateImage && !trayFields.disabled && trayFields.fontSize == 0);
+	CHECK(trayFields.processedMenu == json_find_member(tray, "ProcessedMenu"));
+
+	ReadTrayLabelFields(update, &labelFields);
+	CHECK(strcmp(labelFields.label, "CPU 42%") == 0 && labelFields.disabled);
+	CHECK(labelFields.styledLabel != NULL && labelFields.styledLabel->tag == JSON_ARRAY);
+	CHECK(strcmp(labelFields.fontName, "") == 0 && strcmp(labelFields.RGBA, "") == 0);
+
+	/* Anything but an object reads as all defaults. */
+	ReadMenuItemFields(NULL, &itemFields);
+	CHECK(itemFields.type == NULL && strcmp(itemFields.label, "") == 0 && !itemFields.hidden);
+
+	json_delete(item);
+	json_delete(tray);
+	json_delete(update);
+}
+
+/* Collects the nodes a patch reports, encoded. */
+static void collect_change(JsonNode *node, void *ctx)
+{
+	char *text = json_encode(node);
+	char *changes = ctx;
+
+	if (*changes != 0)
+		strcat(changes, " ");
+	strcat(changes, text);
+	free(text);
+}
+
+static void test_merge_patch(void)
+{
+	/* The examples of RFC 7396, appendix A. */
+	static const char *const cases[][3] = {
+		{"{\"a\":\"b\"}", "{\"a\":\"c\"}", "{\"a\":\"c\"}"},
+		{"{\"a\":\"b\"}", "{\"b\":\"c\"}", "{\"a\":\"b\",\"b\":\"c\"}"},
+		{"{\"a\":\"b\"}", "{\"a\":null}", "{}"},
+		{"{\"a\":\"b\",\"b\":\"c\"}", "{\"a\":null}", "{\"b\":\"c\"}"},
+		{"{\"a\":[\"b\"]}", "{\"a\":\"c\"}", "{\"a\":\"c\"}"},
+		{"{\"a\":\"c\"}", "{\"a\":[\"b\"]}", "{\"a\":[\"b\"]}"},
+		{"{\"a\":{\"b\":\"c\"}}", "{\"a\":{\"b\":\"d\",\"c\":null}}", "{\"a\":{\"b\":\"d\"}}"},
+		{"{\"a\":[{\"b\":\"c\"}]}", "{\"a\":[1]}", "{\"a\":[1]}"},
+		{"[\"a\",\"b\"]", "[\"c\",\"d\"]", "[\"c\",\"d\"]"},
+		{"{\"a\":\"b\"}", "[\"c\"]", "[\"c\"]"},
+		{"{\"a\":\"foo\"}", "null", "null"},
+		{"{\"a\":\"foo\"}", "\"bar\"", "\"bar\""},
+		{"{\"e\":null}", "{\"a\":1}", "{\"e\":null,\"a\":1}"},
+		{"[1,2]", "{\"a\":\"b\",\"c\":null}", "{\"a\":\"b\"}"},
+		{"{}", "{\"a\":{\"bb\":{\"ccc\":null}}}", "{\"a\":{\"bb\":{}}}"},
+	};
+	char changes[256];
+	JsonNode *node, *patch;
+	char *text;
+	size_t i;
+
+	for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+		node = json_decode(cases[i][0]);
+		patch = json_decode(cases[i][1]);
+		json_merge_patch(&node, patch, NULL, NULL);
+		text = json_encode(node);
+		CHECK(strcmp(text, cases[i][2]) == 0);
+		CHECK(json_check(node, NULL));
+		free(text);
+		json_delete(patch);
+		json_delete(node);
+	}
+
+	/* Only what differs is replaced and reported, and members keep their place. */
+	node = json_decode("{\"ID\":\"1\",\"Label\":\"Quit\",\"Checked\":false,\"Accelerator\":{\"Key\":\"q\"}}");
+	json_index_members(node);
+	patch = json_decode("{\"Label\":\"Quit\",\"Checked\":true,\"Accelerator\":{\"Key\":\"q\",\"Modifiers\":null},\"Tooltip\":\"Bye\"}");
+	changes[0] = 0;
+	json_merge_patch(&node, patch, collect_change, changes);
+	CHECK(strcmp(changes, "true \"Bye\"") == 0);
+	text = json_encode(node);
+	CHECK(strcmp(text, "{\"ID\":\"1\",\"Label\":\"Quit\",\"Checked\":true,\"Accelerator\":{\"Key\":\"q\"},\"Tooltip\":\"Bye\"}") == 0);
+	free(text);
+	CHECK(json_find_member(node, "Checked")->bool_ && json_find_member(node, "Checked")->key == json_intern("Checked"));
+	json_delete(patch);
+	json_delete(node);
+
+	/* Arena trees can be patched too. */
+	node = json_decode_arena("{\"a\":{\"b\":1},\"c\":2}");
+	patch = json_decode("{\"a\":{\"b\":[true]},\"c\":null}");
+	json_merge_patch(&node, patch, NULL, NULL);
+	text = json_encode(node);
+	CHECK(strcmp(text, "{\"a\":{\"b\":[true]}}") == 0);
+	free(text);
+	json_delete(patch);
+	json_delete(node);
+}
+
+static void test_patch(void)
+{
+	/* Examples from RFC 6902, appendix A, and the failures it describes. */
+	static const char *const cases[][3] = {
+		{"{\"foo\":\"bar\"}", "[{\"op\":\"add\",\"path\":\"/baz\",\"value\":\"qux\"}]", "{\"foo\":\"bar\",\"baz\":\"qux\"}"},
+		{"{\"foo\":[\"bar\",\"baz\"]}", "[{\"op\":\"add\",\"path\":\"/foo/1\",\"value\":\"qux\"}]", "{\"foo\":[\"bar\",\"qux\",\"baz\"]}"},
+		{"{\"baz\":\"qux\",\"foo\":\"bar\"}", "[{\"op\":\"remove\",\"path\":\"/baz\"}]", "{\"foo\":\"bar\"}"},
+		{"{\"foo\":[\"bar\",\"qux\",\"baz\"]}", "[{\"op\":\"remove\",\"path\":\"/foo/1\"}]", "{\"foo\":[\"bar\",\"baz\"]}"},
+		{"{\"baz\":\"qux\",\"foo\":\"bar\"}", "[{\"op\":\"replace\",\"path\":\"/baz\",\"value\":\"boo\"}]", "{\"baz\":\"boo\",\"foo\":\"bar\"}"},
+		{"{\"foo\":{\"bar\":\"baz\",\"waldo\":\"fred\"},\"qux\":{\"corge\":\"grault\"}}",
+		 "[{\"op\":\"move\",\"from\":\"/foo/waldo\",\"path\":\"/qux/thud\"}]",
+		 "{\"foo\":{\"bar\":\"baz\"},\"qux\":{\"corge\":\"grault\",\"thud\":\"fred\"}}"},
+		{"{\"foo\":[\"all\",\"grass\",\"cows\",\"eat\"]}", "[{\"op\":\"move\",\"from\":\"/foo/1\",\"path\":\"/foo/3\"}]",
+		 "{\"foo\":[\"all\",\"cows\",\"eat\",\"grass\"]}"},
+		{"{\"baz\":\"qux\",\"foo\":[\"a\",2,\"c\"]}",
+		 "[{\"op\":\"test\",\"path\":\"/baz\",\"value\":\"qux\"},{\"op\":\"test\",\"path\":\"/foo/1\",\"value\":2}]",
+		 "{\"baz\":\"qux\",\"foo\":[\"a\",2,\"c\"]}"},
+		{"{\"baz\":\"qux\"}", "[{\"op\":\"test\",\"path\":\"/baz\",\"value\":\"bar\"}]", NULL},
+		{"{\"foo\":\"bar\"}", "[{\"op\":\"add\",\"path\":\"/child\",\"value\":{\"grandchild\":{}}}]", "{\"foo\":\"bar\",\"child\":{\"grandchild\":{}}}"},
+		{"{\"foo\":\"bar\"}", "[{\"op\":\"add\",\"path\":\"/baz/bat\",\"value\":\"qux\"}]", NULL},
+		{"{\"/\":9,\"~1\":10}", "[{\"op\":\"test\",\"path\":\"/~01\",\"value\":10},{\"op\":\"copy\",\"from\":\"/~1\",\"path\":\"/a\"}]",
+		 "{\"/\":9,\"~1\":10,\"a\":9}"},
+		{"{\"foo\":[\"bar\"]}", "[{\"op\":\"add\",\"path\":\"/foo/-\",\"value\":[\"abc\",\"def\"]}]", "{\"foo\":[\"bar\",[\"abc\",\"def\"]]}"},
+		{"{\"foo\":[\"bar\"]}", "[{\"op\":\"add\",\"path\":\"/foo/2\",\"value\":1}]", NULL},
+		{"{\"foo\":[\"bar\"]}", "[{\"op\":\"add\",\"path\":\"/foo/01\",\"value\":1}]", NULL},
+		{"{\"foo\":{\"bar\":1}}", "[{\"op\":\"move\",\"from\":\"/foo\",\"path\":\"/foo/bar\"}]", NULL},
+		{"{\"foo\":1}", "[{\"op\":\"replace\",\"path\":\"\",\"value\":[1]}]", "[1]"},
+		{"{\"foo\":1}", "[{\"op\":\"remove\",\"path\":\"/bar\"}]", NULL},
+		{"{\"foo\":1}", "[{\"op\":\"frobnicate\",\"path\":\"/foo\"}]", NULL},
+		{"{\"foo\":1}", "{\"op\":\"remove\",\"path\":\"/foo\"}", NULL},
+	};
+	char changes[256];
+	JsonNode *node, *patch;
+	char *text;
+	size_t i;
+
+	for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+		node = json_decode(cases[i][0]);
+		patch = json_decode(cases[i][1]);
+		CHECK(json_patch(&node, patch, NULL, NULL) == (cases[i][2] != NULL));
+		CHECK(json_check(node, NULL));
+		if (cases[i][2] != NULL) {
+			text = json_encode(node);
+			CHECK(strcmp(text, cases[i][2]) == 0);
+			free(text);
+		}
+		json_delete(patch);
+		json_delete(node);
+	}
+
+	/* Ticking one checkbox touches that item alone. */
+	node = json_decode("{\"Menu\":{\"Items\":[{\"ID\":\"1\",\"Checked\":false},{\"ID\":\"2\",\"Checked\":false}]}}");
+	json_index_elements(json_find_member(json_find_member(node, "Menu"), "Items"));
+	patch = json_decode("[{\"op\":\"replace\",\"path\":\"/Menu/Items/1/Checked\",\"value\":true},"
+		"{\"op\":\"replace\",\"path\":\"/Menu/Items/0/Checked\",\"value\":false},"
+		"{\"op\":\"add\",\"path\":\"/Menu/Items/0\",\"value\":{\"ID\":\"0\"}}]");
+	changes[0] = 0;
+	CHECK(json_patch(&node, patch, collect_change, changes));
+	CHECK(strcmp(changes, "true {\"ID\":\"0\"}") == 0);
+	CHECK(strcmp(json_find_member(json_find_element(json_find_member(json_find_member(node, "Menu"), "Items"), 2), "ID")->string_, "2") == 0);
+	json_delete(patch);
+	json_delete(node);
+}
+
+/* Patches keep the indexes of large containers up to date instead of rebuilding them. */
+static void test_patch_large(void)
+{
+	JsonNode *node = json_mkobject(), *items = json_mkarray();
+	JsonNode *patch = json_mkobject(), *ops = json_mkarray();
+	JsonNode *op, *member;
+	clock_t start;
+	char key[32];
+	int i, mismatches = 0;
+
+	for (i = 0; i < 20000; i++) {
+		sprintf(key, "item%d", i);
+		json_append_member(node, key, json_mknumber(i));
+		json_append_member(patch, key, i % 2 == 0 ? json_mkstring("even") : json_mknull());
+		json_append_element(items, json_mknumber(i));
+	}
+	json_append_member(node, "Items", items);
+	json_index_members(node);
+	json_index_elements(items);
+
+	start = clock();
+	json_merge_patch(&node, patch, NULL, NULL);
+	for (i = 0; i < 20000; i++) {
+		sprintf(key, "item%d", i);
+		member = json_find_member(node, key);
+		if (i % 2 == 0 ? member == NULL || member->tag != JSON_STRING : member != NULL)
+			mismatches++;
+	}
+	CHECK(mismatches == 0);
+
+	/* Replace every element, and take out and put back every other one. */
+	for (i = 0; i < 10000; i++) {
+		op = json_mkobject();
+		json_append_member(op, "op", json_mkstring("replace"));
+		sprintf(key, "/Items/%d", i * 2);
+		json_append_member(op, "path", json_mkstring(key));
+		json_append_member(op, "value", json_mkstring("replaced"));
+		json_append_element(ops, op);
+
+		op = json_mkobject();
+		json_append_member(op, "op", json_mkstring("move"));
+		sprintf(key, "/Items/%d", i * 2 + 1);
+		json_append_member(op, "from", json_mkstring(key));
+		json_append_member(op, "path", json_mkstring(key));
+		json_append_element(ops, op);
+	}
+	CHECK(json_patch(&node, ops, NULL, NULL));
+	CHECK(clock() - start < CLOCKS_PER_SEC);
+	CHECK(json_check(node, NULL));
+	CHECK(json_array_length(items) == 20000);
+	CHECK(strcmp(json_find_element(items, 19998)->string_, "replaced") == 0);
+	CHECK(json_find_element(items, 19999)->number_ == 19999);
+
+	json_delete(ops);
+	json_delete(patch);
+	json_delete(node);
+}
+
+static void test_hash_text(void)
+{
+	static const char menu[] = "{\"Menu\":{\"Items\":[{\"ID\":\"1\",\"Label\":\"Quit\",\"Checked\":false}]},\"RadioGroups\":null}";
+	char copy[sizeof(menu)];
+	size_t i;
+
+	strcpy(copy, menu);
+	CHECK(json_hash_text(copy) == json_hash_text(menu));
+	CHECK(json_hash_text("") != json_hash_text(" "));
+	CHECK(json_hash_text("12345678") != json_hash_text("123456789"));
+
+	/* Changing any one byte changes the hash. */
+	for (i = 0; i < sizeof(menu) - 1; i++) {
+		copy[i] ^= 1;
+		CHECK(json_hash_text(copy) != json_hash_text(menu));
+		copy[i] ^= 1;
+	}
+}
+
+typedef struct {
+	char *text;
+	size_t length;
+	size_t largest;
+	int calls;
+	int fail_after;
+} WriteLog;
+
+static bool log_write(const char *data, size_t length, void *ctx)
+{
+	WriteLog *log = ctx;
+
+	log->text = realloc(log->text, log->length + length + 1);
+	memcpy(log->text + log->length, data, length);
+	log->length += length;
+	log->text[log->length] = 0;
+	if (length > log->largest)
+		log->largest = length;
+	return ++log->calls != log->fail_after;
+}
+
+static void test_write(void)
+{
+	WriteLog log;
+	JsonNode *node, *items;
+	char *expected, icon[5000];
+	int i, indented;
+
+	node = json_mkobject();
+	items = json_mkarray();
+	for (i = 0; i < 500; i++)
+		json_append_element(items, json_mkstring("An item with a longish label \"quoted\" \xc3\xa9"));
+	json_append_member(node, "Items", items);
+	memset(icon, 'A', sizeof(icon) - 1);
+	icon[sizeof(icon) - 1] = 0;
+	json_append_member(node, "Icon", json_mkstring(icon));
+
+	for (indented = 0; indented < 2; indented++) {
+		const char *space = indented ? "\t" : NULL;
+
+		memset(&log, 0, sizeof(log));
+		CHECK(json_write(node, log_write, &log, space));
+		expected = json_stringify(node, space);
+		CHECK(log.text != NULL && strcmp(log.text, expected) == 0);
+		CHECK(log.calls > 1 && log.largest <= 4096);
+		free(log.text);
+		free(expected);
+	}
+
+	/* Output stops at the first failed write. */
+	memset(&log, 0, sizeof(log));
+	log.fail_after = 2;
+	CHECK(!json_write(node, log_write, &log, NULL));
+	CHECK(log.calls == 2);
+	free(log.text);
+
+	/* Byte strings are written in pieces too. */
+	expected = json_encode(node);
+	CHECK(json_encoded_length(node) == strlen(expected));
+	free(expected);
+	json_delete(node);
+}
+
+int main(void)
+{
+	test_encode_number();
+	test_encode_non_finite();
+	test_number_round_trip();
+	test_integers_are_exact();
+	test_integer_bounds();
+	test_encode_into();
+	test_plain_runs();
+	test_arena();
+	test_insitu();
+	test_member_index();
+	test_element_index();
+	test_indexed_array_removal();
+	test_parser();
+	test_tape();
+	test_compact();
+	test_intern();
+	test_extract();
+	test_menu_schema();
+	test_merge_patch();
+	test_patch();
+	test_patch_large();
+	test_hash_text();
+	test_write();
+#ifndef JSON_NO_POOL
+	test_pool();
+#endif
+
+	if (failures != 0) {
+		fprintf(stderr, "FAIL: %d checks failed\n", failures);
+		return 1;
+	}
+	printf("PASS\n");
+	return 0;
+}
@@ -29,24 +29,28 @@ TrayMenu* NewTrayMenu(const char* menuJSON) {
     // TODO: Make this configurable
     result->trayIconPosition = NSImageLeft;
 
-    result->ID = mustJSONString(processedJSON, "ID");
-    result->label = mustJSONString(processedJSON, "Label");
-    result->icon = mustJSONString(processedJSON, "Image");
-    result->fontName = getJSONString(processedJSON, "FontName");
-    result->RGBA = getJSONString(processedJSON, "RGBA");
-    getJSONBool(processedJSON, "MacTemplateImage", &result->templateImage);
-    result->fontSize = 0;
-    getJSONInt(processedJSON, "FontSize", &result->fontSize);
-    result->tooltip = NULL;
-    result->tooltip = getJSONString(processedJSON, "Tooltip");
-    result->disabled = false;
-    getJSONBool(processedJSON, "Disabled", &result->disabled);
-
-    result->styledLabel = getJSONObject(processedJSON, "StyledLabel");
+    // Read all the fields in one go
+    TrayMenuFields fields;
+    ReadTrayMenuFields(processedJSON, &fields);
+
+    result->ID = fields.ID;
+    result->label = fields.label;
+    result->icon = fields.icon;
+    result->fontName = fields.fontName;
+    result->RGBA = fields.RGBA;
+    result->templateImage = fields.templateImage;
+    result->fontSize = fields.fontSize;
+    result->tooltip = fields.tooltip;
+    result->disabled = fields.disabled;
+
+    result->styledLabel = fields.styledLabel;
 
     // Create the menu
-    JsonNode* processedMenu = mustJSONObject(processedJSON, "ProcessedMenu");
-    result->menu = NewMenu(processedMenu);
+    if( fields.processedMenu == NULL ) {
+        ABORT("[NewTrayMenu] Unable to read required key 'ProcessedMenu' from JSON: %s", menuJSON);
+    }
+    result->menu = NewMenu(fields.processedMenu);
+    result->menu->hash = json_hash_text(menuJSON);
 
     result->delegate = NULL;
 
@@ -223,8 +227,9 @@ void DeleteTrayMenuKeepStatusBarItem(TrayMenu* trayMenu) {
 
 void LoadTrayIcons() {
 
-    // Allocate the Tray Icons
-    if( 0 != hashmap_create((const unsigned)4, &trayIconCache)) {
+    // Allocate the Tray Icons. Icon names are short, so it keeps them
+    // inline rather than pointing into the icon table
+    if( 0 != hashmap_create_owned((const unsigned)4, &trayIconCache)) {
         // Couldn't allocate map
         ABORT("Not enough memory to allocate trayIconCache!");
     }
@@ -11,8 +11,9 @@ TrayMenuStore* NewTrayMenuStore() {
 
     TrayMenuStore* result = malloc(sizeof(TrayMenuStore));
 
-    // Allocate Tray Menu Store
-    if( 0 != hashmap_create((const unsigned)4, &result->trayMenuMap)) {
+    // Allocate Tray Menu Store. It keeps its own copy of the menu IDs, as
+    // they live in the JSON of menus that get replaced
+    if( 0 != hashmap_create_owned((const unsigned)4, &result->trayMenuMap)) {
         ABORT("[NewTrayMenuStore] Not enough memory to allocate trayMenuMap!");
     }
 
@@ -113,28 +114,46 @@ void UpdateTrayMenuLabelInStore(TrayMenuStore* store, const char* JSON) {
     JsonNode *parsedUpdate = mustParseJSON(JSON);
 
     // Get the data out
-    const char* ID = mustJSONString(parsedUpdate, "ID");
-    const char* Label = mustJSONString(parsedUpdate, "Label");
+    TrayLabelFields fields;
+    ReadTrayLabelFields(parsedUpdate, &fields);
 
     // Check we have this menu
-    TrayMenu *menu = MustGetTrayMenuFromStore(store, ID);
-
-    const char *fontName = getJSONString(parsedUpdate, "FontName");
-    const char *RGBA = getJSONString(parsedUpdate, "RGBA");
-    int fontSize = 0;
-    getJSONInt(parsedUpdate, "FontSize", &fontSize);
-    const char *tooltip = getJSONString(parsedUpdate, "Tooltip");
-    bool disabled = false;
-    getJSONBool(parsedUpdate, "Disabled", &disabled);
+    TrayMenu *menu = MustGetTrayMenuFromStore(store, fields.ID);
 
-    JsonNode *styledLabel = getJSONObject(parsedUpdate, "StyledLabel");
+    UpdateTrayLabel(menu, fields.label, fields.fontName, fields.fontSize, fields.RGBA, fields.tooltip, fields.disabled, fields.styledLabel);
 
-    UpdateTrayLabel(menu, Label, fontName, fontSize, RGBA, tooltip, disabled, styledLabel);
+    // The label no longer matches the menu's JSON, so resending that must rebuild it
+    MarkMenuChanged(menu->menu);
 
     json_delete(parsedUpdate);
 }
 
+int trayMenuBuiltFrom(void *const context, struct hashmap_element_s *const e) {
+    TrayMenu *menu = e->data;
+    // A positive result stops the iteration
+    return MenuBuiltFrom(menu->menu, *(uint64_t*)context) ? 1 : 0;
+}
+
+// Whether a stored tray menu was built from exactly this JSON and has not
+// changed since. Identical JSON means an identical ID, so only the hashes of
+// the stored menus need checking and nothing has to be parsed
+bool trayMenuUnchanged(TrayMenuStore* store, const char* menuJSON) {
+    uint64_t hash = json_hash_text(menuJSON);
+
+    pthread_mutex_lock(&store->lock);
+    bool unchanged = hashmap_iterate_pairs(&store->trayMenuMap, trayMenuBuiltFrom, &hash) > 0;
+    pthread_mutex_unlock(&store->lock);
+    return unchanged;
+}
+
 void UpdateTrayMenuInStore(TrayMenuStore* store, const char* menuJSON) {
+
+    // Nothing to parse or rebuild if this menu is already showing
+    if( trayMenuUnchanged(store, menuJSON) ) {
+        CountSkippedMenuRebuild();
+        return;
+    }
+
     TrayMenu* newMenu = NewTrayMenu(menuJSON);
 //    DumpTrayMenu(newMenu);
 